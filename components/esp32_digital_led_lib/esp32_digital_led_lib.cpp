@@ -211,16 +211,45 @@ void digitalLeds_resetPixels(strand_t * pStrand)
   digitalLeds_updatePixels(pStrand);
 }
 
-int IRAM_ATTR digitalLeds_updatePixels(strand_t * pStrand)
+static IRAM_ATTR void waitForPreviousUpdate(digitalLeds_stateData * pState)
 {
-  digitalLeds_stateData * pState = static_cast<digitalLeds_stateData*>(pStrand->_stateVars);
-
   if (pState->sem) {
     // Wait for any previously updating pixels.
     xSemaphoreTake(pState->sem, portMAX_DELAY);
     vSemaphoreDelete(pState->sem);
     pState->sem = nullptr;
   }
+}
+
+static IRAM_ATTR void startUpdate(strand_t * pStrand)
+{
+  digitalLeds_stateData * pState = static_cast<digitalLeds_stateData*>(pStrand->_stateVars);
+
+  pState->buf_pos = 0;
+  pState->buf_half = 0;
+
+  copyToRmtBlock_half(pStrand);
+
+  if (pState->buf_pos < pState->buf_len) {
+    // Fill the other half of the buffer block
+    #if DEBUG_ESP32_DIGITAL_LED_LIB
+      snprintf(digitalLeds_debugBuffer, digitalLeds_debugBufferSz,
+               "%s# ", digitalLeds_debugBuffer);
+    #endif
+    copyToRmtBlock_half(pStrand);
+  }
+
+  pState->sem = xSemaphoreCreateBinary();
+
+  RMT.conf_ch[pStrand->rmtChannel].conf1.mem_rd_rst = 1;
+  RMT.conf_ch[pStrand->rmtChannel].conf1.tx_start = 1;
+}
+
+int IRAM_ATTR digitalLeds_updatePixels(strand_t * pStrand)
+{
+  digitalLeds_stateData * pState = static_cast<digitalLeds_stateData*>(pStrand->_stateVars);
+
+  waitForPreviousUpdate(pState);
 
   ledParams_t ledParams = ledParamsAll[pStrand->ledType];
 
@@ -246,24 +275,48 @@ int IRAM_ATTR digitalLeds_updatePixels(strand_t * pStrand)
     return -1;
   }
 
-  pState->buf_pos = 0;
-  pState->buf_half = 0;
+  startUpdate(pStrand);
 
-  copyToRmtBlock_half(pStrand);
+  return 0;
+}
 
-  if (pState->buf_pos < pState->buf_len) {
-    // Fill the other half of the buffer block
-    #if DEBUG_ESP32_DIGITAL_LED_LIB
-      snprintf(digitalLeds_debugBuffer, digitalLeds_debugBufferSz,
-               "%s# ", digitalLeds_debugBuffer);
-    #endif
-    copyToRmtBlock_half(pStrand);
-  }
+uint32_t digitalLeds_packColor(pixelColor_t color)
+{
+  // Bytes are stored in the order they go out on the wire (GRB or GRBW),
+  // so indexed updates can copy them without reordering
+  uint8_t bytes[4] = {color.g, color.r, color.b, color.w};
+  uint32_t packed;
+  memcpy(&packed, bytes, sizeof(packed));
+  return packed;
+}
 
-  pState->sem = xSemaphoreCreateBinary();
+int IRAM_ATTR digitalLeds_updatePixelsIndexed(strand_t * pStrand, const uint8_t * indices, const uint32_t * palette)
+{
+  digitalLeds_stateData * pState = static_cast<digitalLeds_stateData*>(pStrand->_stateVars);
 
-  RMT.conf_ch[pStrand->rmtChannel].conf1.mem_rd_rst = 1;
-  RMT.conf_ch[pStrand->rmtChannel].conf1.tx_start = 1;
+  waitForPreviousUpdate(pState);
+
+  ledParams_t ledParams = ledParamsAll[pStrand->ledType];
+
+  // Expand palette indices straight into the transmission buffer
+  if (ledParams.bytesPerPixel == 3) {
+    for (uint16_t i = 0; i < pStrand->numPixels; i++) {
+      const uint8_t * packed = reinterpret_cast<const uint8_t*>(&palette[indices[i]]);
+      pState->buf_data[0 + i * 3] = packed[0];
+      pState->buf_data[1 + i * 3] = packed[1];
+      pState->buf_data[2 + i * 3] = packed[2];
+    }
+  }
+  else if (ledParams.bytesPerPixel == 4) {
+    for (uint16_t i = 0; i < pStrand->numPixels; i++) {
+      memcpy(&pState->buf_data[i * 4], &palette[indices[i]], 4);
+    }
+  }
+  else {
+    return -1;
+  }
+
+  startUpdate(pStrand);
 
   return 0;
 }
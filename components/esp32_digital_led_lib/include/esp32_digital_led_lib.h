@@ -96,7 +96,7 @@ enum led_types {
   LED_SK6812W_V1,
 };
 
-const ledParams_t ledParamsAll[] = {  // Still must match order of `led_types`
+static const ledParams_t ledParamsAll[] = {  // Still must match order of `led_types`
   [LED_WS2812_V1]  = { .bytesPerPixel = 3, .T0H = 350, .T1H = 700, .T0L = 800, .T1L = 600, .TRS =  50000},
   [LED_WS2812B_V1] = { .bytesPerPixel = 3, .T0H = 350, .T1H = 900, .T0L = 900, .T1L = 350, .TRS =  50000}, // Older datasheet
   [LED_WS2812B_V2] = { .bytesPerPixel = 3, .T0H = 400, .T1H = 850, .T0L = 850, .T1L = 400, .TRS =  50000}, // 2016 datasheet
@@ -111,6 +111,8 @@ const ledParams_t ledParamsAll[] = {  // Still must match order of `led_types`
 extern int digitalLeds_initStrands(strand_t strands [], int numStrands);
 extern int digitalLeds_updatePixels(strand_t * strand);
 extern void digitalLeds_resetPixels(strand_t * pStrand);
+extern uint32_t digitalLeds_packColor(pixelColor_t color);
+extern int digitalLeds_updatePixelsIndexed(strand_t * pStrand, const uint8_t * indices, const uint32_t * palette);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,51 @@
+#ifndef ANIM_FORMAT_H
+#define ANIM_FORMAT_H
+
+#include <stdint.h>
+
+// Precomputed animation format, as written by tools/anim_encode.py
+//
+// animHeader
+// palette      paletteSize RGB triplets, only present when paletteSize > 0
+// frames       frameCount frames, each an animFrameHeader then its records
+//
+// Pixels are numbered row by row from the top left of the animation. A pixel
+// is an RGB triplet, or a single palette entry when the animation has a palette.
+//
+// A frame is a list of records. Each record is a skip count and a pixel count
+// (both uint8) followed by that many pixels, or by a single pixel repeated
+// that many times when the frame is run length encoded. A record with a pixel
+// count of 0 has no pixel data and is used for skips over 255. Skipped pixels keep
+// their value from the previous frame, or are black in a key frame.
+
+#define ANIM_MAGIC "LFAN"
+#define ANIM_VERSION 1
+
+#define ANIM_FRAME_KEY 0
+#define ANIM_FRAME_DELTA 1
+
+#define ANIM_ENCODING_RAW 0
+#define ANIM_ENCODING_RLE 1
+
+typedef struct __attribute__((packed)) animHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t width;
+    uint16_t height;
+    uint16_t frameCount;
+    uint16_t frameMillis;
+    uint16_t paletteSize;
+    // Length of everything after the header
+    uint32_t dataLength;
+} animHeader;
+
+typedef struct __attribute__((packed)) animFrameHeader {
+    uint8_t type;
+    uint8_t encoding;
+    uint16_t reserved;
+    // Length of the frame's records
+    uint32_t length;
+} animFrameHeader;
+
+#endif /* ANIM_FORMAT_H */
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "frame_base.h"
+#include "anim_format.h"
+
+#define ANIM_PARTITION_SUBTYPE 0x40
+#define ANIM_PARTITION_LABEL "anim"
+
+static const char *TAG = "scene anim";
+
+// Frames are decoded straight from the memory mapped partition, so only the
+// palette and a few pointers are held in RAM
+static const esp_partition_t *partition = NULL;
+static spi_flash_mmap_handle_t mmapHandle;
+static const void *mapped = NULL;
+static const animHeader *header = NULL;
+static const uint8_t *firstFrame = NULL;
+static const uint8_t *nextFrame = NULL;
+static const uint8_t *dataEnd = NULL;
+static uint16_t frameNum = 0;
+static uint32_t palette[PALETTE_SIZE];
+static bool restartPending = false;
+// When interpolating, frames are decoded here and blended into the scene's frame
+static frameBuffer decoded;
+static bool interpolating = false;
+static size_t writeOffset = 0;
+
+// Held while decoding and while the partition is remapped for an upload
+static SemaphoreHandle_t mapLock = NULL;
+
+static uint32_t lastMillis = 0;
+
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_clear_frame(frameBuffer *frame);
+bool interpolation_enabled(interpolateSource source);
+void interpolation_reset(interpolateSource source);
+void interpolation_push(interpolateSource source, const pixelColor_t *pixels, uint32_t sourceMillis, uint32_t localMillis);
+bool interpolation_render(interpolateSource source, pixelColor_t *out, uint32_t localMillis);
+
+
+static void anim_unmap()
+{
+    if (mapped != NULL) {
+        spi_flash_munmap(mmapHandle);
+        mapped = NULL;
+    }
+    header = NULL;
+}
+
+static bool anim_map()
+{
+    if (partition == NULL) {
+        return false;
+    }
+    if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &mmapHandle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error mapping animation partition");
+        mapped = NULL;
+        return false;
+    }
+
+    const animHeader *mappedHeader = (const animHeader *) mapped;
+    if (memcmp(mappedHeader->magic, ANIM_MAGIC, sizeof(mappedHeader->magic)) != 0
+            || mappedHeader->version != ANIM_VERSION
+            || mappedHeader->width == 0
+            || mappedHeader->height == 0
+            || mappedHeader->paletteSize > PALETTE_SIZE
+            || mappedHeader->dataLength > partition->size - sizeof(animHeader)
+            || mappedHeader->paletteSize * 3 > mappedHeader->dataLength
+            || mappedHeader->frameCount == 0
+            || mappedHeader->frameMillis == 0) {
+        ESP_LOGI(TAG, "No valid animation stored");
+        anim_unmap();
+        return false;
+    }
+
+    const uint8_t *paletteData = (const uint8_t *) mapped + sizeof(animHeader);
+    for (uint16_t i = 0; i < mappedHeader->paletteSize; i++) {
+        pixelColor_t colour = {
+            .r = paletteData[i * 3],
+            .g = paletteData[i * 3 + 1],
+            .b = paletteData[i * 3 + 2],
+            .w = 0,
+        };
+        palette[i] = digitalLeds_packColor(colour);
+    }
+
+    header = mappedHeader;
+    firstFrame = paletteData + header->paletteSize * 3;
+    dataEnd = (const uint8_t *) mapped + sizeof(animHeader) + header->dataLength;
+    ESP_LOGI(TAG, "Animation: %d x %d, %d frames, %d ms per frame, palette size = %d", header->width, header->height, header->frameCount, header->frameMillis, header->paletteSize);
+    return true;
+}
+
+static inline void set_pixel(frameBuffer *frame, uint16_t col, uint16_t row, const uint8_t *pixel)
+{
+    // Animations cover the canvas, each frame shows its own part of it
+    int16_t idx = canvasPixelIdx(col, row);
+    if (idx < 0) {
+        return;
+    }
+    if (header->paletteSize > 0) {
+        frame->indices[idx] = pixel[0];
+    } else {
+        frame->pixels[idx].r = pixel[0];
+        frame->pixels[idx].g = pixel[1];
+        frame->pixels[idx].b = pixel[2];
+        frame->pixels[idx].w = 0;
+    }
+}
+
+// Decodes one frame into the frame buffer and returns the start of the next
+// frame, or NULL if the frame runs past the end of the data
+static const uint8_t *decode_frame(frameBuffer *frame, const uint8_t *data)
+{
+    if (dataEnd - data < (int32_t) sizeof(animFrameHeader)) {
+        return NULL;
+    }
+    const animFrameHeader *frameHeader = (const animFrameHeader *) data;
+    const uint8_t *record = data + sizeof(animFrameHeader);
+    const uint8_t *recordsEnd = record + frameHeader->length;
+    if (frameHeader->length > (uint32_t) (dataEnd - record)) {
+        return NULL;
+    }
+
+    if (frameHeader->type == ANIM_FRAME_KEY) {
+        leds_clear_frame(frame);
+    }
+
+    uint8_t pixelSize = header->paletteSize > 0 ? 1 : 3;
+    bool rle = frameHeader->encoding == ANIM_ENCODING_RLE;
+    uint32_t col = 0;
+    uint32_t row = 0;
+
+    while (recordsEnd - record >= 2) {
+        uint8_t skip = record[0];
+        uint8_t count = record[1];
+        record += 2;
+
+        // Records with no pixels only skip, so have no data either
+        uint16_t dataSize = rle && count > 0 ? pixelSize : count * pixelSize;
+        if (recordsEnd - record < dataSize) {
+            return NULL;
+        }
+
+        // A division rather than a loop, so no skip can keep the render task here
+        col += skip;
+        row += col / header->width;
+        col %= header->width;
+        if (row > header->height) {
+            return NULL;
+        }
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (row >= header->height) {
+                return NULL;
+            }
+            set_pixel(frame, col, row, rle ? record : record + i * pixelSize);
+            if (++col == header->width) {
+                col = 0;
+                row++;
+            }
+        }
+        record += dataSize;
+    }
+
+    return recordsEnd;
+}
+
+void anim_scene_initialise()
+{
+    mapLock = xSemaphoreCreateMutex();
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ANIM_PARTITION_SUBTYPE, ANIM_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGI(TAG, "No animation partition found");
+        return;
+    }
+    anim_map();
+}
+
+bool anim_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    bool drawn = false;
+
+    if (xSemaphoreTake(mapLock, 0) != pdTRUE) {
+        return false;
+    }
+
+    if (interpolation_enabled(INTERPOLATE_ANIM) != interpolating) {
+        restartPending = true;
+    }
+    frameBuffer *target = interpolating ? &decoded : frame;
+
+    if (restartPending) {
+        interpolating = interpolation_enabled(INTERPOLATE_ANIM);
+        target = interpolating ? &decoded : frame;
+        leds_clear_frame(target);
+        leds_set_palette(target, header != NULL && header->paletteSize > 0 ? palette : NULL);
+        if (interpolating) {
+            leds_clear_frame(frame);
+            leds_set_palette(frame, NULL);
+            interpolation_reset(INTERPOLATE_ANIM);
+        }
+        nextFrame = firstFrame;
+        frameNum = 0;
+        restartPending = false;
+    }
+
+    if (header != NULL && currMillis - lastMillis >= header->frameMillis) {
+        nextFrame = decode_frame(target, nextFrame);
+        if (nextFrame == NULL || ++frameNum == header->frameCount) {
+            if (nextFrame == NULL) {
+                ESP_LOGI(TAG, "Frame %d is not valid, restarting", frameNum);
+            }
+            nextFrame = firstFrame;
+            frameNum = 0;
+        }
+        lastMillis = currMillis;
+        drawn = true;
+
+        if (interpolating) {
+            pixelColor_t pixels[NUM_PIXELS];
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                pixels[i] = framePixel(&decoded, i);
+            }
+            interpolation_push(INTERPOLATE_ANIM, pixels, currMillis, currMillis);
+        }
+    }
+    if (interpolating) {
+        drawn = interpolation_render(INTERPOLATE_ANIM, frame->pixels, currMillis);
+    }
+
+    xSemaphoreGive(mapLock);
+    return drawn;
+}
+
+void anim_scene_init()
+{
+    lastMillis = 0;
+    // The frame's palette is set when playback restarts on the next update
+    restartPending = true;
+}
+
+esp_err_t anim_scene_write_begin(size_t length)
+{
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (length < sizeof(animHeader) || length > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Stop playback while the partition is rewritten
+    xSemaphoreTake(mapLock, portMAX_DELAY);
+    anim_unmap();
+    xSemaphoreGive(mapLock);
+
+    writeOffset = 0;
+    size_t eraseLength = (length + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    return esp_partition_erase_range(partition, 0, eraseLength);
+}
+
+esp_err_t anim_scene_write(const char *data, size_t length)
+{
+    if (writeOffset + length > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = esp_partition_write(partition, writeOffset, data, length);
+    writeOffset += length;
+    return err;
+}
+
+esp_err_t anim_scene_write_end()
+{
+    xSemaphoreTake(mapLock, portMAX_DELAY);
+    bool valid = anim_map();
+    restartPending = true;
+    xSemaphoreGive(mapLock);
+
+    return valid ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,28 @@
+#ifndef AUDIO_FORMAT_H
+#define AUDIO_FORMAT_H
+
+#include <stdint.h>
+
+// Multicast audio format, as sent by tools/audio_send.py
+//
+// Each UDP datagram is an audioPacketHeader followed by sampleCount samples
+// of each channel, interleaved, as signed 16 bit little endian PCM. seq goes
+// up by one each packet so lost packets can be counted.
+
+#define AUDIO_MAGIC "LFAU"
+#define AUDIO_VERSION 1
+
+#define AUDIO_MAX_PACKET_BYTES 1472
+#define AUDIO_MAX_CHANNELS 2
+
+typedef struct __attribute__((packed)) audioPacketHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t channels;
+    uint16_t sampleRate;
+    uint16_t sampleCount;
+    uint16_t reserved;
+    uint32_t seq;
+} audioPacketHeader;
+
+#endif /* AUDIO_FORMAT_H */
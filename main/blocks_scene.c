@@ -1,195 +1,202 @@
 #include <stdio.h>
 #include <esp_log.h>
-#include <esp_system.h>
 #include "frame_base.h"
 
 static const char *TAG = "scene blocks";
 
-#define BLOCK_SIZE 2
-#define NUM_BLOCK_COLS (PIXELS_PER_ROW / BLOCK_SIZE)
-#define NUM_BLOCK_ROWS (NUM_ROWS / BLOCK_SIZE)
-#define NUM_BLOCKS (NUM_BLOCK_COLS * NUM_BLOCK_ROWS)
-
-typedef struct block {
-    uint8_t row;
-    bool halfRow;
-    float hue;
-    float sat;
-    float value;
-    bool falling;
-} block;
-
-static block blocks[NUM_BLOCK_COLS][NUM_BLOCK_ROWS];
-static bool colsComplete[NUM_BLOCK_COLS];
-static uint8_t activeCol = 0;
+// Limits of the block grid, which is the canvas divided into blocks
+#define MAX_BLOCK_COLS 128
+#define MAX_BLOCK_ROWS 255
+
+typedef struct fallingBlock {
+    uint8_t col;
+    // Canvas row of the block's top edge, negative while still above the canvas
+    int16_t top;
+    pixelColor_t colour;
+} fallingBlock;
+
+// Each column only keeps how many blocks have landed in it. Settled blocks are
+// left in the frame, so a step only draws the rows of the falling blocks that
+// moved: one row is cleared at the top of each and one drawn at the bottom.
+static uint8_t heights[MAX_BLOCK_COLS];
+static fallingBlock falling[MAX_BLOCK_COLS];
+static uint8_t numFalling = 0;
+// Columns with room for another block and nothing falling in them
+static uint8_t openCols[MAX_BLOCK_COLS];
+static uint8_t numOpen = 0;
+static uint8_t numBlockCols = 0;
+static uint8_t numBlockRows = 0;
+
 static uint16_t millisBeforeMove = 300;
 static uint8_t movesBeforeColsCompleteReset = 3;
+static uint8_t blockSize = 2;
+static uint8_t maxFalling = 1;
 static uint8_t movesSinceComplete = 0;
+static bool resetPending = true;
+static float hue = 0.01;
+static uint32_t randomState = 0;
 
 static uint32_t lastMillis = 0;
 
-void leds_set_pixel(int pixel, float hue, float sat, float value);
-void leds_clear(bool updateLeds);
-void leds_update();
+void leds_clear_frame(frameBuffer *frame);
+pixelColor_t leds_hsv_colour(float hue, float sat, float value);
+
 
 static void reset_blocks()
 {
-    float hue = 0.01;
-    for (uint8_t col = 0; col < NUM_BLOCK_COLS; col++) {
-        for (uint8_t colBlock = 0; colBlock < NUM_BLOCK_ROWS; colBlock++) {
-            blocks[col][colBlock].row = 0;
-            blocks[col][colBlock].halfRow = false;
-            blocks[col][colBlock].hue = hue;
-            blocks[col][colBlock].sat = 1;
-            blocks[col][colBlock].value = 0.1;
-            blocks[col][colBlock].falling = false;
-            switch (esp_random() % 5) {
-                case 0:
-                    hue += 0.01;
-                    break;
-                case 1:
-                    hue += 0.25;
-                    break;
-                case 2:
-                    hue += 0.05;
-                    break;
-                case 3:
-                    hue += 0.11;
-                    break;
-                case 4:
-                    hue += 0.33;
-                    break;
-            }
-        }
-        colsComplete[col] = false;
+    const canvasConfig *canvas = getCanvas();
+    numBlockCols = canvas->width / blockSize < MAX_BLOCK_COLS ? canvas->width / blockSize : MAX_BLOCK_COLS;
+    numBlockRows = canvas->height / blockSize < MAX_BLOCK_ROWS ? canvas->height / blockSize : MAX_BLOCK_ROWS;
+
+    for (uint8_t col = 0; col < numBlockCols; col++) {
+        heights[col] = 0;
+        openCols[col] = col;
     }
+    numOpen = numBlockRows > 0 ? numBlockCols : 0;
+    numFalling = 0;
+    movesSinceComplete = 0;
 }
 
-void blocks_scene_update(uint32_t currMillis)
+static pixelColor_t next_colour()
 {
-    uint32_t elapsedMillis = currMillis - lastMillis;
-
-    if (elapsedMillis >= millisBeforeMove) {
-        leds_clear(false);
-
-        for (uint8_t col = 0; col < NUM_BLOCK_COLS; col++) {
-            for (uint8_t colBlock = 0; colBlock < NUM_BLOCK_ROWS; colBlock++) {
-                if (blocks[col][colBlock].row == 0 && !blocks[col][colBlock].halfRow) {
-                    continue;
-                }
-                for (uint8_t i = 0; i < BLOCK_SIZE; i++) {
-                    if (blocks[col][colBlock].row == 0 && !blocks[col][colBlock].halfRow) {
-                        continue;
-                    }
-                    uint8_t x = (col * BLOCK_SIZE);
-                    uint8_t y = ((blocks[col][colBlock].row - 1) * BLOCK_SIZE) + i;
-                    if (blocks[col][colBlock].halfRow) {
-                        y++;
-                    }
-                    leds_set_pixel(
-                        pixelIdx(x, y),
-                        blocks[col][colBlock].hue,
-                        blocks[col][colBlock].sat,
-                        blocks[col][colBlock].value
-                    );
-                    leds_set_pixel(
-                        pixelIdx(x + 1, y),
-                        blocks[col][colBlock].hue,
-                        blocks[col][colBlock].sat,
-                        blocks[col][colBlock].value
-                    );
-                }
-            }
-        }
+    static const float hueSteps[] = {0.01, 0.25, 0.05, 0.11, 0.33};
 
-        leds_update();
+    pixelColor_t colour = leds_hsv_colour(hue, 1, 0.1);
+    hue += hueSteps[canvasRandom(&randomState) % (sizeof(hueSteps) / sizeof(hueSteps[0]))];
+    if (hue >= 1) {
+        hue -= 1;
+    }
+    return colour;
+}
 
-        uint8_t numColsRemaining = 0;
-        uint8_t remainingCols[NUM_BLOCK_COLS];
-        for (uint8_t i = 0; i < NUM_BLOCK_COLS; i++) {
-            if (!colsComplete[i]) {
-                remainingCols[numColsRemaining] = i + 1;
-                numColsRemaining++;
-            }
-        }
-        // Select next column
-        if (activeCol == 0 && numColsRemaining > 0) {
-            uint8_t selectedColIdx = esp_random() % numColsRemaining;
-            activeCol = remainingCols[selectedColIdx];
-            printf("active col: %d\n", activeCol);
-        }
+// Every frame of a canvas takes the same random choices, so the same columns
+// are picked everywhere
+static void start_blocks()
+{
+    while (numFalling < maxFalling && numOpen > 0) {
+        uint8_t openIdx = canvasRandom(&randomState) % numOpen;
+        fallingBlock *block = &falling[numFalling++];
+        block->col = openCols[openIdx];
+        block->top = -blockSize;
+        block->colour = next_colour();
+        openCols[openIdx] = openCols[--numOpen];
+    }
+}
 
-        if (activeCol > 0) {
-            uint8_t colIdx = activeCol - 1;
-
-            for (uint8_t colBlock = 0; colBlock < NUM_BLOCK_ROWS; colBlock++) {
-                // Skip blocks that have finished falling
-                if (blocks[colIdx][colBlock].row > 0 && !blocks[colIdx][colBlock].falling) continue;
-
-                // Find the current top of the column and find whether there is already a falling block
-                bool canMove = true;
-                uint8_t columnTop = NUM_BLOCK_ROWS;
-                for (uint8_t checkColBlock = 0; checkColBlock < NUM_BLOCK_ROWS; checkColBlock++) {
-                    if (checkColBlock == colBlock) continue;
-                    if (blocks[colIdx][checkColBlock].falling) {
-                        canMove = false;
-                    } else if (blocks[colIdx][checkColBlock].row > 0) {
-                        if (blocks[colIdx][checkColBlock].row == columnTop) {
-                            columnTop = blocks[colIdx][checkColBlock].row - 1;
-                        }
-                    }
-                }
-
-                if (canMove) {
-                    blocks[colIdx][colBlock].falling = true;
-
-                    if (blocks[colIdx][colBlock].row < columnTop) {
-                        if (!blocks[colIdx][colBlock].halfRow) {
-                            blocks[colIdx][colBlock].halfRow = true;
-                        } else {
-                            blocks[colIdx][colBlock].halfRow = false;
-                            if (++blocks[colIdx][colBlock].row == columnTop) {
-                                blocks[colIdx][colBlock].falling = false;
-                            }
-                            if (columnTop == 1) {
-                                colsComplete[colIdx] = true;
-                                activeCol = 0;
-                            }
-                        }
-                    }
-
-                    break;
-                }
-            }
+static void draw_row(frameBuffer *frame, uint8_t col, int16_t row, pixelColor_t colour)
+{
+    if (row < 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < blockSize; i++) {
+        int16_t idx = canvasPixelIdx(col * blockSize + i, row);
+        if (idx >= 0) {
+            frame->pixels[idx] = colour;
         }
+    }
+}
+
+bool blocks_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    if (currMillis - lastMillis < millisBeforeMove) {
+        return false;
+    }
+    lastMillis = currMillis;
 
-        if (numColsRemaining == 0) {
-            if (++movesSinceComplete > movesBeforeColsCompleteReset) {
-                movesSinceComplete = 0;
-                reset_blocks();
-            }
+    if (resetPending) {
+        leds_clear_frame(frame);
+        reset_blocks();
+        resetPending = false;
+    }
+
+    start_blocks();
+
+    if (numFalling == 0 && numOpen == 0) {
+        // Every column is full, hold it for a few moves before starting again
+        if (++movesSinceComplete > movesBeforeColsCompleteReset) {
+            resetPending = true;
         }
+        return false;
+    }
 
-        lastMillis = currMillis;
+    const pixelColor_t black = {0};
+    const canvasConfig *canvas = getCanvas();
+    uint8_t i = 0;
+    while (i < numFalling) {
+        fallingBlock *block = &falling[i];
+        draw_row(frame, block->col, block->top, black);
+        block->top++;
+        draw_row(frame, block->col, block->top + blockSize - 1, block->colour);
+
+        // Stacks are built up from the bottom of the canvas
+        int16_t landingTop = canvas->height - (heights[block->col] + 1) * blockSize;
+        if (block->top < landingTop) {
+            i++;
+            continue;
+        }
+        if (++heights[block->col] < numBlockRows) {
+            openCols[numOpen++] = block->col;
+        }
+        *block = falling[--numFalling];
     }
+
+    return true;
 }
 
 void blocks_scene_init()
 {
     lastMillis = 0;
-    reset_blocks();
+    hue = 0.01;
+    randomState = getCanvas()->seed;
+    resetPending = true;
+}
+
+void blocks_scene_get_config(blocksSceneConfig *config)
+{
+    config->moveMillis = millisBeforeMove;
+    config->movesBeforeColsReset = movesBeforeColsCompleteReset;
+    config->blockSize = blockSize;
+    config->maxFalling = maxFalling;
 }
 
-void blocks_scene_update_config(cJSON *json)
+void blocks_scene_set_config(const blocksSceneConfig *config)
+{
+    millisBeforeMove = config->moveMillis;
+    movesBeforeColsCompleteReset = config->movesBeforeColsReset;
+    maxFalling = config->maxFalling > 0 ? config->maxFalling : 1;
+    uint8_t newBlockSize = config->blockSize > 0 ? config->blockSize : 1;
+    if (newBlockSize != blockSize) {
+        // The grid changes, so start again from empty columns
+        blockSize = newBlockSize;
+        resetPending = true;
+    }
+}
+
+// Applies the settings present in json on top of config
+void blocks_scene_parse_config(cJSON *json, blocksSceneConfig *config)
 {
     const cJSON *moveMillisJson = cJSON_GetObjectItem(json, "moveMillis");
     if (cJSON_IsNumber(moveMillisJson)) {
-        millisBeforeMove = (uint16_t) moveMillisJson->valueint;
+        config->moveMillis = (uint16_t) moveMillisJson->valueint;
     }
     const cJSON *movesBeforeColsResetJson = cJSON_GetObjectItem(json, "movesBeforeColsReset");
     if (cJSON_IsNumber(movesBeforeColsResetJson)) {
-        movesBeforeColsCompleteReset = (uint8_t) movesBeforeColsResetJson->valueint;
+        config->movesBeforeColsReset = (uint8_t) movesBeforeColsResetJson->valueint;
+    }
+    const cJSON *blockSizeJson = cJSON_GetObjectItem(json, "blockSize");
+    if (cJSON_IsNumber(blockSizeJson) && blockSizeJson->valueint > 0) {
+        config->blockSize = (uint8_t) blockSizeJson->valueint;
     }
+    const cJSON *maxFallingJson = cJSON_GetObjectItem(json, "maxFalling");
+    if (cJSON_IsNumber(maxFallingJson) && maxFallingJson->valueint > 0) {
+        config->maxFalling = (uint8_t) maxFallingJson->valueint;
+    }
+}
 
-    ESP_LOGI(TAG, "Blocks config: move millis = %d, moves before reset = %d", millisBeforeMove, movesBeforeColsCompleteReset);
-}
\ No newline at end of file
+void blocks_scene_print_config(const blocksSceneConfig *config, cJSON *json)
+{
+    cJSON_AddNumberToObject(json, "moveMillis", config->moveMillis);
+    cJSON_AddNumberToObject(json, "movesBeforeColsReset", config->movesBeforeColsReset);
+    cJSON_AddNumberToObject(json, "blockSize", config->blockSize);
+    cJSON_AddNumberToObject(json, "maxFalling", config->maxFalling);
+}
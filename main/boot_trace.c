@@ -0,0 +1,30 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include "frame_base.h"
+
+static const char *TAG = "light frame boot";
+
+static const char *phaseNames[] = {"nvs", "leds", "firstFrame", "wifi", "httpd"};
+// Microseconds since boot each phase was first reached, 0 if not reached yet
+static int64_t phaseMicros[NUM_BOOT_PHASES];
+
+
+void boot_trace_mark(bootPhase phase)
+{
+    if (phaseMicros[phase] != 0) {
+        return;
+    }
+    phaseMicros[phase] = esp_timer_get_time();
+    ESP_LOGI(TAG, "Boot phase %s reached after %d us", phaseNames[phase], (int) phaseMicros[phase]);
+}
+
+void boot_trace_add_stats(cJSON *json)
+{
+    cJSON *bootJson = cJSON_AddObjectToObject(json, "bootMicros");
+    for (uint8_t i = 0; i < NUM_BOOT_PHASES; i++) {
+        if (phaseMicros[i] != 0) {
+            cJSON_AddNumberToObject(bootJson, phaseNames[i], phaseMicros[i]);
+        }
+    }
+}
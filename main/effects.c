@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include "frame_base.h"
+
+static const char *TAG = "effects";
+
+#define MAX_BLUR_RADIUS 3
+// A decay stage's amount is what is kept over this long, however often frames
+// are shown. Faded trails are sent on at this rate once the scene stops drawing.
+#define DECAY_STEP_MILLIS 16
+
+static const char *effectNames[] = {"decay", "blur", "mirror", "hue"};
+static const char *mirrorNames[] = {"none", "horizontal", "vertical", "both"};
+
+// New settings wait in pendingConfig until the render task picks them up
+// before the next frame
+static effectsConfig config;
+static effectsConfig pendingConfig;
+static volatile bool configPending = false;
+static portMUX_TYPE configMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Strand index of each panel pixel, so the kernels work in rows and columns
+static uint8_t pixelMap[NUM_ROWS][PIXELS_PER_ROW];
+static bool pixelMapBuilt = false;
+// The last output of each decay stage
+static pixelColor_t trails[MAX_EFFECT_STAGES][NUM_PIXELS];
+// Set while any trail is still fading
+static bool trailsLit = false;
+static uint32_t lastApplyMillis = 0;
+// Hue rotation matrix of each hue stage, 256 being 1
+static int16_t hueMatrices[MAX_EFFECT_STAGES][3][3];
+// 65536 / n rounded up, to average n pixels with a multiply
+static uint32_t reciprocals[2 * MAX_BLUR_RADIUS + 2];
+
+static uint32_t stageMicros[MAX_EFFECT_STAGES];
+static uint32_t stageMaxMicros[MAX_EFFECT_STAGES];
+
+extern volatile uint32_t millis;
+
+static void build_pixel_map()
+{
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            pixelMap[row][col] = pixelIdx(col, row);
+        }
+    }
+    for (uint8_t n = 1; n < sizeof(reciprocals) / sizeof(reciprocals[0]); n++) {
+        reciprocals[n] = (65536 + n - 1) / n;
+    }
+    pixelMapBuilt = true;
+}
+
+// Rotation about the grey axis, so greys stay grey and brightness is roughly kept
+static void build_hue_matrix(int16_t matrix[3][3], uint8_t shift)
+{
+    float angle = shift * 2 * M_PI / 256;
+    float c = cosf(angle);
+    float s = sinf(angle);
+    float diagonal = c + (1 - c) / 3;
+    float before = (1 - c) / 3 - sqrtf(1.0f / 3) * s;
+    float after = (1 - c) / 3 + sqrtf(1.0f / 3) * s;
+    int16_t coefficients[3] = {
+        (int16_t) lroundf(diagonal * 256),
+        (int16_t) lroundf(before * 256),
+        (int16_t) lroundf(after * 256),
+    };
+    for (uint8_t i = 0; i < 3; i++) {
+        for (uint8_t j = 0; j < 3; j++) {
+            matrix[i][j] = coefficients[(j - i + 3) % 3];
+        }
+    }
+}
+
+// Each channel is the larger of the new pixel and the faded last output, so
+// anything a scene stops drawing fades out behind it. keep is out of 65536,
+// and rounding down takes every trail to black. Returns whether any of the
+// output is lit.
+static bool decay(pixelColor_t *pixels, pixelColor_t *trail, uint32_t keep)
+{
+    uint8_t lit = 0;
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        uint8_t r = (trail[i].r * keep) >> 16;
+        uint8_t g = (trail[i].g * keep) >> 16;
+        uint8_t b = (trail[i].b * keep) >> 16;
+        if (pixels[i].r < r) {
+            pixels[i].r = r;
+        }
+        if (pixels[i].g < g) {
+            pixels[i].g = g;
+        }
+        if (pixels[i].b < b) {
+            pixels[i].b = b;
+        }
+        trail[i] = pixels[i];
+        lit |= pixels[i].r | pixels[i].g | pixels[i].b;
+    }
+    return lit != 0;
+}
+
+// Box blur, a pass along the rows and then one down the columns. Pixels past
+// the edge of the panel are left out of the average.
+static void blur(pixelColor_t *pixels, uint8_t radius)
+{
+    static pixelColor_t rows[NUM_ROWS][PIXELS_PER_ROW];
+
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (int16_t col = 0; col < PIXELS_PER_ROW; col++) {
+            uint32_t r = 0, g = 0, b = 0;
+            uint8_t count = 0;
+            for (int16_t c = col - radius; c <= col + radius; c++) {
+                if (c < 0 || c >= PIXELS_PER_ROW) {
+                    continue;
+                }
+                const pixelColor_t *p = &pixels[pixelMap[row][c]];
+                r += p->r;
+                g += p->g;
+                b += p->b;
+                count++;
+            }
+            rows[row][col].r = (r * reciprocals[count]) >> 16;
+            rows[row][col].g = (g * reciprocals[count]) >> 16;
+            rows[row][col].b = (b * reciprocals[count]) >> 16;
+        }
+    }
+
+    for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+        for (int16_t row = 0; row < NUM_ROWS; row++) {
+            uint32_t r = 0, g = 0, b = 0;
+            uint8_t count = 0;
+            for (int16_t rw = row - radius; rw <= row + radius; rw++) {
+                if (rw < 0 || rw >= NUM_ROWS) {
+                    continue;
+                }
+                r += rows[rw][col].r;
+                g += rows[rw][col].g;
+                b += rows[rw][col].b;
+                count++;
+            }
+            pixelColor_t *p = &pixels[pixelMap[row][col]];
+            p->r = (r * reciprocals[count]) >> 16;
+            p->g = (g * reciprocals[count]) >> 16;
+            p->b = (b * reciprocals[count]) >> 16;
+        }
+    }
+}
+
+// Copies the left half onto the right and/or the top half onto the bottom.
+// Both together make a four way kaleidoscope of the top left quarter.
+static void mirror(pixelColor_t *pixels, uint8_t axes)
+{
+    if (axes & MIRROR_HORIZONTAL) {
+        for (uint8_t row = 0; row < NUM_ROWS; row++) {
+            for (uint8_t col = 0; col < PIXELS_PER_ROW / 2; col++) {
+                pixels[pixelMap[row][PIXELS_PER_ROW - 1 - col]] = pixels[pixelMap[row][col]];
+            }
+        }
+    }
+    if (axes & MIRROR_VERTICAL) {
+        for (uint8_t row = 0; row < NUM_ROWS / 2; row++) {
+            for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+                pixels[pixelMap[NUM_ROWS - 1 - row][col]] = pixels[pixelMap[row][col]];
+            }
+        }
+    }
+}
+
+static inline uint8_t clamp_channel(int32_t value)
+{
+    if (value < 0) {
+        return 0;
+    }
+    return value > 255 ? 255 : value;
+}
+
+static void hue_shift(pixelColor_t *pixels, int16_t matrix[3][3])
+{
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        int32_t r = pixels[i].r;
+        int32_t g = pixels[i].g;
+        int32_t b = pixels[i].b;
+        if ((r | g | b) == 0) {
+            continue;
+        }
+        pixels[i].r = clamp_channel((matrix[0][0] * r + matrix[0][1] * g + matrix[0][2] * b) >> 8);
+        pixels[i].g = clamp_channel((matrix[1][0] * r + matrix[1][1] * g + matrix[1][2] * b) >> 8);
+        pixels[i].b = clamp_channel((matrix[2][0] * r + matrix[2][1] * g + matrix[2][2] * b) >> 8);
+    }
+}
+
+static void take_pending_config()
+{
+    portENTER_CRITICAL(&configMux);
+    config = pendingConfig;
+    configPending = false;
+    portEXIT_CRITICAL(&configMux);
+
+    memset(trails, 0, sizeof(trails));
+    trailsLit = false;
+    memset(stageMicros, 0, sizeof(stageMicros));
+    memset(stageMaxMicros, 0, sizeof(stageMaxMicros));
+    for (uint8_t i = 0; i < config.numStages; i++) {
+        if (config.stages[i].type == EFFECT_HUE) {
+            build_hue_matrix(hueMatrices[i], config.stages[i].param);
+        }
+    }
+}
+
+bool effects_active()
+{
+    return config.numStages > 0 || configPending;
+}
+
+// Whether a frame is due only to carry on fading the decay trails, after the
+// scene has stopped drawing
+bool effects_frame_due(uint32_t currMillis)
+{
+    return trailsLit && currMillis - lastApplyMillis >= DECAY_STEP_MILLIS;
+}
+
+// Runs the stages in order over a frame about to be sent to the LEDs
+void effects_apply(pixelColor_t *pixels)
+{
+    if (configPending) {
+        take_pending_config();
+    }
+    if (!pixelMapBuilt) {
+        build_pixel_map();
+    }
+
+    uint32_t currMillis = millis;
+    float steps = (float) (currMillis - lastApplyMillis) / DECAY_STEP_MILLIS;
+    lastApplyMillis = currMillis;
+    bool lit = false;
+
+    for (uint8_t i = 0; i < config.numStages; i++) {
+        int64_t startMicros = esp_timer_get_time();
+        switch (config.stages[i].type)
+        {
+            case EFFECT_DECAY:
+            {
+                uint32_t keep = lroundf(65536 * powf(config.stages[i].param / 256.0f, steps));
+                lit |= decay(pixels, trails[i], keep);
+                break;
+            }
+            case EFFECT_BLUR:
+                blur(pixels, config.stages[i].param);
+                break;
+            case EFFECT_MIRROR:
+                mirror(pixels, config.stages[i].param);
+                break;
+            case EFFECT_HUE:
+                hue_shift(pixels, hueMatrices[i]);
+                break;
+        }
+        stageMicros[i] = esp_timer_get_time() - startMicros;
+        if (stageMicros[i] > stageMaxMicros[i]) {
+            stageMaxMicros[i] = stageMicros[i];
+        }
+    }
+    trailsLit = lit;
+}
+
+void effects_get_config(effectsConfig *result)
+{
+    portENTER_CRITICAL(&configMux);
+    *result = configPending ? pendingConfig : config;
+    portEXIT_CRITICAL(&configMux);
+}
+
+void effects_set_config(const effectsConfig *newConfig)
+{
+    // Stored settings are checked too, as the effects may have changed since,
+    // with params brought into range as effects_parse_config does
+    effectsConfig checked;
+    memset(&checked, 0, sizeof(checked));
+    for (uint8_t i = 0; i < newConfig->numStages && i < MAX_EFFECT_STAGES; i++) {
+        effectStage stage = newConfig->stages[i];
+        if (stage.type > EFFECT_HUE) {
+            continue;
+        }
+        if (stage.type == EFFECT_BLUR) {
+            stage.param = stage.param < 1 ? 1 : stage.param > MAX_BLUR_RADIUS ? MAX_BLUR_RADIUS : stage.param;
+        } else if (stage.type == EFFECT_MIRROR) {
+            stage.param &= MIRROR_HORIZONTAL | MIRROR_VERTICAL;
+        }
+        checked.stages[checked.numStages++] = stage;
+    }
+
+    portENTER_CRITICAL(&configMux);
+    pendingConfig = checked;
+    configPending = true;
+    portEXIT_CRITICAL(&configMux);
+
+    ESP_LOGI(TAG, "Effects config: %d stages", checked.numStages);
+}
+
+// Replaces config's stages with those in json's stages array, in order.
+// Stages of unknown types are skipped.
+void effects_parse_config(cJSON *json, effectsConfig *config)
+{
+    const cJSON *stagesJson = cJSON_GetObjectItem(json, "stages");
+    if (!cJSON_IsArray(stagesJson)) {
+        return;
+    }
+
+    config->numStages = 0;
+    const cJSON *stageJson;
+    cJSON_ArrayForEach(stageJson, stagesJson) {
+        if (config->numStages == MAX_EFFECT_STAGES) {
+            break;
+        }
+        const cJSON *typeJson = cJSON_GetObjectItem(stageJson, "type");
+        if (!cJSON_IsString(typeJson)) {
+            continue;
+        }
+        int8_t type = -1;
+        for (uint8_t i = 0; i < sizeof(effectNames) / sizeof(effectNames[0]); i++) {
+            if (strcmp(typeJson->valuestring, effectNames[i]) == 0) {
+                type = i;
+            }
+        }
+        if (type < 0) {
+            continue;
+        }
+
+        effectStage *stage = &config->stages[config->numStages];
+        stage->type = type;
+        switch (type)
+        {
+            case EFFECT_DECAY:
+            {
+                const cJSON *amountJson = cJSON_GetObjectItem(stageJson, "amount");
+                int amount = cJSON_IsNumber(amountJson) ? amountJson->valueint : 192;
+                stage->param = amount < 0 ? 0 : amount > 255 ? 255 : amount;
+                break;
+            }
+            case EFFECT_BLUR:
+            {
+                const cJSON *radiusJson = cJSON_GetObjectItem(stageJson, "radius");
+                int radius = cJSON_IsNumber(radiusJson) ? radiusJson->valueint : 1;
+                stage->param = radius < 1 ? 1 : radius > MAX_BLUR_RADIUS ? MAX_BLUR_RADIUS : radius;
+                break;
+            }
+            case EFFECT_MIRROR:
+            {
+                const cJSON *axesJson = cJSON_GetObjectItem(stageJson, "axes");
+                stage->param = MIRROR_HORIZONTAL | MIRROR_VERTICAL;
+                if (cJSON_IsString(axesJson)) {
+                    for (uint8_t i = 0; i < sizeof(mirrorNames) / sizeof(mirrorNames[0]); i++) {
+                        if (strcmp(axesJson->valuestring, mirrorNames[i]) == 0) {
+                            stage->param = i;
+                        }
+                    }
+                }
+                break;
+            }
+            case EFFECT_HUE:
+            {
+                const cJSON *shiftJson = cJSON_GetObjectItem(stageJson, "shift");
+                stage->param = cJSON_IsNumber(shiftJson) ? (uint8_t) shiftJson->valueint : 0;
+                break;
+            }
+        }
+        config->numStages++;
+    }
+}
+
+void effects_print_config(const effectsConfig *config, cJSON *json)
+{
+    cJSON *stagesJson = cJSON_AddArrayToObject(json, "stages");
+    for (uint8_t i = 0; i < config->numStages; i++) {
+        const effectStage *stage = &config->stages[i];
+        cJSON *stageJson = cJSON_CreateObject();
+        cJSON_AddStringToObject(stageJson, "type", effectNames[stage->type]);
+        switch (stage->type)
+        {
+            case EFFECT_DECAY:
+                cJSON_AddNumberToObject(stageJson, "amount", stage->param);
+                break;
+            case EFFECT_BLUR:
+                cJSON_AddNumberToObject(stageJson, "radius", stage->param);
+                break;
+            case EFFECT_MIRROR:
+                cJSON_AddStringToObject(stageJson, "axes", mirrorNames[stage->param & 3]);
+                break;
+            case EFFECT_HUE:
+                cJSON_AddNumberToObject(stageJson, "shift", stage->param);
+                break;
+        }
+        cJSON_AddItemToArray(stagesJson, stageJson);
+    }
+}
+
+// Time each stage took on the last frame, and the longest since the stages were set
+void effects_add_stats(cJSON *json)
+{
+    cJSON *effectsJson = cJSON_AddArrayToObject(json, "effects");
+    for (uint8_t i = 0; i < config.numStages; i++) {
+        cJSON *stageJson = cJSON_CreateObject();
+        cJSON_AddStringToObject(stageJson, "type", effectNames[config.stages[i].type]);
+        cJSON_AddNumberToObject(stageJson, "micros", stageMicros[i]);
+        cJSON_AddNumberToObject(stageJson, "maxMicros", stageMaxMicros[i]);
+        cJSON_AddItemToArray(effectsJson, stageJson);
+    }
+}
@@ -1,20 +1,44 @@
 #include <stdio.h>
+#include <string.h>
 #include <esp_log.h>
 #include <cJSON.h>
 #include "frame_base.h"
 
 static const char *TAG = "scene fill";
 
+#define NUM_FILL_ORDERS 6
+
+typedef enum {ORDER_STRIP, ORDER_COLUMNS, ORDER_DIAGONAL, ORDER_SPIRAL, ORDER_RANDOM, ORDER_CENTRE} fillOrder;
+
+// A pixel on this panel and the step of the fill or clear that reaches it
+typedef struct fillStep {
+    uint32_t step;
+    uint8_t pixel;
+} fillStep;
+
+// The steps for this panel's pixels in order. An order covers the whole canvas,
+// but only where it visits this panel is kept, so any canvas size costs the same.
+typedef struct fillTable {
+    fillStep steps[NUM_PIXELS];
+    uint8_t count;
+} fillTable;
+
 static uint32_t fill_scene_lastMillis = 0;
-static uint8_t fill_scene_pixel = 0;
+static bool fill_scene_restart = true;
+// Steps taken through the canvas by the current fill or clear
+static uint32_t fill_scene_pixel = 0;
+// Next entry of the current table to be reached
+static uint8_t fill_scene_next_step = 0;
 // 0 - filling, 1 - pausing, 2 - clearing, 3 - pausing
 static uint8_t fill_scene_mode = 0;
 // 0 - change at end of fill, 1 - change after each pixel, 2 - change after each row
 static uint8_t fill_scene_colour_mode = 0;
 static bool fill_scene_clear_mode = true;
-// true - down, false - up
+// true - forwards through the order, false - backwards
 static bool fill_scene_fill_direction = true;
 static bool fill_scene_clear_direction = true;
+static uint8_t fill_scene_fill_order = ORDER_STRIP;
+static uint8_t fill_scene_clear_order = ORDER_STRIP;
 static uint16_t fill_scene_fill_pixel_millis = 50;
 static uint16_t fill_scene_fill_pause_millis = 200;
 static uint16_t fill_scene_clear_pixel_millis = 30;
@@ -29,29 +53,172 @@ static hsvColourChangeConfig colourChange = {
     .valueChange = 0,
     .maxValue = HSV_MAX_VALUE
 };
+// Palette entry holding the current colour. A colour change moves on to the
+// next entry once a pixel on this panel has been drawn with the current one, so
+// pixels drawn earlier keep theirs. Each fill draws every pixel of the panel,
+// so the entries come round again long before one is still on show.
+static uint8_t fill_scene_palette_entry = 1;
+static bool fill_scene_entry_used = false;
+static uint32_t fill_scene_palette[PALETTE_SIZE];
+static fillTable fillOrderTable;
+static fillTable clearOrderTable;
+static const char *orderNames[] = {"strip", "columns", "diagonal", "spiral", "random", "centre"};
 
 
-void leds_set_pixel(int pixel, float hue, float sat, float value);
-void leds_update();
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_set_palette_colour(uint32_t *palette, uint8_t entry, float hue, float sat, float value);
+void leds_set_pixel_index(frameBuffer *frame, int pixel, uint8_t entry);
 
 
-static void init_fill_pixel()
+static uint32_t canvas_pixels()
 {
-    if (fill_scene_fill_direction) {
-        fill_scene_pixel = 0;
-    } else {
-        fill_scene_pixel = NUM_PIXELS - 1;
+    return getCanvas()->width * getCanvas()->height;
+}
+
+
+// Sort key of a canvas pixel in an order. The pixel number in the low half
+// breaks ties, so every pixel has its own step.
+static uint64_t order_key(uint8_t order, uint16_t col, uint16_t row)
+{
+    const canvasConfig *canvas = getCanvas();
+    uint16_t width = canvas->width;
+    uint16_t height = canvas->height;
+    uint32_t pixel = row * width + col;
+    uint32_t key = 0;
+
+    switch (order) {
+        case ORDER_STRIP:
+            // Back and forth along each row, the way the LEDs are wired on a panel
+            key = pixel;
+            if (row % 2 == 1) {
+                key = row * width + width - col - 1;
+            }
+            break;
+        case ORDER_COLUMNS:
+            key = col * height + row;
+            break;
+        case ORDER_DIAGONAL:
+            key = (col + row) << 16 | row;
+            break;
+        case ORDER_SPIRAL: {
+            // Clockwise from the top left, a ring at a time towards the middle
+            uint16_t ring = col;
+            ring = row < ring ? row : ring;
+            ring = width - col - 1 < ring ? width - col - 1 : ring;
+            ring = height - row - 1 < ring ? height - row - 1 : ring;
+            uint16_t ringWidth = width - 2 * ring - 1;
+            uint16_t ringHeight = height - 2 * ring - 1;
+            uint32_t along;
+            if (row == ring) {
+                along = col - ring;
+            } else if (col == width - ring - 1) {
+                along = ringWidth + row - ring;
+            } else if (row == height - ring - 1) {
+                along = ringWidth + ringHeight + width - ring - 1 - col;
+            } else {
+                along = 2 * ringWidth + ringHeight + height - ring - 1 - row;
+            }
+            key = (uint32_t) ring << 20 | along;
+            break;
+        }
+        case ORDER_RANDOM:
+            // Integer hash of the pixel, the same on every frame of the canvas
+            key = (pixel + 1) * 0x9E3779B1 ^ canvas->seed;
+            key ^= key >> 16;
+            key *= 0x85EBCA6B;
+            key ^= key >> 13;
+            key *= 0xC2B2AE35;
+            key ^= key >> 16;
+            break;
+        case ORDER_CENTRE: {
+            // Squared distance from the middle, in half pixels
+            int32_t dx = 2 * col + 1 - width;
+            int32_t dy = 2 * row + 1 - height;
+            key = dx * dx + dy * dy;
+            break;
+        }
     }
+    return (uint64_t) key << 32 | pixel;
 }
 
 
-static void init_clear_pixel()
+// Works out the step at which the fill reaches each pixel of this panel. The
+// step is the number of canvas pixels ordered before it, counted in one pass
+// over the canvas against this panel's keys.
+static void build_table(fillTable *table, uint8_t order)
 {
-    if (fill_scene_clear_direction) {
-        fill_scene_pixel = 0;
+    const canvasConfig *canvas = getCanvas();
+    uint64_t keys[NUM_PIXELS];
+    uint32_t counts[NUM_PIXELS];
+
+    table->count = 0;
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            uint16_t canvasCol = canvas->x + col;
+            uint16_t canvasRow = canvas->y + row;
+            if (canvasCol >= canvas->width || canvasRow >= canvas->height) {
+                continue;
+            }
+            // Insertion sort, there are only NUM_PIXELS of them
+            uint64_t key = order_key(order, canvasCol, canvasRow);
+            uint8_t i = table->count++;
+            while (i > 0 && keys[i - 1] > key) {
+                keys[i] = keys[i - 1];
+                table->steps[i].pixel = table->steps[i - 1].pixel;
+                i--;
+            }
+            keys[i] = key;
+            table->steps[i].pixel = pixelIdx(col, row);
+        }
+    }
+
+    // counts[i] is the number of canvas pixels between keys[i - 1] and keys[i]
+    memset(counts, 0, sizeof(counts));
+    for (uint16_t row = 0; row < canvas->height; row++) {
+        for (uint16_t col = 0; col < canvas->width; col++) {
+            uint64_t key = order_key(order, col, row);
+            uint8_t low = 0;
+            uint8_t high = table->count;
+            while (low < high) {
+                uint8_t mid = (low + high) / 2;
+                if (keys[mid] > key) {
+                    high = mid;
+                } else {
+                    low = mid + 1;
+                }
+            }
+            if (low < table->count) {
+                counts[low]++;
+            }
+        }
+    }
+
+    uint32_t step = 0;
+    for (uint8_t i = 0; i < table->count; i++) {
+        step += counts[i];
+        table->steps[i].step = step;
+    }
+}
+
+
+static void build_tables()
+{
+    build_table(&fillOrderTable, fill_scene_fill_order);
+    if (fill_scene_clear_order == fill_scene_fill_order) {
+        clearOrderTable = fillOrderTable;
     } else {
-        fill_scene_pixel = NUM_PIXELS - 1;
+        build_table(&clearOrderTable, fill_scene_clear_order);
+    }
+}
+
+
+static void palette_entry_update()
+{
+    if (fill_scene_entry_used && ++fill_scene_palette_entry == PALETTE_BLACK) {
+        fill_scene_palette_entry++;
     }
+    fill_scene_entry_used = false;
+    leds_set_palette_colour(fill_scene_palette, fill_scene_palette_entry, colour.hue, colour.sat, colour.value);
 }
 
 
@@ -62,166 +229,244 @@ static void colour_update()
     if (colour.value > colourChange.maxValue) {
         colour.value = 0;
     }
+    palette_entry_update();
 }
 
 
-void fill_scene_update(uint32_t currMillis)
+static void start_walk()
 {
-    uint32_t elapsedMillis = currMillis - fill_scene_lastMillis;
+    fill_scene_pixel = 0;
+    fill_scene_next_step = 0;
+}
 
-    if (fill_scene_mode == 0 && elapsedMillis >= fill_scene_fill_pixel_millis) {
-        leds_set_pixel(
-            fill_scene_pixel,
-            colour.hue,
-            colour.sat,
-            colour.value
-        );
-        leds_update();
-        
-        if (fill_scene_fill_direction) {
-            fill_scene_pixel++;
-        } else {
-            fill_scene_pixel--;
-        }
-        
-        if (fill_scene_colour_mode == 1) {
-            colour_update();
-        } else if (fill_scene_colour_mode == 2) {
-            // If fill direction is down we change colour when we are on the first pixel of the next row
-            if (fill_scene_fill_direction && fill_scene_pixel % PIXELS_PER_ROW == 0) {
-                colour_update();
-            // If fill direction is up we change colour when we are on the last pixel of the next row
-            } else if (!fill_scene_fill_direction && (fill_scene_pixel + 1) % PIXELS_PER_ROW == 0) {
-                colour_update();
+
+// Takes the steps due since the last one, setting this panel's pixels that
+// they reach to entry. Several steps can be taken in one frame when steps are
+// shorter than frames, and the pixels are all sent together. Returns true once
+// the whole canvas has been walked.
+static bool walk(frameBuffer *frame, const fillTable *table, bool forwards, uint16_t pixelMillis, uint32_t currMillis, bool filling, bool *drawn)
+{
+    uint32_t total = canvas_pixels();
+    uint32_t steps = total - fill_scene_pixel;
+    if (pixelMillis > 0) {
+        uint32_t due = (currMillis - fill_scene_lastMillis) / pixelMillis;
+        steps = due < steps ? due : steps;
+        fill_scene_lastMillis += steps * pixelMillis;
+    } else {
+        fill_scene_lastMillis = currMillis;
+    }
+
+    for (uint32_t i = 0; i < steps; i++) {
+        // Entries behind the current step are passed over, as after the order changes
+        while (fill_scene_next_step < table->count) {
+            const fillStep *next = &table->steps[forwards ? fill_scene_next_step : table->count - 1 - fill_scene_next_step];
+            uint32_t nextStep = forwards ? next->step : total - 1 - next->step;
+            if (nextStep > fill_scene_pixel) {
+                break;
+            }
+            if (nextStep == fill_scene_pixel) {
+                leds_set_pixel_index(frame, next->pixel, filling ? fill_scene_palette_entry : PALETTE_BLACK);
+                fill_scene_entry_used |= filling;
+                *drawn = true;
             }
+            fill_scene_next_step++;
         }
+        fill_scene_pixel++;
 
-        bool fillDone = false;
-        if (fill_scene_fill_direction && fill_scene_pixel == NUM_PIXELS) {
-            fillDone = true;
-        } else if (!fill_scene_fill_direction && fill_scene_pixel == 255) {
-            // When fill direction is up we need to check whether fill is done when fill_scene_pixel has rolled over i.e. pixel 0 has been set
-            fillDone = true;
+        if (filling && fill_scene_colour_mode == 1) {
+            colour_update();
+        } else if (filling && fill_scene_colour_mode == 2 && fill_scene_pixel % getCanvas()->width == 0) {
+            colour_update();
         }
-        if (fillDone) {
+    }
+
+    return fill_scene_pixel == total;
+}
+
+
+bool fill_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    bool drawn = false;
+
+    if (fill_scene_restart) {
+        // The first pixel is drawn straight away
+        fill_scene_lastMillis = currMillis - fill_scene_fill_pixel_millis;
+        fill_scene_restart = false;
+    }
+    uint32_t elapsedMillis = currMillis - fill_scene_lastMillis;
+
+    if (fill_scene_mode == 0 && elapsedMillis >= fill_scene_fill_pixel_millis) {
+        if (walk(frame, &fillOrderTable, fill_scene_fill_direction, fill_scene_fill_pixel_millis, currMillis, true, &drawn)) {
             fill_scene_mode++;
             if (fill_scene_colour_mode == 0) {
                 colour_update();
             }
+            fill_scene_lastMillis = currMillis;
         }
-
-        fill_scene_lastMillis = currMillis;
     } else if (fill_scene_mode == 1 && elapsedMillis >= fill_scene_fill_pause_millis) {
-        if (!fill_scene_clear_mode) {
-            fill_scene_mode = 0;
-            init_fill_pixel();
-        } else {
-            fill_scene_mode++;
-            init_clear_pixel();
-        }
+        fill_scene_mode = fill_scene_clear_mode ? 2 : 0;
+        start_walk();
         fill_scene_lastMillis = currMillis;
     } else if (fill_scene_mode == 2 && elapsedMillis >= fill_scene_clear_pixel_millis) {
-        leds_set_pixel(fill_scene_pixel, 0, 0, 0);
-        leds_update();
-
-        if (fill_scene_clear_direction) {
-            fill_scene_pixel++;
-        } else {
-            fill_scene_pixel--;
-        }
-
-        bool clearDone = false;
-        if (fill_scene_clear_direction && fill_scene_pixel == NUM_PIXELS) {
-            clearDone = true;
-        } else if (!fill_scene_clear_direction && fill_scene_pixel == 255) {
-            // We want to check whether fill_scene_pixel has rolled over - pixel 0 has been set
-            clearDone = true;
-        }
-        if (clearDone) {
+        if (walk(frame, &clearOrderTable, fill_scene_clear_direction, fill_scene_clear_pixel_millis, currMillis, false, &drawn)) {
             fill_scene_mode++;
+            fill_scene_lastMillis = currMillis;
         }
-
-        fill_scene_lastMillis = currMillis;
     } else if (fill_scene_mode == 3 && elapsedMillis >= fill_scene_clear_pause_millis) {
         fill_scene_mode = 0;
-        init_fill_pixel();
+        start_walk();
         fill_scene_lastMillis = currMillis;
     }
+
+    return drawn;
 }
 
-void fill_scene_init()
+void fill_scene_init(frameBuffer *frame)
 {
-    fill_scene_pixel = 0;
+    build_tables();
+    start_walk();
     fill_scene_mode = 0;
-    fill_scene_lastMillis = 0;
+    fill_scene_restart = true;
+    leds_set_palette(frame, fill_scene_palette);
+    palette_entry_update();
+}
+
+void fill_scene_get_config(fillSceneConfig *config)
+{
+    config->colourMode = fill_scene_colour_mode;
+    config->clearMode = fill_scene_clear_mode;
+    config->fillDirection = fill_scene_fill_direction;
+    config->clearDirection = fill_scene_clear_direction;
+    config->fillPixelMillis = fill_scene_fill_pixel_millis;
+    config->fillPauseMillis = fill_scene_fill_pause_millis;
+    config->clearPixelMillis = fill_scene_clear_pixel_millis;
+    config->clearPauseMillis = fill_scene_clear_pause_millis;
+    config->colour = colour;
+    config->colourChange = colourChange;
+    config->fillOrder = fill_scene_fill_order;
+    config->clearOrder = fill_scene_clear_order;
+}
+
+void fill_scene_set_config(const fillSceneConfig *config)
+{
+    fill_scene_colour_mode = config->colourMode;
+    fill_scene_clear_mode = config->clearMode;
+    fill_scene_fill_direction = config->fillDirection;
+    fill_scene_clear_direction = config->clearDirection;
+    fill_scene_fill_pixel_millis = config->fillPixelMillis;
+    fill_scene_fill_pause_millis = config->fillPauseMillis;
+    fill_scene_clear_pixel_millis = config->clearPixelMillis;
+    fill_scene_clear_pause_millis = config->clearPauseMillis;
+    colour = config->colour;
+    colourChange = config->colourChange;
+    palette_entry_update();
+
+    uint8_t fillOrder = config->fillOrder < NUM_FILL_ORDERS ? config->fillOrder : ORDER_STRIP;
+    uint8_t clearOrder = config->clearOrder < NUM_FILL_ORDERS ? config->clearOrder : ORDER_STRIP;
+    if (fillOrder != fill_scene_fill_order || clearOrder != fill_scene_clear_order) {
+        fill_scene_fill_order = fillOrder;
+        fill_scene_clear_order = clearOrder;
+        build_tables();
+        // Carry on from the same step, through the new order
+        fill_scene_next_step = 0;
+    }
 }
 
-void fill_scene_update_config(cJSON *json)
+// Applies the settings present in json on top of config
+void fill_scene_parse_config(cJSON *json, fillSceneConfig *config)
 {
     const cJSON *colourModelJson = cJSON_GetObjectItem(json, "colourMode");
     if (cJSON_IsNumber(colourModelJson)) {
-        fill_scene_colour_mode = (uint8_t) colourModelJson->valueint;
-        if (fill_scene_colour_mode > 2) {
-           fill_scene_colour_mode = 0;
+        config->colourMode = (uint8_t) colourModelJson->valueint;
+        if (config->colourMode > 2) {
+           config->colourMode = 0;
         }
     }
     const cJSON *clearModeJson = cJSON_GetObjectItem(json, "clearMode");
     if (cJSON_IsBool(clearModeJson)) {
-        fill_scene_clear_mode = cJSON_IsTrue(clearModeJson);
+        config->clearMode = cJSON_IsTrue(clearModeJson);
     }
     const cJSON *fillDirectionJson = cJSON_GetObjectItem(json, "fillDirection");
     if (cJSON_IsBool(fillDirectionJson)) {
-        fill_scene_fill_direction = cJSON_IsTrue(fillDirectionJson);
+        config->fillDirection = cJSON_IsTrue(fillDirectionJson);
     }
     const cJSON *clearDirectionJson = cJSON_GetObjectItem(json, "clearDirection");
     if (cJSON_IsBool(clearDirectionJson)) {
-        fill_scene_clear_direction = cJSON_IsTrue(clearDirectionJson);
+        config->clearDirection = cJSON_IsTrue(clearDirectionJson);
     }
     const cJSON *fillPixelMillisJson = cJSON_GetObjectItem(json, "fillPixelMillis");
     if (cJSON_IsNumber(fillPixelMillisJson)) {
-        fill_scene_fill_pixel_millis = (uint16_t) fillPixelMillisJson->valueint;
+        config->fillPixelMillis = (uint16_t) fillPixelMillisJson->valueint;
     }
     const cJSON *fillPauseMillisJson = cJSON_GetObjectItem(json, "fillPauseMillis");
     if (cJSON_IsNumber(fillPauseMillisJson)) {
-        fill_scene_fill_pause_millis = (uint16_t) fillPauseMillisJson->valueint;
+        config->fillPauseMillis = (uint16_t) fillPauseMillisJson->valueint;
     }
     const cJSON *clearPixelMillisJson = cJSON_GetObjectItem(json, "clearPixelMillis");
     if (cJSON_IsNumber(clearPixelMillisJson)) {
-        fill_scene_clear_pixel_millis = (uint16_t) clearPixelMillisJson->valueint;
+        config->clearPixelMillis = (uint16_t) clearPixelMillisJson->valueint;
     }
     const cJSON *clearPauseMillisJson = cJSON_GetObjectItem(json, "clearPauseMillis");
     if (cJSON_IsNumber(clearPauseMillisJson)) {
-        fill_scene_clear_pause_millis = (uint16_t) clearPauseMillisJson->valueint;
+        config->clearPauseMillis = (uint16_t) clearPauseMillisJson->valueint;
+    }
+
+    const cJSON *fillOrderJson = cJSON_GetObjectItem(json, "fillOrder");
+    const cJSON *clearOrderJson = cJSON_GetObjectItem(json, "clearOrder");
+    for (uint8_t i = 0; i < NUM_FILL_ORDERS; i++) {
+        if (cJSON_IsString(fillOrderJson) && strcmp(fillOrderJson->valuestring, orderNames[i]) == 0) {
+            config->fillOrder = i;
+        }
+        if (cJSON_IsString(clearOrderJson) && strcmp(clearOrderJson->valuestring, orderNames[i]) == 0) {
+            config->clearOrder = i;
+        }
     }
-    ESP_LOGI(TAG, "Updated config: colour mode = %d, clear mode = %d, fill direction = %d, clear direction = %d, fill pixel millis = %d, fill pause millis = %d, clear pixel millis = %d, clear pause millis = %d\n", fill_scene_colour_mode, fill_scene_clear_mode, fill_scene_fill_direction, fill_scene_clear_direction, fill_scene_fill_pixel_millis, fill_scene_fill_pause_millis, fill_scene_clear_pixel_millis, fill_scene_clear_pause_millis);
 
     const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
     if (cJSON_IsNumber(hueJson)) {
-        colour.hue = (float) hueJson->valuedouble;
+        config->colour.hue = (float) hueJson->valuedouble;
     }
     const cJSON *satJson = cJSON_GetObjectItem(json, "sat");
     if (cJSON_IsNumber(satJson)) {
-        colour.sat = (float) satJson->valuedouble;
+        config->colour.sat = (float) satJson->valuedouble;
     }
     const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
     if (cJSON_IsNumber(valueJson)) {
-        colour.value = (float) valueJson->valuedouble;
+        config->colour.value = (float) valueJson->valuedouble;
     }
     const cJSON *hueChangeJson = cJSON_GetObjectItem(json, "hueChange");
     if (cJSON_IsNumber(hueChangeJson)) {
-        colourChange.hueChange = (float) hueChangeJson->valuedouble;
+        config->colourChange.hueChange = (float) hueChangeJson->valuedouble;
     }
     const cJSON *valueChangeJson = cJSON_GetObjectItem(json, "valueChange");
     if (cJSON_IsNumber(valueChangeJson)) {
-        colourChange.valueChange = (float) valueChangeJson->valuedouble;
+        config->colourChange.valueChange = (float) valueChangeJson->valuedouble;
     }
     const cJSON *maxValueJson = cJSON_GetObjectItem(json, "maxValue");
     if (cJSON_IsNumber(maxValueJson)) {
-        colourChange.maxValue = (float) maxValueJson->valuedouble;
-        if (colourChange.maxValue > HSV_MAX_VALUE) {
-            colourChange.maxValue = HSV_MAX_VALUE;
+        config->colourChange.maxValue = (float) maxValueJson->valuedouble;
+        if (config->colourChange.maxValue > HSV_MAX_VALUE) {
+            config->colourChange.maxValue = HSV_MAX_VALUE;
         }
     }
+}
 
-    ESP_LOGI(TAG, "Colour config: hue = %f, sat = %f, value = %f, hue change = %f, value change = %f, max value = %f", colour.hue, colour.sat, colour.value, colourChange.hueChange, colourChange.valueChange, colourChange.maxValue);
-}
\ No newline at end of file
+void fill_scene_print_config(const fillSceneConfig *config, cJSON *json)
+{
+    cJSON_AddNumberToObject(json, "colourMode", config->colourMode);
+    cJSON_AddBoolToObject(json, "clearMode", config->clearMode);
+    cJSON_AddBoolToObject(json, "fillDirection", config->fillDirection);
+    cJSON_AddBoolToObject(json, "clearDirection", config->clearDirection);
+    cJSON_AddNumberToObject(json, "fillPixelMillis", config->fillPixelMillis);
+    cJSON_AddNumberToObject(json, "fillPauseMillis", config->fillPauseMillis);
+    cJSON_AddNumberToObject(json, "clearPixelMillis", config->clearPixelMillis);
+    cJSON_AddNumberToObject(json, "clearPauseMillis", config->clearPauseMillis);
+    cJSON_AddStringToObject(json, "fillOrder", orderNames[config->fillOrder < NUM_FILL_ORDERS ? config->fillOrder : ORDER_STRIP]);
+    cJSON_AddStringToObject(json, "clearOrder", orderNames[config->clearOrder < NUM_FILL_ORDERS ? config->clearOrder : ORDER_STRIP]);
+    cJSON_AddNumberToObject(json, "hue", config->colour.hue);
+    cJSON_AddNumberToObject(json, "sat", config->colour.sat);
+    cJSON_AddNumberToObject(json, "value", config->colour.value);
+    cJSON_AddNumberToObject(json, "hueChange", config->colourChange.hueChange);
+    cJSON_AddNumberToObject(json, "valueChange", config->colourChange.valueChange);
+    cJSON_AddNumberToObject(json, "maxValue", config->colourChange.maxValue);
+}
@@ -1,21 +1,157 @@
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <string.h>
+#include <freertos/FreeRTOS.h>
 #include "frame_base.h"
 
+// Blended transition frames are sent at most this often
+#define TRANSITION_FRAME_MILLIS 16
+
+typedef struct layer {
+    scene layerScene;
+    blendMode blend;
+    uint8_t opacity;
+    frameBuffer frame;
+    uint32_t renderMicros;
+    uint32_t maxRenderMicros;
+} layer;
+
 static scene currentScene = SCENE_FILL;
+static const char *sceneNames[] = {"fill", "snake", "blocks", "anim", "stream", "plasma", "particles", "text", "life", "shader", "spectrum", "image"};
+
+// The current scene draws into frames[activeFrame]. During a transition the
+// previous scene keeps drawing into the other frame and both are blended.
+static frameBuffer frames[2];
+static uint8_t activeFrame = 0;
+
+static transitionType transition = TRANSITION_CUT;
+static uint16_t transitionMillis = 1000;
+static bool transitionRunning = false;
+static bool transitionStartPending = false;
+static scene previousScene = SCENE_FILL;
+static uint32_t transitionStartMillis = 0;
+static uint32_t transitionLastFrameMillis = 0;
+static uint8_t transitionWeights[NUM_PIXELS];
+static uint8_t dissolveThresholds[NUM_PIXELS];
+static uint32_t transitionMaxBlendMicros = 0;
+
+// When layers are set they are rendered and composited bottom to top in place
+// of the current scene. layerComposites[i] holds layers 0 - i merged, so
+// layers below the lowest one that changed don't need merging again.
+static layer layers[MAX_LAYERS];
+static uint8_t numLayers = 0;
+static pixelColor_t layerComposites[MAX_LAYERS][NUM_PIXELS];
+static const pixelColor_t blackPixels[NUM_PIXELS];
+static uint32_t composeMicros = 0;
+// Longest time each scene has taken to draw a frame on its own
+static uint32_t sceneMaxRenderMicros[NUM_SCENES];
+// Frames of grid scenes resampled to the LED map, one for each side of a blend
+static frameBuffer rasterFrames[2];
+// Scene to switch to once millis reaches scheduledSceneMillis, -1 if none
+static volatile int16_t scheduledScene = -1;
+static volatile uint32_t scheduledSceneMillis = 0;
+static canvasConfig canvas = {
+    .width = PIXELS_PER_ROW,
+    .height = NUM_ROWS,
+    .x = 0,
+    .y = 0,
+    .seed = 1
+};
+static volatile bool restartPending = false;
+// Batch of settings waiting for the next frame
+static configBatch pendingBatch;
+static volatile bool batchPending = false;
+static portMUX_TYPE batchMux = portMUX_INITIALIZER_UNLOCKED;
+static const char *blendNames[] = {"alpha", "add", "max", "multiply"};
+static const char *transitionNames[] = {"cut", "crossfade", "wipe", "dissolve"};
 
 static const char *TAG = "light frame base";
 
 
-void fill_scene_update(uint32_t currMillis);
-void fill_scene_init();
-void fill_scene_update_config(cJSON *json);
-void snake_scene_update(uint32_t currMillis);
+bool fill_scene_update(frameBuffer *frame, uint32_t currMillis);
+void fill_scene_init(frameBuffer *frame);
+void fill_scene_get_config(fillSceneConfig *config);
+void fill_scene_set_config(const fillSceneConfig *config);
+void fill_scene_parse_config(cJSON *json, fillSceneConfig *config);
+void fill_scene_print_config(const fillSceneConfig *config, cJSON *json);
+bool snake_scene_update(frameBuffer *frame, uint32_t currMillis);
 void snake_scene_init();
-void blocks_scene_update(uint32_t currMillis);
+void snake_scene_get_config(snakeSceneConfig *config);
+void snake_scene_set_config(const snakeSceneConfig *config);
+void snake_scene_parse_config(cJSON *json, snakeSceneConfig *config);
+void snake_scene_print_config(const snakeSceneConfig *config, cJSON *json);
+bool blocks_scene_update(frameBuffer *frame, uint32_t currMillis);
 void blocks_scene_init();
-void blocks_scene_update_config(cJSON *json);
+void blocks_scene_get_config(blocksSceneConfig *config);
+void blocks_scene_set_config(const blocksSceneConfig *config);
+void blocks_scene_parse_config(cJSON *json, blocksSceneConfig *config);
+void blocks_scene_print_config(const blocksSceneConfig *config, cJSON *json);
+bool anim_scene_update(frameBuffer *frame, uint32_t currMillis);
+void anim_scene_init();
+bool stream_scene_update(frameBuffer *frame, uint32_t currMillis);
+void stream_scene_init();
+bool plasma_scene_update(frameBuffer *frame, uint32_t currMillis);
+void plasma_scene_init(frameBuffer *frame);
+void plasma_scene_get_config(plasmaSceneConfig *config);
+void plasma_scene_set_config(const plasmaSceneConfig *config);
+void plasma_scene_parse_config(cJSON *json, plasmaSceneConfig *config);
+void plasma_scene_print_config(const plasmaSceneConfig *config, cJSON *json);
+bool particles_scene_update(frameBuffer *frame, uint32_t currMillis);
+void particles_scene_init();
+void particles_scene_get_config(particlesSceneConfig *config);
+void particles_scene_set_config(const particlesSceneConfig *config);
+void particles_scene_parse_config(cJSON *json, particlesSceneConfig *config);
+void particles_scene_print_config(const particlesSceneConfig *config, cJSON *json);
+bool text_scene_update(frameBuffer *frame, uint32_t currMillis);
+void text_scene_init(frameBuffer *frame);
+void text_scene_get_config(textSceneConfig *config);
+void text_scene_set_config(const textSceneConfig *config);
+void text_scene_parse_config(cJSON *json, textSceneConfig *config);
+void text_scene_print_config(const textSceneConfig *config, cJSON *json);
+bool life_scene_update(frameBuffer *frame, uint32_t currMillis);
+void life_scene_init(frameBuffer *frame);
+void life_scene_get_config(lifeSceneConfig *config);
+void life_scene_set_config(const lifeSceneConfig *config);
+void life_scene_parse_config(cJSON *json, lifeSceneConfig *config);
+void life_scene_print_config(const lifeSceneConfig *config, cJSON *json);
+bool shader_scene_update(frameBuffer *frame, uint32_t currMillis);
+void shader_scene_init();
+void shader_scene_get_config(shaderSceneConfig *config);
+void shader_scene_set_config(const shaderSceneConfig *config);
+void shader_scene_parse_config(cJSON *json, shaderSceneConfig *config);
+void shader_scene_print_config(const shaderSceneConfig *config, cJSON *json);
+bool spectrum_scene_update(frameBuffer *frame, uint32_t currMillis);
+void spectrum_scene_init();
+void spectrum_scene_get_config(spectrumSceneConfig *config);
+void spectrum_scene_set_config(const spectrumSceneConfig *config);
+void spectrum_scene_parse_config(cJSON *json, spectrumSceneConfig *config);
+void spectrum_scene_print_config(const spectrumSceneConfig *config, cJSON *json);
+bool image_scene_update(frameBuffer *frame, uint32_t currMillis);
+void image_scene_init();
 void leds_clear(bool updateLeds);
+void leds_clear_frame(frameBuffer *frame);
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_show(const frameBuffer *frame);
+void leds_show_pixels(const pixelColor_t *pixels);
+void settings_save_later();
+void leds_set_brightness(uint8_t value);
+uint8_t leds_get_brightness();
+uint32_t sync_scene_start(scene startScene);
+void leds_show_blend(const frameBuffer *from, const frameBuffer *to, const uint8_t *weights);
+bool effects_frame_due(uint32_t currMillis);
+void effects_get_config(effectsConfig *config);
+void effects_set_config(const effectsConfig *config);
+void effects_parse_config(cJSON *json, effectsConfig *config);
+void effects_print_config(const effectsConfig *config, cJSON *json);
+void interpolation_get_config(interpolationConfig *config);
+void interpolation_set_config(const interpolationConfig *config);
+void interpolation_parse_config(cJSON *json, interpolationConfig *config);
+void interpolation_print_config(const interpolationConfig *config, cJSON *json);
+bool ledmap_loaded();
+bool ledmap_apply_pending();
+const ledPosition *ledmap_positions();
+void ledmap_rasterize(const frameBuffer *grid, frameBuffer *result);
 
 uint8_t pixelIdx(uint8_t col, uint8_t row)
 {
@@ -26,70 +162,1104 @@ uint8_t pixelIdx(uint8_t col, uint8_t row)
     }
 }
 
-void setSceneConfig(char *scene, cJSON *json)
+// Returns the LED index of a canvas pixel, or -1 if it isn't on this panel
+int16_t canvasPixelIdx(uint16_t col, uint16_t row)
+{
+    if (col < canvas.x || row < canvas.y || col - canvas.x >= PIXELS_PER_ROW || row - canvas.y >= NUM_ROWS) {
+        return -1;
+    }
+    return pixelIdx(col - canvas.x, row - canvas.y);
+}
+
+// Scenes that draw each LED at its place in the LED map. Every other scene
+// draws the grid, which is resampled to the map when one is loaded.
+static bool scenePositioned(scene positionScene)
+{
+    switch (positionScene)
+    {
+        case SCENE_PLASMA:
+        case SCENE_SHADER:
+        case SCENE_TEXT:
+        case SCENE_PARTICLES:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The frame to send to the LEDs for a frame drawn by frameScene
+static const frameBuffer *ledFrame(scene frameScene, const frameBuffer *frame, frameBuffer *raster)
+{
+    if (!ledmap_loaded() || scenePositioned(frameScene)) {
+        return frame;
+    }
+    ledmap_rasterize(frame, raster);
+    return raster;
+}
+
+// xorshift32, the same sequence on every frame for the same seed
+uint32_t canvasRandom(uint32_t *state)
+{
+    uint32_t x = *state != 0 ? *state : 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+const canvasConfig *getCanvas()
+{
+    return &canvas;
+}
+
+// The current scene restarts so its state is laid out for the new canvas
+void setCanvas(const canvasConfig *config)
+{
+    canvas = *config;
+    restartPending = true;
+}
+
+// Fills config with the canvas settings in json on top of the current ones.
+// Returns false if the offset would be outside the canvas.
+static bool parse_canvas_config(cJSON *json, canvasConfig *result)
+{
+    canvasConfig config = canvas;
+
+    const cJSON *widthJson = cJSON_GetObjectItem(json, "width");
+    if (cJSON_IsNumber(widthJson) && widthJson->valueint > 0) {
+        config.width = (uint16_t) widthJson->valueint;
+    }
+    const cJSON *heightJson = cJSON_GetObjectItem(json, "height");
+    if (cJSON_IsNumber(heightJson) && heightJson->valueint > 0) {
+        config.height = (uint16_t) heightJson->valueint;
+    }
+    const cJSON *xJson = cJSON_GetObjectItem(json, "x");
+    if (cJSON_IsNumber(xJson) && xJson->valueint >= 0) {
+        config.x = (uint16_t) xJson->valueint;
+    }
+    const cJSON *yJson = cJSON_GetObjectItem(json, "y");
+    if (cJSON_IsNumber(yJson) && yJson->valueint >= 0) {
+        config.y = (uint16_t) yJson->valueint;
+    }
+    const cJSON *seedJson = cJSON_GetObjectItem(json, "seed");
+    if (cJSON_IsNumber(seedJson)) {
+        config.seed = (uint32_t) seedJson->valuedouble;
+    }
+
+    if (config.x >= config.width || config.y >= config.height) {
+        ESP_LOGI(TAG, "Canvas offset %d, %d is outside the %d x %d canvas", config.x, config.y, config.width, config.height);
+        return false;
+    }
+    *result = config;
+    return true;
+}
+
+bool sceneFromName(const char *name, scene *result)
 {
-    if (strncmp(scene, "fill", 4) == 0)
+    if (strncmp(name, "fill", 4) == 0)
+    {
+        *result = SCENE_FILL;
+    }
+    else if (strncmp(name, "snake", 5) == 0)
+    {
+        *result = SCENE_SNAKE;
+    }
+    else if (strncmp(name, "blocks", 6) == 0)
     {
-        fill_scene_update_config(json);
+        *result = SCENE_BLOCKS;
     }
-    else if (strncmp(scene, "blocks", 6) == 0)
+    else if (strncmp(name, "anim", 4) == 0)
     {
-        blocks_scene_update_config(json);
+        *result = SCENE_ANIM;
+    }
+    else if (strncmp(name, "stream", 6) == 0)
+    {
+        *result = SCENE_STREAM;
+    }
+    else if (strncmp(name, "plasma", 6) == 0)
+    {
+        *result = SCENE_PLASMA;
+    }
+    else if (strncmp(name, "particles", 9) == 0)
+    {
+        *result = SCENE_PARTICLES;
+    }
+    else if (strncmp(name, "text", 4) == 0)
+    {
+        *result = SCENE_TEXT;
+    }
+    else if (strncmp(name, "life", 4) == 0)
+    {
+        *result = SCENE_LIFE;
+    }
+    else if (strncmp(name, "shader", 6) == 0)
+    {
+        *result = SCENE_SHADER;
+    }
+    else if (strncmp(name, "spectrum", 8) == 0)
+    {
+        *result = SCENE_SPECTRUM;
+    }
+    else if (strncmp(name, "image", 5) == 0)
+    {
+        *result = SCENE_IMAGE;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Fills type and millis with the transition settings in json on top of the current ones
+static void parse_transition_config(cJSON *json, transitionType *type, uint16_t *millis)
+{
+    *type = transition;
+    *millis = transitionMillis;
+
+    const cJSON *typeJson = cJSON_GetObjectItem(json, "type");
+    if (cJSON_IsString(typeJson)) {
+        if (strcmp(typeJson->valuestring, "cut") == 0) {
+            *type = TRANSITION_CUT;
+        } else if (strcmp(typeJson->valuestring, "crossfade") == 0) {
+            *type = TRANSITION_CROSSFADE;
+        } else if (strcmp(typeJson->valuestring, "wipe") == 0) {
+            *type = TRANSITION_WIPE;
+        } else if (strcmp(typeJson->valuestring, "dissolve") == 0) {
+            *type = TRANSITION_DISSOLVE;
+        }
+    }
+    const cJSON *millisJson = cJSON_GetObjectItem(json, "millis");
+    if (cJSON_IsNumber(millisJson) && millisJson->valueint > 0) {
+        *millis = (uint16_t) millisJson->valueint;
     }
 }
 
-void setCurrentScene(char *scene)
+static void sceneInit(scene initScene, frameBuffer *frame);
+
+static void layersInit(uint8_t count)
 {
-    if (strncmp(scene, "fill", 4) == 0)
+    for (uint8_t i = 0; i < count; i++) {
+        sceneInit(layers[i].layerScene, &layers[i].frame);
+        layers[i].renderMicros = 0;
+        layers[i].maxRenderMicros = 0;
+        memset(layerComposites[i], 0, sizeof(layerComposites[i]));
+    }
+}
+
+// Fills the batch's layers from the "layers" array in json. Returns false if
+// there is no array.
+static bool parse_layers_config(cJSON *json, configBatch *batch)
+{
+    const cJSON *layersJson = cJSON_GetObjectItem(json, "layers");
+    if (!cJSON_IsArray(layersJson)) {
+        return false;
+    }
+
+    uint8_t count = 0;
+    const cJSON *layerJson;
+    cJSON_ArrayForEach(layerJson, layersJson) {
+        if (count == MAX_LAYERS) {
+            break;
+        }
+
+        const cJSON *sceneJson = cJSON_GetObjectItem(layerJson, "scene");
+        scene layerScene;
+        if (!cJSON_IsString(sceneJson) || !sceneFromName(sceneJson->valuestring, &layerScene)) {
+            continue;
+        }
+        // Scene state is per scene, so each scene can only be used by one layer
+        bool used = false;
+        for (uint8_t i = 0; i < count; i++) {
+            if (batch->layers[i].layerScene == layerScene) {
+                used = true;
+            }
+        }
+        if (used) {
+            continue;
+        }
+
+        layerConfig *config = &batch->layers[count];
+        config->layerScene = layerScene;
+        config->blend = BLEND_ALPHA;
+        config->opacity = 255;
+
+        const cJSON *blendJson = cJSON_GetObjectItem(layerJson, "blend");
+        if (cJSON_IsString(blendJson)) {
+            for (uint8_t mode = 0; mode < sizeof(blendNames) / sizeof(blendNames[0]); mode++) {
+                if (strcmp(blendJson->valuestring, blendNames[mode]) == 0) {
+                    config->blend = (blendMode) mode;
+                }
+            }
+        }
+        const cJSON *opacityJson = cJSON_GetObjectItem(layerJson, "opacity");
+        if (cJSON_IsNumber(opacityJson)) {
+            if (opacityJson->valueint < 0) {
+                config->opacity = 0;
+            } else if (opacityJson->valueint > 255) {
+                config->opacity = 255;
+            } else {
+                config->opacity = (uint8_t) opacityJson->valueint;
+            }
+        }
+        count++;
+    }
+
+    batch->numLayers = count;
+    batch->hasLayers = true;
+    return true;
+}
+
+// Rebuilds the layer stack. Only called by the render task, between frames.
+static void layersApply(const layerConfig *configs, uint8_t count)
+{
+    transitionRunning = false;
+    leds_clear(true);
+    for (uint8_t i = 0; i < count; i++) {
+        layers[i].layerScene = configs[i].layerScene;
+        layers[i].blend = configs[i].blend;
+        layers[i].opacity = configs[i].opacity;
+        ESP_LOGI(TAG, "Layer %d: scene = %s, blend = %s, opacity = %d", i, sceneNames[layers[i].layerScene], blendNames[layers[i].blend], layers[i].opacity);
+    }
+    layersInit(count);
+    numLayers = count;
+}
+
+// Settings are queued as a batch, so the render task applies them between
+// frames. Returns false, having changed nothing, if name isn't something with
+// settings or json isn't valid.
+bool setSceneConfig(char *name, cJSON *json)
+{
+    static configBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    if (!cJSON_IsObject(json)) {
+        return false;
+    }
+
+    scene configScene;
+    if (strncmp(name, "transition", 10) == 0)
     {
-        currentScene = SCENE_FILL;
+        parse_transition_config(json, &batch.transition, &batch.transitionMillis);
+        batch.hasTransition = true;
     }
-    else if (strncmp(scene, "snake", 5) == 0)
+    else if (strncmp(name, "layers", 6) == 0)
     {
-        currentScene = SCENE_SNAKE;
+        if (!parse_layers_config(json, &batch)) {
+            return false;
+        }
     }
-    else if (strncmp(scene, "blocks", 6) == 0)
+    else if (strncmp(name, "canvas", 6) == 0)
     {
-        currentScene = SCENE_BLOCKS;
+        if (!parse_canvas_config(json, &batch.canvas)) {
+            return false;
+        }
+        batch.hasCanvas = true;
+    }
+    else if (strncmp(name, "effects", 7) == 0)
+    {
+        effects_get_config(&batch.effects);
+        effects_parse_config(json, &batch.effects);
+        batch.hasEffects = true;
+    }
+    else if (strncmp(name, "interpolation", 13) == 0)
+    {
+        interpolation_get_config(&batch.interpolation);
+        interpolation_parse_config(json, &batch.interpolation);
+        batch.hasInterpolation = true;
+    }
+    else if (sceneFromName(name, &configScene) && parseSceneConfig(configScene, json, &batch.configs[configScene]))
+    {
+        batch.hasConfig[configScene] = true;
     }
     else
     {
+        return false;
+    }
+    applyConfigBatch(&batch);
+    return true;
+}
+
+static bool sceneUpdate(scene updateScene, frameBuffer *frame, uint32_t millis)
+{
+    switch (updateScene)
+    {
+        case SCENE_FILL:
+            return fill_scene_update(frame, millis);
+        case SCENE_SNAKE:
+            return snake_scene_update(frame, millis);
+        case SCENE_BLOCKS:
+            return blocks_scene_update(frame, millis);
+        case SCENE_ANIM:
+            return anim_scene_update(frame, millis);
+        case SCENE_STREAM:
+            return stream_scene_update(frame, millis);
+        case SCENE_PLASMA:
+            return plasma_scene_update(frame, millis);
+        case SCENE_PARTICLES:
+            return particles_scene_update(frame, millis);
+        case SCENE_TEXT:
+            return text_scene_update(frame, millis);
+        case SCENE_LIFE:
+            return life_scene_update(frame, millis);
+        case SCENE_SHADER:
+            return shader_scene_update(frame, millis);
+        case SCENE_SPECTRUM:
+            return spectrum_scene_update(frame, millis);
+        case SCENE_IMAGE:
+            return image_scene_update(frame, millis);
+    }
+    return false;
+}
+
+static void sceneInit(scene initScene, frameBuffer *frame)
+{
+    leds_clear_frame(frame);
+    // Scenes that draw through a palette set their own in init
+    leds_set_palette(frame, NULL);
+
+    switch (initScene)
+    {
+        case SCENE_FILL:
+            fill_scene_init(frame);
+            break;
+        case SCENE_SNAKE:
+            snake_scene_init();
+            break;
+        case SCENE_BLOCKS:
+            blocks_scene_init();
+            break;
+        case SCENE_ANIM:
+            anim_scene_init();
+            break;
+        case SCENE_STREAM:
+            stream_scene_init();
+            break;
+        case SCENE_PLASMA:
+            plasma_scene_init(frame);
+            break;
+        case SCENE_PARTICLES:
+            particles_scene_init();
+            break;
+        case SCENE_TEXT:
+            text_scene_init(frame);
+            break;
+        case SCENE_LIFE:
+            life_scene_init(frame);
+            break;
+        case SCENE_SHADER:
+            shader_scene_init();
+            break;
+        case SCENE_SPECTRUM:
+            spectrum_scene_init();
+            break;
+        case SCENE_IMAGE:
+            image_scene_init();
+            break;
+    }
+}
+
+static void transitionStart(scene newScene)
+{
+    previousScene = currentScene;
+    currentScene = newScene;
+    activeFrame ^= 1;
+    sceneInit(currentScene, &frames[activeFrame]);
+
+    if (transition == TRANSITION_DISSOLVE) {
+        for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+            dissolveThresholds[i] = esp_random() & 0xFF;
+        }
+    }
+
+    transitionMaxBlendMicros = 0;
+    // The start time is taken from the render loop's clock on the next update
+    transitionStartPending = true;
+    transitionRunning = true;
+}
+
+// Fills transitionWeights for a transition progress of 0 - 256
+static void transitionSetWeights(uint16_t progress)
+{
+    switch (transition)
+    {
+        case TRANSITION_CUT:
+        case TRANSITION_CROSSFADE:
+        {
+            uint8_t weight = progress > 255 ? 255 : progress;
+            memset(transitionWeights, weight, NUM_PIXELS);
+            break;
+        }
+        case TRANSITION_WIPE:
+        {
+            // The edge moves left to right and is one column wide
+            const ledPosition *positions = ledmap_positions();
+            int32_t edge = progress * PIXELS_PER_ROW;
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                int32_t weight = edge - positions[i].x;
+                if (weight < 0) {
+                    weight = 0;
+                } else if (weight > 255) {
+                    weight = 255;
+                }
+                transitionWeights[i] = weight;
+            }
+            break;
+        }
+        case TRANSITION_DISSOLVE:
+        {
+            // Each pixel fades in quickly once progress passes its threshold
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                int32_t weight = (progress - dissolveThresholds[i]) * 8;
+                if (weight < 0) {
+                    weight = 0;
+                } else if (weight > 255) {
+                    weight = 255;
+                }
+                transitionWeights[i] = weight;
+            }
+            break;
+        }
+    }
+}
+
+static void transitionUpdate(uint32_t millis)
+{
+    if (transitionStartPending) {
+        transitionStartMillis = millis;
+        transitionLastFrameMillis = millis - TRANSITION_FRAME_MILLIS;
+        transitionStartPending = false;
+    }
+
+    sceneUpdate(previousScene, &frames[activeFrame ^ 1], millis);
+
+    uint32_t elapsedMillis = millis - transitionStartMillis;
+    if (elapsedMillis >= transitionMillis) {
+        transitionRunning = false;
+        leds_show(ledFrame(currentScene, &frames[activeFrame], &rasterFrames[0]));
+        ESP_LOGI(TAG, "Transition done, max blend time = %d us", transitionMaxBlendMicros);
         return;
     }
-    
-    leds_clear(true);
-    currentSceneInit();
-    ESP_LOGI(TAG, "New scene: %s", scene); 
+
+    if (millis - transitionLastFrameMillis < TRANSITION_FRAME_MILLIS) {
+        return;
+    }
+    transitionLastFrameMillis = millis;
+
+    int64_t blendStart = esp_timer_get_time();
+    transitionSetWeights((elapsedMillis * 256) / transitionMillis);
+    leds_show_blend(ledFrame(previousScene, &frames[activeFrame ^ 1], &rasterFrames[0]),
+                    ledFrame(currentScene, &frames[activeFrame], &rasterFrames[1]), transitionWeights);
+    uint32_t blendMicros = esp_timer_get_time() - blendStart;
+    if (blendMicros > transitionMaxBlendMicros) {
+        transitionMaxBlendMicros = blendMicros;
+    }
 }
 
-void currentSceneUpdate(uint32_t millis)
+scene getCurrentScene()
+{
+    return currentScene;
+}
+
+const char *sceneName(scene nameScene)
+{
+    return sceneNames[nameScene];
+}
+
+// Sets the scene to start with, before the LEDs are initialised
+void setStartScene(scene startScene)
+{
+    currentScene = startScene;
+}
+
+void selectScene(scene selectedScene)
 {
-    switch (currentScene)
+    // Selecting a single scene replaces any layers
+    numLayers = 0;
+
+    // Scene state is per scene, so a scene can't transition into itself
+    if (transition == TRANSITION_CUT || selectedScene == currentScene || transitionRunning) {
+        currentScene = selectedScene;
+        leds_clear(true);
+        currentSceneInit();
+    } else {
+        transitionStart(selectedScene);
+    }
+    ESP_LOGI(TAG, "New scene: %s", sceneNames[selectedScene]);
+}
+
+// Selects the scene from the render loop once millis reaches startMillis
+void scheduleScene(scene startScene, uint32_t startMillis)
+{
+    scheduledSceneMillis = startMillis;
+    scheduledScene = startScene;
+}
+
+void setCurrentScene(char *newScene)
+{
+    scene selectedScene;
+
+    if (!sceneFromName(newScene, &selectedScene))
+    {
+        return;
+    }
+    // Frames kept in time by sync start the scene together
+    scheduleScene(selectedScene, sync_scene_start(selectedScene));
+    settings_save_later();
+}
+
+// Fills config with the scene's current settings. Returns false for scenes without settings.
+bool getSceneConfig(scene configScene, sceneConfig *config)
+{
+    switch (configScene)
+    {
+        case SCENE_FILL:
+            fill_scene_get_config(&config->fill);
+            return true;
+        case SCENE_SNAKE:
+            snake_scene_get_config(&config->snake);
+            return true;
+        case SCENE_BLOCKS:
+            blocks_scene_get_config(&config->blocks);
+            return true;
+        case SCENE_PLASMA:
+            plasma_scene_get_config(&config->plasma);
+            return true;
+        case SCENE_PARTICLES:
+            particles_scene_get_config(&config->particles);
+            return true;
+        case SCENE_TEXT:
+            text_scene_get_config(&config->text);
+            return true;
+        case SCENE_LIFE:
+            life_scene_get_config(&config->life);
+            return true;
+        case SCENE_SHADER:
+            shader_scene_get_config(&config->shader);
+            return true;
+        case SCENE_SPECTRUM:
+            spectrum_scene_get_config(&config->spectrum);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Fills config with the scene's current settings overridden by those in json.
+// Returns false for scenes without settings.
+bool parseSceneConfig(scene configScene, cJSON *json, sceneConfig *config)
+{
+    // Settings still waiting for the render task are built on, so a change
+    // sent straight after another doesn't undo it
+    bool pending = false;
+    portENTER_CRITICAL(&batchMux);
+    if (batchPending && pendingBatch.hasConfig[configScene]) {
+        *config = pendingBatch.configs[configScene];
+        pending = true;
+    }
+    portEXIT_CRITICAL(&batchMux);
+    if (!pending && !getSceneConfig(configScene, config)) {
+        return false;
+    }
+    switch (configScene)
     {
         case SCENE_FILL:
-            fill_scene_update(millis);
+            fill_scene_parse_config(json, &config->fill);
             break;
         case SCENE_SNAKE:
-            snake_scene_update(millis);
+            snake_scene_parse_config(json, &config->snake);
             break;
         case SCENE_BLOCKS:
-            blocks_scene_update(millis);
+            blocks_scene_parse_config(json, &config->blocks);
+            break;
+        case SCENE_PLASMA:
+            plasma_scene_parse_config(json, &config->plasma);
+            break;
+        case SCENE_PARTICLES:
+            particles_scene_parse_config(json, &config->particles);
+            break;
+        case SCENE_TEXT:
+            text_scene_parse_config(json, &config->text);
+            break;
+        case SCENE_LIFE:
+            life_scene_parse_config(json, &config->life);
+            break;
+        case SCENE_SHADER:
+            shader_scene_parse_config(json, &config->shader);
+            break;
+        case SCENE_SPECTRUM:
+            spectrum_scene_parse_config(json, &config->spectrum);
+            break;
+        default:
             break;
     }
+    return true;
 }
 
-void currentSceneInit()
+// Adds the scene's current settings to json. Returns false for scenes without settings.
+bool addSceneConfig(scene configScene, cJSON *json)
 {
-    switch (currentScene)
+    sceneConfig config;
+    if (!getSceneConfig(configScene, &config)) {
+        return false;
+    }
+    switch (configScene)
     {
         case SCENE_FILL:
-            fill_scene_init();
+            fill_scene_print_config(&config.fill, json);
             break;
         case SCENE_SNAKE:
-            snake_scene_init();
+            snake_scene_print_config(&config.snake, json);
             break;
         case SCENE_BLOCKS:
-            blocks_scene_init();
+            blocks_scene_print_config(&config.blocks, json);
+            break;
+        case SCENE_PLASMA:
+            plasma_scene_print_config(&config.plasma, json);
+            break;
+        case SCENE_PARTICLES:
+            particles_scene_print_config(&config.particles, json);
+            break;
+        case SCENE_TEXT:
+            text_scene_print_config(&config.text, json);
+            break;
+        case SCENE_LIFE:
+            life_scene_print_config(&config.life, json);
+            break;
+        case SCENE_SHADER:
+            shader_scene_print_config(&config.shader, json);
+            break;
+        case SCENE_SPECTRUM:
+            spectrum_scene_print_config(&config.spectrum, json);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// Adds everything that can be set through the API, as it is now
+void addCurrentConfig(cJSON *json)
+{
+    cJSON_AddStringToObject(json, "scene", sceneNames[currentScene]);
+    cJSON_AddNumberToObject(json, "brightness", leds_get_brightness());
+
+    cJSON *transitionJson = cJSON_AddObjectToObject(json, "transition");
+    cJSON_AddStringToObject(transitionJson, "type", transitionNames[transition]);
+    cJSON_AddNumberToObject(transitionJson, "millis", transitionMillis);
+
+    cJSON *canvasJson = cJSON_AddObjectToObject(json, "canvas");
+    cJSON_AddNumberToObject(canvasJson, "width", canvas.width);
+    cJSON_AddNumberToObject(canvasJson, "height", canvas.height);
+    cJSON_AddNumberToObject(canvasJson, "x", canvas.x);
+    cJSON_AddNumberToObject(canvasJson, "y", canvas.y);
+    cJSON_AddNumberToObject(canvasJson, "seed", canvas.seed);
+
+    effectsConfig effects;
+    effects_get_config(&effects);
+    effects_print_config(&effects, cJSON_AddObjectToObject(json, "effects"));
+
+    interpolationConfig interpolation;
+    interpolation_get_config(&interpolation);
+    interpolation_print_config(&interpolation, cJSON_AddObjectToObject(json, "interpolation"));
+
+    cJSON *layersJson = cJSON_AddArrayToObject(json, "layers");
+    for (uint8_t i = 0; i < numLayers; i++) {
+        cJSON *layerJson = cJSON_CreateObject();
+        cJSON_AddStringToObject(layerJson, "scene", sceneNames[layers[i].layerScene]);
+        cJSON_AddStringToObject(layerJson, "blend", blendNames[layers[i].blend]);
+        cJSON_AddNumberToObject(layerJson, "opacity", layers[i].opacity);
+        cJSON_AddItemToArray(layersJson, layerJson);
+    }
+
+    cJSON *configsJson = cJSON_AddObjectToObject(json, "configs");
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        cJSON *configJson = cJSON_CreateObject();
+        if (addSceneConfig(i, configJson)) {
+            cJSON_AddItemToObject(configsJson, sceneNames[i], configJson);
+        } else {
+            cJSON_Delete(configJson);
+        }
+    }
+}
+
+void applySceneConfig(scene configScene, const sceneConfig *config)
+{
+    switch (configScene)
+    {
+        case SCENE_FILL:
+            fill_scene_set_config(&config->fill);
+            break;
+        case SCENE_SNAKE:
+            snake_scene_set_config(&config->snake);
+            break;
+        case SCENE_BLOCKS:
+            blocks_scene_set_config(&config->blocks);
+            break;
+        case SCENE_PLASMA:
+            plasma_scene_set_config(&config->plasma);
+            break;
+        case SCENE_PARTICLES:
+            particles_scene_set_config(&config->particles);
+            break;
+        case SCENE_TEXT:
+            text_scene_set_config(&config->text);
+            break;
+        case SCENE_LIFE:
+            life_scene_set_config(&config->life);
+            break;
+        case SCENE_SHADER:
+            shader_scene_set_config(&config->shader);
+            break;
+        case SCENE_SPECTRUM:
+            spectrum_scene_set_config(&config->spectrum);
+            break;
+        default:
+            break;
+    }
+}
+
+static inline uint8_t mixChannel(uint8_t a, uint8_t b, uint16_t weight)
+{
+    return a + (((b - a) * weight) >> 8);
+}
+
+// Merges a layer over the composite of the layers below it into dest.
+// Alpha treats black pixels as transparent, the other modes apply to every pixel.
+// The loop is repeated per mode to keep the mode switch out of the pixel loop.
+static void blendLayer(pixelColor_t *dest, const pixelColor_t *below, const layer *src)
+{
+    // Stretch 0 - 255 to 0 - 256 so full opacity is exact
+    uint16_t opacity = src->opacity + (src->opacity >> 7);
+    const frameBuffer *frame = ledFrame(src->layerScene, &src->frame, &rasterFrames[0]);
+
+    switch (src->blend)
+    {
+        case BLEND_ALPHA:
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                pixelColor_t a = below[i];
+                pixelColor_t b = framePixel(frame, i);
+                if ((b.r | b.g | b.b) == 0) {
+                    dest[i] = a;
+                    continue;
+                }
+                dest[i].r = mixChannel(a.r, b.r, opacity);
+                dest[i].g = mixChannel(a.g, b.g, opacity);
+                dest[i].b = mixChannel(a.b, b.b, opacity);
+                dest[i].w = 0;
+            }
+            break;
+        case BLEND_ADD:
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                pixelColor_t a = below[i];
+                pixelColor_t b = framePixel(frame, i);
+                uint16_t r = a.r + ((b.r * opacity) >> 8);
+                uint16_t g = a.g + ((b.g * opacity) >> 8);
+                uint16_t bl = a.b + ((b.b * opacity) >> 8);
+                dest[i].r = r > 255 ? 255 : r;
+                dest[i].g = g > 255 ? 255 : g;
+                dest[i].b = bl > 255 ? 255 : bl;
+                dest[i].w = 0;
+            }
+            break;
+        case BLEND_MAX:
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                pixelColor_t a = below[i];
+                pixelColor_t b = framePixel(frame, i);
+                dest[i].r = mixChannel(a.r, b.r > a.r ? b.r : a.r, opacity);
+                dest[i].g = mixChannel(a.g, b.g > a.g ? b.g : a.g, opacity);
+                dest[i].b = mixChannel(a.b, b.b > a.b ? b.b : a.b, opacity);
+                dest[i].w = 0;
+            }
+            break;
+        case BLEND_MULTIPLY:
+            for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+                pixelColor_t a = below[i];
+                pixelColor_t b = framePixel(frame, i);
+                // (x * y + 255) >> 8 is exact for 0 and 255
+                dest[i].r = mixChannel(a.r, (a.r * b.r + 255) >> 8, opacity);
+                dest[i].g = mixChannel(a.g, (a.g * b.g + 255) >> 8, opacity);
+                dest[i].b = mixChannel(a.b, (a.b * b.b + 255) >> 8, opacity);
+                dest[i].w = 0;
+            }
             break;
     }
-}
\ No newline at end of file
+}
+
+static void layersUpdate(uint32_t millis)
+{
+    int8_t lowestChanged = -1;
+
+    for (uint8_t i = 0; i < numLayers; i++) {
+        int64_t renderStart = esp_timer_get_time();
+        if (!sceneUpdate(layers[i].layerScene, &layers[i].frame, millis)) {
+            continue;
+        }
+        layers[i].renderMicros = esp_timer_get_time() - renderStart;
+        if (layers[i].renderMicros > layers[i].maxRenderMicros) {
+            layers[i].maxRenderMicros = layers[i].renderMicros;
+        }
+        if (lowestChanged < 0) {
+            lowestChanged = i;
+        }
+    }
+
+    if (lowestChanged < 0) {
+        if (effects_frame_due(millis)) {
+            leds_show_pixels(layerComposites[numLayers - 1]);
+        }
+        return;
+    }
+
+    int64_t composeStart = esp_timer_get_time();
+    for (uint8_t i = lowestChanged; i < numLayers; i++) {
+        blendLayer(layerComposites[i], i == 0 ? blackPixels : layerComposites[i - 1], &layers[i]);
+    }
+    leds_show_pixels(layerComposites[numLayers - 1]);
+    composeMicros = esp_timer_get_time() - composeStart;
+}
+
+// Fills batch from json, which can hold any of a scene to select, settings
+// for each scene, a brightness, transition settings, effect stages and which
+// sources are interpolated. Returns false, leaving nothing to apply, if any part is not
+// valid.
+bool parseConfigBatch(cJSON *json, configBatch *batch)
+{
+    memset(batch, 0, sizeof(configBatch));
+    if (!cJSON_IsObject(json)) {
+        return false;
+    }
+
+    const cJSON *sceneJson = cJSON_GetObjectItem(json, "scene");
+    if (sceneJson != NULL) {
+        if (!cJSON_IsString(sceneJson) || !sceneFromName(sceneJson->valuestring, &batch->batchScene)) {
+            return false;
+        }
+        batch->hasScene = true;
+    }
+
+    cJSON *configsJson = cJSON_GetObjectItem(json, "configs");
+    if (configsJson != NULL) {
+        if (!cJSON_IsObject(configsJson)) {
+            return false;
+        }
+        cJSON *configJson;
+        cJSON_ArrayForEach(configJson, configsJson) {
+            scene configScene;
+            if (!sceneFromName(configJson->string, &configScene)
+                    || !parseSceneConfig(configScene, configJson, &batch->configs[configScene])) {
+                return false;
+            }
+            batch->hasConfig[configScene] = true;
+        }
+    }
+
+    const cJSON *brightnessJson = cJSON_GetObjectItem(json, "brightness");
+    if (brightnessJson != NULL) {
+        if (!cJSON_IsNumber(brightnessJson) || brightnessJson->valueint < 0 || brightnessJson->valueint > 255) {
+            return false;
+        }
+        batch->brightness = (uint8_t) brightnessJson->valueint;
+        batch->hasBrightness = true;
+    }
+
+    cJSON *transitionJson = cJSON_GetObjectItem(json, "transition");
+    if (transitionJson != NULL) {
+        if (!cJSON_IsObject(transitionJson)) {
+            return false;
+        }
+        parse_transition_config(transitionJson, &batch->transition, &batch->transitionMillis);
+        batch->hasTransition = true;
+    }
+
+    cJSON *effectsJson = cJSON_GetObjectItem(json, "effects");
+    if (effectsJson != NULL) {
+        if (!cJSON_IsObject(effectsJson)) {
+            return false;
+        }
+        effects_get_config(&batch->effects);
+        effects_parse_config(effectsJson, &batch->effects);
+        batch->hasEffects = true;
+    }
+
+    cJSON *interpolationJson = cJSON_GetObjectItem(json, "interpolation");
+    if (interpolationJson != NULL) {
+        if (!cJSON_IsObject(interpolationJson)) {
+            return false;
+        }
+        interpolation_get_config(&batch->interpolation);
+        interpolation_parse_config(interpolationJson, &batch->interpolation);
+        batch->hasInterpolation = true;
+    }
+    return true;
+}
+
+// Queues batch to be applied as a whole before the next frame is drawn. A
+// batch still waiting is merged with, later settings winning.
+void applyConfigBatch(const configBatch *batch)
+{
+    // Frames kept in time by sync start the scene together
+    uint32_t startMillis = batch->hasScene ? sync_scene_start(batch->batchScene) : 0;
+
+    portENTER_CRITICAL(&batchMux);
+    if (!batchPending) {
+        memset(&pendingBatch, 0, sizeof(pendingBatch));
+    }
+    if (batch->hasScene) {
+        pendingBatch.hasScene = true;
+        pendingBatch.batchScene = batch->batchScene;
+        pendingBatch.startMillis = startMillis;
+    }
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        if (batch->hasConfig[i]) {
+            pendingBatch.hasConfig[i] = true;
+            pendingBatch.configs[i] = batch->configs[i];
+        }
+    }
+    if (batch->hasBrightness) {
+        pendingBatch.hasBrightness = true;
+        pendingBatch.brightness = batch->brightness;
+    }
+    if (batch->hasTransition) {
+        pendingBatch.hasTransition = true;
+        pendingBatch.transition = batch->transition;
+        pendingBatch.transitionMillis = batch->transitionMillis;
+    }
+    if (batch->hasLayers) {
+        pendingBatch.hasLayers = true;
+        pendingBatch.numLayers = batch->numLayers;
+        memcpy(pendingBatch.layers, batch->layers, sizeof(pendingBatch.layers));
+    }
+    if (batch->hasCanvas) {
+        pendingBatch.hasCanvas = true;
+        pendingBatch.canvas = batch->canvas;
+    }
+    if (batch->hasEffects) {
+        pendingBatch.hasEffects = true;
+        pendingBatch.effects = batch->effects;
+    }
+    if (batch->hasInterpolation) {
+        pendingBatch.hasInterpolation = true;
+        pendingBatch.interpolation = batch->interpolation;
+    }
+    batchPending = true;
+    portEXIT_CRITICAL(&batchMux);
+
+    settings_save_later();
+}
+
+static void batchUpdate()
+{
+    static configBatch batch;
+
+    portENTER_CRITICAL(&batchMux);
+    batch = pendingBatch;
+    batchPending = false;
+    portEXIT_CRITICAL(&batchMux);
+
+    uint8_t configs = 0;
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        if (batch.hasConfig[i]) {
+            applySceneConfig(i, &batch.configs[i]);
+            configs++;
+        }
+    }
+    if (batch.hasBrightness) {
+        leds_set_brightness(batch.brightness);
+    }
+    if (batch.hasTransition) {
+        transition = batch.transition;
+        transitionMillis = batch.transitionMillis;
+    }
+    if (batch.hasEffects) {
+        effects_set_config(&batch.effects);
+    }
+    if (batch.hasInterpolation) {
+        interpolation_set_config(&batch.interpolation);
+    }
+    if (batch.hasCanvas) {
+        setCanvas(&batch.canvas);
+    }
+    if (batch.hasLayers) {
+        layersApply(batch.layers, batch.numLayers);
+    }
+    if (batch.hasScene) {
+        scheduleScene(batch.batchScene, batch.startMillis);
+    }
+
+    ESP_LOGI(TAG, "Applied config batch: scene = %s, configs = %d, brightness = %d, transition = %d", batch.hasScene ? sceneNames[batch.batchScene] : "-", configs, batch.hasBrightness ? batch.brightness : -1, batch.hasTransition ? transition : -1);
+}
+
+void currentSceneUpdate(uint32_t millis)
+{
+    if (batchPending) {
+        batchUpdate();
+    }
+    if (ledmap_apply_pending()) {
+        // Scenes that work out where LEDs are start again with the new map
+        restartPending = true;
+    }
+    if (restartPending) {
+        restartPending = false;
+        currentSceneInit();
+    }
+    if (scheduledScene >= 0 && (int32_t) (millis - scheduledSceneMillis) >= 0) {
+        scene startScene = scheduledScene;
+        scheduledScene = -1;
+        selectScene(startScene);
+    }
+
+    if (numLayers > 0) {
+        layersUpdate(millis);
+        return;
+    }
+
+    int64_t renderStart = esp_timer_get_time();
+    bool drawn = sceneUpdate(currentScene, &frames[activeFrame], millis);
+    if (drawn) {
+        uint32_t renderMicros = esp_timer_get_time() - renderStart;
+        if (renderMicros > sceneMaxRenderMicros[currentScene]) {
+            sceneMaxRenderMicros[currentScene] = renderMicros;
+        }
+    }
+
+    if (transitionRunning) {
+        transitionUpdate(millis);
+    } else if (drawn || effects_frame_due(millis)) {
+        // Without a new frame, the last one again lets decay trails fade out
+        leds_show(ledFrame(currentScene, &frames[activeFrame], &rasterFrames[0]));
+    }
+}
+
+void currentSceneInit()
+{
+    transitionRunning = false;
+    if (numLayers > 0) {
+        layersInit(numLayers);
+    } else {
+        sceneInit(currentScene, &frames[activeFrame]);
+    }
+}
+
+void addSceneStats(cJSON *json)
+{
+    cJSON_AddStringToObject(json, "scene", sceneNames[currentScene]);
+    cJSON_AddNumberToObject(json, "transitionMaxBlendMicros", transitionMaxBlendMicros);
+
+    cJSON *layersJson = cJSON_AddArrayToObject(json, "layers");
+    for (uint8_t i = 0; i < numLayers; i++) {
+        cJSON *layerJson = cJSON_CreateObject();
+        cJSON_AddStringToObject(layerJson, "scene", sceneNames[layers[i].layerScene]);
+        cJSON_AddNumberToObject(layerJson, "renderMicros", layers[i].renderMicros);
+        cJSON_AddNumberToObject(layerJson, "maxRenderMicros", layers[i].maxRenderMicros);
+        cJSON_AddItemToArray(layersJson, layerJson);
+    }
+    cJSON_AddNumberToObject(json, "composeMicros", composeMicros);
+
+    cJSON *renderJson = cJSON_AddObjectToObject(json, "sceneMaxRenderMicros");
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        if (sceneMaxRenderMicros[i] > 0) {
+            cJSON_AddNumberToObject(renderJson, sceneNames[i], sceneMaxRenderMicros[i]);
+        }
+    }
+}
@@ -2,6 +2,7 @@
 #define FRAME_BASE_H
 
 #include <cJSON.h>
+#include "esp32_digital_led_lib.h"
 
 #define PIXELS_PER_ROW 8
 #define NUM_ROWS 6
@@ -9,6 +10,10 @@
 
 #define HSV_MAX_VALUE 1
 
+// Entry 0 is reserved for black so cleared pixels never need a palette slot
+#define PALETTE_SIZE 256
+#define PALETTE_BLACK 0
+
 typedef struct hsvColour {
     float hue;
     float sat;
@@ -21,12 +26,274 @@ typedef struct hsvColourChangeConfig {
     float maxValue;
 } hsvColourChangeConfig;
 
-typedef enum {SCENE_FILL, SCENE_SNAKE, SCENE_BLOCKS} scene;
+// Scenes draw into a frame buffer supplied by frame_base rather than straight
+// into the strand, so more than one scene can be rendered at a time. A frame
+// with a palette holds palette entries in indices, otherwise colours in pixels.
+// The two share their memory, so a scene that changes palette mode clears the
+// frame first. Indices take a quarter of the space, and the rest goes unused.
+typedef struct frameBuffer {
+    union {
+        pixelColor_t pixels[NUM_PIXELS];
+        uint8_t indices[NUM_PIXELS];
+    };
+    const uint32_t *palette;
+} frameBuffer;
+
+// Where an LED sits, in 1/256 pixels from the top left of the panel's grid
+typedef struct ledPosition {
+    int16_t x;
+    int16_t y;
+} ledPosition;
+
+typedef struct fillSceneConfig {
+    // 0 - change at end of fill, 1 - change after each pixel, 2 - change after each row
+    uint8_t colourMode;
+    bool clearMode;
+    // true - forwards through the order (down for strip), false - backwards
+    bool fillDirection;
+    bool clearDirection;
+    uint16_t fillPixelMillis;
+    uint16_t fillPauseMillis;
+    uint16_t clearPixelMillis;
+    uint16_t clearPauseMillis;
+    hsvColour colour;
+    hsvColourChangeConfig colourChange;
+    // 0 - strip, 1 - columns, 2 - diagonal, 3 - spiral, 4 - random, 5 - centre out
+    uint8_t fillOrder;
+    uint8_t clearOrder;
+} fillSceneConfig;
+
+typedef struct snakeSceneConfig {
+    uint16_t count;
+    uint16_t length;
+    uint16_t moveMillis;
+    // Snakes turn at random after this many moves
+    uint8_t movesBeforeDirChange;
+    hsvColour colour;
+    // Added to the hue for each move, so the body shows the colours it has been
+    float hueChange;
+} snakeSceneConfig;
+
+typedef struct blocksSceneConfig {
+    uint16_t moveMillis;
+    uint8_t movesBeforeColsReset;
+    // Width and height of a block in pixels
+    uint8_t blockSize;
+    // How many columns can have a block falling at once
+    uint8_t maxFalling;
+} blocksSceneConfig;
+
+typedef struct plasmaSceneConfig {
+    uint8_t scale;
+    uint8_t speed;
+    uint8_t palette;
+    float value;
+} plasmaSceneConfig;
+
+typedef struct particlesSceneConfig {
+    // 0 - sparkle, 1 - rain, 2 - fireworks
+    uint8_t effect;
+    // Particles, or bursts for fireworks, per second
+    uint16_t spawnRate;
+    uint16_t lifeMillis;
+    // Added to each particle's downward speed every frame, 1/256 pixel per frame
+    int8_t gravity;
+    float hue;
+    float hueSpread;
+    float value;
+} particlesSceneConfig;
+
+typedef struct lifeSceneConfig {
+    // Bit n is set if a dead cell with n live neighbours comes alive
+    uint16_t birth;
+    // Bit n is set if a live cell with n live neighbours stays alive
+    uint16_t survive;
+    // 2 for Life-like rules. With more, cells take states - 2 generations to
+    // die and can't come alive until then, as in Brian's Brain (3).
+    uint8_t states;
+    // Chance out of 256 of each cell starting alive
+    uint8_t density;
+    uint16_t generationMillis;
+    // Start again after this many generations, 0 to run until the pattern settles
+    uint16_t maxGenerations;
+    float hue;
+    // Added to the hue as cells get older
+    float hueSpread;
+    float value;
+} lifeSceneConfig;
+
+typedef struct shaderSceneConfig {
+    // Inputs to the program, SHADER_NUM_PARAMS of them
+    float params[4];
+    uint16_t frameMillis;
+} shaderSceneConfig;
+
+typedef struct spectrumSceneConfig {
+    // Frequencies of the left edge of the first column and the right edge of
+    // the last, with the columns spaced evenly in pitch between them
+    uint16_t minHz;
+    uint16_t maxHz;
+    // Levels this far below full scale show as empty columns
+    uint8_t rangeDb;
+    // Time for a falling bar to drop one row
+    uint16_t fallMillis;
+    // Time the peak of each column stays before falling
+    uint16_t peakHoldMillis;
+    float hue;
+    // Added to the hue from the bottom row to the top
+    float hueSpread;
+    float value;
+} spectrumSceneConfig;
+
+// Longest text the text scene shows, in characters
+#define MAX_TEXT_LENGTH 32
+
+typedef struct textSceneConfig {
+    char text[MAX_TEXT_LENGTH + 1];
+    // Time for the text to move one pixel left
+    uint16_t columnMillis;
+    // Each font pixel is drawn as scale x scale LEDs
+    uint8_t scale;
+    float hue;
+    float value;
+} textSceneConfig;
+
+// Where this frame's panel sits in a canvas made of several networked frames.
+// Scenes work in canvas coordinates and only draw the pixels on this panel.
+typedef struct canvasConfig {
+    uint16_t width;
+    uint16_t height;
+    uint16_t x;
+    uint16_t y;
+    // Seeds canvasRandom, so every frame of the canvas makes the same choices
+    uint32_t seed;
+} canvasConfig;
+
+#define MAX_EFFECT_STAGES 6
+
+typedef enum {EFFECT_DECAY, EFFECT_BLUR, EFFECT_MIRROR, EFFECT_HUE} effectType;
+
+// Mirror axes, ORed together for a kaleidoscope
+#define MIRROR_HORIZONTAL 1
+#define MIRROR_VERTICAL 2
+
+typedef struct effectStage {
+    uint8_t type;
+    // Decay - share of the last frame kept each 16 ms, out of 256. Blur - radius in
+    // pixels. Mirror - axes. Hue - shift, 256 being a full turn.
+    uint8_t param;
+} effectStage;
+
+// Effects applied in order to every frame before it is sent to the LEDs
+typedef struct effectsConfig {
+    uint8_t numStages;
+    effectStage stages[MAX_EFFECT_STAGES];
+} effectsConfig;
+
+// Sources whose frames can be blended into smooth intermediate frames
+typedef enum {INTERPOLATE_STREAM, INTERPOLATE_ANIM, INTERPOLATE_IMAGE} interpolateSource;
+#define NUM_INTERPOLATE_SOURCES (INTERPOLATE_IMAGE + 1)
+
+typedef struct interpolationConfig {
+    // Bit n is set if source n is interpolated
+    uint8_t sources;
+} interpolationConfig;
+
+// Parsed scene settings, so they can be stored and applied without JSON
+typedef union sceneConfig {
+    fillSceneConfig fill;
+    snakeSceneConfig snake;
+    blocksSceneConfig blocks;
+    plasmaSceneConfig plasma;
+    particlesSceneConfig particles;
+    textSceneConfig text;
+    lifeSceneConfig life;
+    shaderSceneConfig shader;
+    spectrumSceneConfig spectrum;
+} sceneConfig;
+
+typedef enum {SCENE_FILL, SCENE_SNAKE, SCENE_BLOCKS, SCENE_ANIM, SCENE_STREAM, SCENE_PLASMA, SCENE_PARTICLES, SCENE_TEXT, SCENE_LIFE, SCENE_SHADER, SCENE_SPECTRUM, SCENE_IMAGE} scene;
+#define NUM_SCENES (SCENE_IMAGE + 1)
+
+// Boot phases in the order they are expected to be reached
+typedef enum {BOOT_NVS, BOOT_LEDS, BOOT_FIRST_FRAME, BOOT_WIFI, BOOT_HTTPD} bootPhase;
+#define NUM_BOOT_PHASES (BOOT_HTTPD + 1)
+
+typedef enum {TRANSITION_CUT, TRANSITION_CROSSFADE, TRANSITION_WIPE, TRANSITION_DISSOLVE} transitionType;
+
+typedef enum {BLEND_ALPHA, BLEND_ADD, BLEND_MAX, BLEND_MULTIPLY} blendMode;
+
+#define MAX_LAYERS 4
+
+typedef struct layerConfig {
+    scene layerScene;
+    blendMode blend;
+    uint8_t opacity;
+} layerConfig;
+
+// Settings sent together in one request and applied between two frames
+typedef struct configBatch {
+    bool hasScene;
+    scene batchScene;
+    uint32_t startMillis;
+    bool hasConfig[NUM_SCENES];
+    sceneConfig configs[NUM_SCENES];
+    bool hasBrightness;
+    uint8_t brightness;
+    bool hasTransition;
+    transitionType transition;
+    uint16_t transitionMillis;
+    bool hasLayers;
+    uint8_t numLayers;
+    layerConfig layers[MAX_LAYERS];
+    bool hasCanvas;
+    canvasConfig canvas;
+    bool hasEffects;
+    effectsConfig effects;
+    bool hasInterpolation;
+    interpolationConfig interpolation;
+} configBatch;
+
+static inline pixelColor_t framePixel(const frameBuffer *frame, int pixel)
+{
+    if (frame->palette == NULL) {
+        return frame->pixels[pixel];
+    }
+    // Packed palette colours are in GRB(W) order
+    const uint8_t *packed = (const uint8_t *) &frame->palette[frame->indices[pixel]];
+    pixelColor_t colour = {
+        .r = packed[1],
+        .g = packed[0],
+        .b = packed[2],
+        .w = packed[3],
+    };
+    return colour;
+}
 
 uint8_t pixelIdx(uint8_t col, uint8_t row);
-void setSceneConfig(char *scene, cJSON *json);
+int16_t canvasPixelIdx(uint16_t col, uint16_t row);
+uint32_t canvasRandom(uint32_t *state);
+const canvasConfig *getCanvas();
+void setCanvas(const canvasConfig *config);
+bool sceneFromName(const char *name, scene *result);
+bool setSceneConfig(char *scene, cJSON *json);
+bool parseConfigBatch(cJSON *json, configBatch *batch);
+void applyConfigBatch(const configBatch *batch);
+bool getSceneConfig(scene configScene, sceneConfig *config);
+bool parseSceneConfig(scene configScene, cJSON *json, sceneConfig *config);
+void applySceneConfig(scene configScene, const sceneConfig *config);
+bool addSceneConfig(scene configScene, cJSON *json);
+void addCurrentConfig(cJSON *json);
 void setCurrentScene(char *newScene);
+void selectScene(scene selectedScene);
+void setStartScene(scene startScene);
+void scheduleScene(scene startScene, uint32_t startMillis);
+scene getCurrentScene();
+const char *sceneName(scene nameScene);
 void currentSceneUpdate(uint32_t millis);
 void currentSceneInit();
+void addSceneStats(cJSON *json);
+void boot_trace_mark(bootPhase phase);
+void boot_trace_add_stats(cJSON *json);
 
 #endif /* FRAME_BASE_H */
\ No newline at end of file
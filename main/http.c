@@ -1,5 +1,6 @@
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include <stdio.h>
 #include <string.h>
 #include "frame_base.h"
 
@@ -11,6 +12,25 @@ static char* postDataBuffer;
 void pause();
 void resume();
 void stop();
+esp_err_t anim_scene_write_begin(size_t length);
+esp_err_t anim_scene_write(const char *data, size_t length);
+esp_err_t anim_scene_write_end();
+esp_err_t image_scene_write_begin(bool nearest);
+esp_err_t image_scene_write(const char *data, size_t length);
+esp_err_t image_scene_write_end();
+void image_scene_write_cancel();
+esp_err_t shader_scene_load(const char *data, size_t length);
+esp_err_t ledmap_load(const char *data, size_t length);
+bool playlist_set(cJSON *json);
+uint32_t leds_get_snapshot(pixelColor_t *pixels);
+void sync_add_stats(cJSON *json);
+void stream_add_stats(cJSON *json);
+void particles_scene_add_stats(cJSON *json);
+void life_scene_add_stats(cJSON *json);
+void shader_scene_add_stats(cJSON *json);
+void effects_add_stats(cJSON *json);
+void interpolation_add_stats(cJSON *json);
+void spectrum_scene_add_stats(cJSON *json);
 
 static esp_err_t pauseHandler(httpd_req_t *req)
 {
@@ -57,6 +77,29 @@ static httpd_uri_t api_stop = {
     .user_ctx   = NULL
 };
 
+// Reads the whole body into postDataBuffer as a string. Sends an error
+// response and returns false if it can't.
+static bool receiveBody(httpd_req_t *req)
+{
+    int body_len = req->content_len;
+    int cur_len = 0;
+    int received = 0;
+    if (body_len >= POST_DATA_BUFSIZE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "content too long");
+        return false;
+    }
+    while (cur_len < body_len) {
+        received = httpd_req_recv(req, postDataBuffer + cur_len, body_len - cur_len);
+        if (received <= 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Post value is not valid");
+            return false;
+        }
+        cur_len += received;
+    }
+    postDataBuffer[body_len] = '\0';
+    return true;
+}
+
 static esp_err_t setSceneConfigHandler(httpd_req_t *req)
 {
     int query_len = httpd_req_get_url_query_len(req) + 1;
@@ -64,38 +107,30 @@ static esp_err_t setSceneConfigHandler(httpd_req_t *req)
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scene must be specified as query param");
         return ESP_FAIL;
     }
-    if (query_len > 20) {
+    // Long enough for the longest name, scene=interpolation
+    char queryStringBuffer[32];
+    char scene[16] = "";
+    if (query_len > (int) sizeof(queryStringBuffer)) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "query string too long");
         return ESP_FAIL;
     }
-    char queryStringBuffer[20];
-    char scene[10];
     if (httpd_req_get_url_query_str(req, queryStringBuffer, query_len) == ESP_OK) {
         if (httpd_query_key_value(queryStringBuffer, "scene", scene, sizeof(scene)) == ESP_OK) {
             ESP_LOGI(TAG, "Scene query parameter: %s", scene);
         }
     }
 
-    int body_len = req->content_len;
-    int cur_len = 0;
-    int received = 0;
-    if (body_len >= POST_DATA_BUFSIZE) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "content too long");
+    if (!receiveBody(req)) {
         return ESP_FAIL;
     }
-    while (cur_len < body_len) {
-        received = httpd_req_recv(req, postDataBuffer + cur_len, body_len);
-        if (received <= 0) {
-            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Post value is not valid");
-            return ESP_FAIL;
-        }
-        cur_len += received;
-    }
-    postDataBuffer[body_len] = '\0';
 
     cJSON *json = cJSON_Parse(postDataBuffer);
-    setSceneConfig(scene, json);
+    bool applied = setSceneConfig(scene, json);
     cJSON_Delete(json);
+    if (!applied) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "unknown scene or settings not valid");
+        return ESP_FAIL;
+    }
 
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
@@ -137,10 +172,380 @@ static httpd_uri_t api_current_scene = {
     .user_ctx   = NULL
 };
 
+static esp_err_t uploadAnimationHandler(httpd_req_t *req)
+{
+    int remaining = req->content_len;
+    if (anim_scene_write_begin(remaining) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "animation can't be stored");
+        return ESP_FAIL;
+    }
+
+    // The animation is written to flash in chunks as it arrives
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, postDataBuffer, remaining < POST_DATA_BUFSIZE ? remaining : POST_DATA_BUFSIZE);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (received <= 0) {
+            anim_scene_write_end();
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Post value is not valid");
+            return ESP_FAIL;
+        }
+        if (anim_scene_write(postDataBuffer, received) != ESP_OK) {
+            anim_scene_write_end();
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error writing animation");
+            return ESP_FAIL;
+        }
+        remaining -= received;
+    }
+
+    if (anim_scene_write_end() != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "animation is not valid");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Stored animation, %d bytes", (int) req->content_len);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_animation = {
+    .uri        = "/animation",
+    .method     = HTTP_POST,
+    .handler    = uploadAnimationHandler,
+    .user_ctx   = NULL
+};
+
+// A GIF or BMP, decoded as it arrives. ?scale=nearest samples the image
+// rather than averaging it down to the canvas.
+static esp_err_t uploadImageHandler(httpd_req_t *req)
+{
+    char queryStringBuffer[20];
+    char scale[10];
+    bool nearest = false;
+    int query_len = httpd_req_get_url_query_len(req) + 1;
+    if (query_len > 1 && query_len <= sizeof(queryStringBuffer)
+            && httpd_req_get_url_query_str(req, queryStringBuffer, query_len) == ESP_OK
+            && httpd_query_key_value(queryStringBuffer, "scale", scale, sizeof(scale)) == ESP_OK) {
+        nearest = strcmp(scale, "nearest") == 0;
+    }
+
+    if (image_scene_write_begin(nearest) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough memory to decode image");
+        return ESP_FAIL;
+    }
+
+    int remaining = req->content_len;
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, postDataBuffer, remaining < POST_DATA_BUFSIZE ? remaining : POST_DATA_BUFSIZE);
+        if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (received <= 0) {
+            image_scene_write_cancel();
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Post value is not valid");
+            return ESP_FAIL;
+        }
+        if (image_scene_write(postDataBuffer, received) != ESP_OK) {
+            image_scene_write_cancel();
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "image is not valid");
+            return ESP_FAIL;
+        }
+        remaining -= received;
+    }
+
+    esp_err_t err = image_scene_write_end();
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "image is not valid");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Not enough memory to store image");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Stored image, %d bytes", (int) req->content_len);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_image = {
+    .uri        = "/image",
+    .method     = HTTP_POST,
+    .handler    = uploadImageHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t setPlaylistHandler(httpd_req_t *req)
+{
+    if (!receiveBody(req)) {
+        return ESP_FAIL;
+    }
+
+    cJSON *json = cJSON_Parse(postDataBuffer);
+    bool valid = playlist_set(json);
+    cJSON_Delete(json);
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "playlist is not valid");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_playlist = {
+    .uri        = "/playlist",
+    .method     = HTTP_POST,
+    .handler    = setPlaylistHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t uploadShaderHandler(httpd_req_t *req)
+{
+    if (!receiveBody(req)) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = shader_scene_load(postDataBuffer, req->content_len);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "shader is not valid");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error storing shader");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_shader = {
+    .uri        = "/shader",
+    .method     = HTTP_POST,
+    .handler    = uploadShaderHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t uploadLedMapHandler(httpd_req_t *req)
+{
+    if (!receiveBody(req)) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = ledmap_load(postDataBuffer, req->content_len);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "LED map is not valid");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error storing LED map");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_led_map = {
+    .uri        = "/led-map",
+    .method     = HTTP_POST,
+    .handler    = uploadLedMapHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t setConfigHandler(httpd_req_t *req)
+{
+    static configBatch batch;
+
+    if (!receiveBody(req)) {
+        return ESP_FAIL;
+    }
+
+    cJSON *json = cJSON_Parse(postDataBuffer);
+    bool valid = parseConfigBatch(json, &batch);
+    cJSON_Delete(json);
+    if (!valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "config is not valid");
+        return ESP_FAIL;
+    }
+    applyConfigBatch(&batch);
+
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static httpd_uri_t api_config = {
+    .uri        = "/config",
+    .method     = HTTP_POST,
+    .handler    = setConfigHandler,
+    .user_ctx   = NULL
+};
+
+// Sends json as the response and frees it
+static esp_err_t sendJson(httpd_req_t *req, cJSON *json)
+{
+    char *body = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (body == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error creating response");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, body, strlen(body));
+    free(body);
+    return ESP_OK;
+}
+
+static esp_err_t getConfigHandler(httpd_req_t *req)
+{
+    cJSON *json = cJSON_CreateObject();
+    addCurrentConfig(json);
+    return sendJson(req, json);
+}
+
+static httpd_uri_t api_get_config = {
+    .uri        = "/config",
+    .method     = HTTP_GET,
+    .handler    = getConfigHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t getSceneConfigHandler(httpd_req_t *req)
+{
+    // Sized as in setSceneConfigHandler
+    char queryStringBuffer[32];
+    char sceneQuery[16];
+    scene configScene;
+    int query_len = httpd_req_get_url_query_len(req) + 1;
+    if (query_len <= 1 || query_len > sizeof(queryStringBuffer)
+            || httpd_req_get_url_query_str(req, queryStringBuffer, query_len) != ESP_OK
+            || httpd_query_key_value(queryStringBuffer, "scene", sceneQuery, sizeof(sceneQuery)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "scene must be specified as query param");
+        return ESP_FAIL;
+    }
+
+    cJSON *json = cJSON_CreateObject();
+    if (!sceneFromName(sceneQuery, &configScene) || !addSceneConfig(configScene, json)) {
+        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "scene has no settings");
+        return ESP_FAIL;
+    }
+    return sendJson(req, json);
+}
+
+static httpd_uri_t api_get_scene_config = {
+    .uri        = "/scene-config",
+    .method     = HTTP_GET,
+    .handler    = getSceneConfigHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t getCurrentSceneHandler(httpd_req_t *req)
+{
+    const char *name = sceneName(getCurrentScene());
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, name, strlen(name));
+    return ESP_OK;
+}
+
+static httpd_uri_t api_get_current_scene = {
+    .uri        = "/current-scene",
+    .method     = HTTP_GET,
+    .handler    = getCurrentSceneHandler,
+    .user_ctx   = NULL
+};
+
+// The last frame shown: width and height (uint8) then an RGB triplet for
+// each pixel, row by row from the top left. X-Frame-Seq counts frames shown,
+// so pollers can tell when nothing has changed.
+static esp_err_t getFrameHandler(httpd_req_t *req)
+{
+    pixelColor_t pixels[NUM_PIXELS];
+    uint8_t body[2 + NUM_PIXELS * 3];
+    char seqBuffer[12];
+
+    uint32_t seq = leds_get_snapshot(pixels);
+
+    body[0] = PIXELS_PER_ROW;
+    body[1] = NUM_ROWS;
+    uint8_t *out = body + 2;
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            const pixelColor_t *pixel = &pixels[pixelIdx(col, row)];
+            *out++ = pixel->r;
+            *out++ = pixel->g;
+            *out++ = pixel->b;
+        }
+    }
+
+    snprintf(seqBuffer, sizeof(seqBuffer), "%u", (unsigned int) seq);
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "X-Frame-Seq", seqBuffer);
+    httpd_resp_send(req, (const char *) body, sizeof(body));
+    return ESP_OK;
+}
+
+static httpd_uri_t api_frame = {
+    .uri        = "/frame",
+    .method     = HTTP_GET,
+    .handler    = getFrameHandler,
+    .user_ctx   = NULL
+};
+
+static esp_err_t getStatsHandler(httpd_req_t *req)
+{
+    cJSON *json = cJSON_CreateObject();
+    addSceneStats(json);
+    boot_trace_add_stats(json);
+    sync_add_stats(json);
+    stream_add_stats(json);
+    particles_scene_add_stats(json);
+    life_scene_add_stats(json);
+    shader_scene_add_stats(json);
+    spectrum_scene_add_stats(json);
+    effects_add_stats(json);
+    interpolation_add_stats(json);
+    return sendJson(req, json);
+}
+
+static httpd_uri_t api_stats = {
+    .uri        = "/stats",
+    .method     = HTTP_GET,
+    .handler    = getStatsHandler,
+    .user_ctx   = NULL
+};
+
+static httpd_uri_t *handlers[] = {
+    &api_pause,
+    &api_resume,
+    &api_stop,
+    &api_scene_config,
+    &api_current_scene,
+    &api_stats,
+    &api_animation,
+    &api_image,
+    &api_playlist,
+    &api_shader,
+    &api_led_map,
+    &api_config,
+    &api_get_config,
+    &api_get_scene_config,
+    &api_get_current_scene,
+    &api_frame,
+};
+#define NUM_HANDLERS (sizeof(handlers) / sizeof(handlers[0]))
+
+// Room for handlers added later, so they don't silently fail to register
+#define URI_HANDLER_HEADROOM 8
+
 httpd_handle_t http_start_webserver(void)
 {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = NUM_HANDLERS + URI_HANDLER_HEADROOM;
 
     postDataBuffer = (char*) malloc(POST_DATA_BUFSIZE);
     if (postDataBuffer == NULL) {
@@ -153,11 +558,12 @@ httpd_handle_t http_start_webserver(void)
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
-        httpd_register_uri_handler(server, &api_pause);
-        httpd_register_uri_handler(server, &api_resume);
-        httpd_register_uri_handler(server, &api_stop);
-        httpd_register_uri_handler(server, &api_scene_config);
-        httpd_register_uri_handler(server, &api_current_scene);
+        for (uint8_t i = 0; i < NUM_HANDLERS; i++) {
+            esp_err_t err = httpd_register_uri_handler(server, handlers[i]);
+            if (err != ESP_OK) {
+                ESP_LOGI(TAG, "Error registering %s: %d", handlers[i]->uri, err);
+            }
+        }
         return server;
     }
 
@@ -0,0 +1,765 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "frame_base.h"
+
+// Widest image row that can be decoded
+#define IMAGE_MAX_WIDTH 1024
+#define IMAGE_MAX_FRAMES 64
+// Decoded frames are cached as GRB triplets in LED order
+#define IMAGE_FRAME_BYTES (NUM_PIXELS * 3)
+
+#define GIF_MAX_CODES 4096
+#define GIF_NO_CODE 0xFFFF
+// GIFs with no delay, or a very short one, play at this rate like in browsers
+#define GIF_DEFAULT_DELAY_MILLIS 100
+#define GIF_MIN_DELAY_MILLIS 20
+
+#define GIF_DISPOSE_BACKGROUND 2
+#define GIF_DISPOSE_PREVIOUS 3
+
+#define BMP_HEADER_SIZE 54
+
+static const char *TAG = "scene image";
+
+typedef enum {
+    DECODE_SIGNATURE,
+    DECODE_DONE,
+    GIF_SCREEN,
+    GIF_GLOBAL_TABLE,
+    GIF_BLOCK,
+    GIF_EXTENSION,
+    GIF_CONTROL,
+    GIF_SUB_BLOCK,
+    GIF_IMAGE,
+    GIF_LOCAL_TABLE,
+    GIF_CODE_SIZE,
+    GIF_DATA_LENGTH,
+    GIF_DATA,
+    BMP_HEADER,
+    BMP_PIXELS,
+} decodeState;
+
+// The part of the image covered by one LED. Rows are shrunk by averaging
+// the pixels in the box, or sampling the one at its centre.
+typedef struct cellBox {
+    uint16_t x0;
+    uint16_t x1;
+    uint16_t y0;
+    uint16_t y1;
+} cellBox;
+
+// A box can cover the whole of a 65535 x 65535 screen, so the colour sums
+// need 64 bits, as do the blends worked out from them
+typedef struct cellSum {
+    uint64_t r;
+    uint64_t g;
+    uint64_t b;
+    // Pixels of the box drawn by this frame, and those of them not transparent
+    uint32_t covered;
+    uint32_t opaque;
+} cellSum;
+
+// Everything needed while an image is uploaded, only allocated until it's done.
+// Data is decoded as it arrives, so the file itself is never held in RAM.
+typedef struct imageDecoder {
+    decodeState state;
+    bool nearest;
+    // Bytes of the current state's fields gathered so far, and how many it needs
+    uint8_t gather[256 * 3];
+    uint16_t gathered;
+    uint16_t wanted;
+    // Bytes to drop before carrying on, for unknown blocks and BMP padding
+    uint32_t skip;
+
+    uint16_t screenWidth;
+    uint16_t screenHeight;
+    cellBox boxes[NUM_PIXELS];
+    cellSum sums[NUM_PIXELS];
+    // The image as it is built up frame by frame, RGB in LED order
+    uint8_t base[IMAGE_FRAME_BYTES];
+
+    // The frame being decoded, a rectangle of the screen
+    uint16_t left;
+    uint16_t top;
+    uint16_t width;
+    uint16_t height;
+    uint16_t rowX;
+    uint16_t rowY;
+    uint16_t rowsDone;
+    uint8_t rowColours[IMAGE_MAX_WIDTH * 3];
+    bool rowOpaque[IMAGE_MAX_WIDTH];
+
+    // GIF colour tables and graphic control
+    uint8_t globalTable[256 * 3];
+    uint16_t globalSize;
+    uint8_t localTable[256 * 3];
+    uint16_t localSize;
+    bool interlaced;
+    uint8_t pass;
+    uint8_t disposal;
+    bool hasTransparent;
+    uint8_t transparentIndex;
+    uint16_t delayMillis;
+
+    // GIF LZW decoding
+    uint8_t minCodeSize;
+    uint8_t codeSize;
+    uint16_t nextCode;
+    uint16_t prevCode;
+    uint8_t prevFirst;
+    bool codesEnded;
+    uint32_t bitBuffer;
+    uint8_t bitCount;
+    uint8_t dataRemaining;
+    uint16_t prefix[GIF_MAX_CODES];
+    uint8_t suffix[GIF_MAX_CODES];
+    uint8_t stack[GIF_MAX_CODES];
+
+    // BMP rows
+    uint8_t bytesPerPixel;
+    uint32_t rowBytes;
+    uint32_t rowByte;
+    bool topDown;
+
+    uint16_t frameCount;
+    uint8_t *frames;
+    uint16_t delays[IMAGE_MAX_FRAMES];
+} imageDecoder;
+
+static imageDecoder *decoder = NULL;
+
+// Decoded frames being played, swapped for new ones when an upload finishes
+static uint8_t *frames = NULL;
+static uint16_t *delays = NULL;
+static uint16_t frameCount = 0;
+static uint16_t frameNum = 0;
+static bool restartPending = false;
+static uint32_t lastMillis = 0;
+static SemaphoreHandle_t framesLock = NULL;
+
+bool interpolation_enabled(interpolateSource source);
+void interpolation_reset(interpolateSource source);
+void interpolation_push(interpolateSource source, const pixelColor_t *pixels, uint32_t sourceMillis, uint32_t localMillis);
+bool interpolation_render(interpolateSource source, pixelColor_t *out, uint32_t localMillis);
+
+
+static inline uint16_t read16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static inline uint32_t read32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+static void want(imageDecoder *d, decodeState state, uint16_t length)
+{
+    d->state = state;
+    d->wanted = length;
+    d->gathered = 0;
+}
+
+// Works out which part of the image each LED shows, with the image
+// stretched over the whole canvas
+static void layout_cells(imageDecoder *d)
+{
+    const canvasConfig *canvas = getCanvas();
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            cellBox *box = &d->boxes[pixelIdx(col, row)];
+            uint32_t canvasCol = canvas->x + col;
+            uint32_t canvasRow = canvas->y + row;
+            if (canvasCol >= canvas->width || canvasRow >= canvas->height) {
+                memset(box, 0, sizeof(cellBox));
+                continue;
+            }
+            if (d->nearest) {
+                box->x0 = (2 * canvasCol + 1) * d->screenWidth / (2 * canvas->width);
+                box->y0 = (2 * canvasRow + 1) * d->screenHeight / (2 * canvas->height);
+                box->x1 = box->x0 + 1;
+                box->y1 = box->y0 + 1;
+            } else {
+                box->x0 = canvasCol * d->screenWidth / canvas->width;
+                box->y0 = canvasRow * d->screenHeight / canvas->height;
+                box->x1 = (canvasCol + 1) * d->screenWidth / canvas->width;
+                box->y1 = (canvasRow + 1) * d->screenHeight / canvas->height;
+                // Images smaller than the canvas repeat pixels
+                if (box->x1 == box->x0) {
+                    box->x1++;
+                }
+                if (box->y1 == box->y0) {
+                    box->y1++;
+                }
+            }
+        }
+    }
+}
+
+static bool frame_begin(imageDecoder *d, uint16_t left, uint16_t top, uint16_t width, uint16_t height)
+{
+    if (width == 0 || height == 0 || width > IMAGE_MAX_WIDTH) {
+        ESP_LOGI(TAG, "Frame of %d x %d can't be decoded", width, height);
+        return false;
+    }
+    d->left = left;
+    d->top = top;
+    d->width = width;
+    d->height = height;
+    d->rowX = 0;
+    d->rowY = 0;
+    d->rowsDone = 0;
+    d->pass = 0;
+    memset(d->sums, 0, sizeof(d->sums));
+    return true;
+}
+
+// Adds a finished row to the boxes it falls in
+static void frame_row(imageDecoder *d)
+{
+    uint32_t y = d->top + d->rowY;
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        const cellBox *box = &d->boxes[i];
+        if (y < box->y0 || y >= box->y1 || box->x1 <= d->left) {
+            continue;
+        }
+        uint16_t start = box->x0 > d->left ? box->x0 - d->left : 0;
+        uint16_t end = box->x1 - d->left < d->width ? box->x1 - d->left : d->width;
+        cellSum *sum = &d->sums[i];
+        for (uint16_t x = start; x < end; x++) {
+            sum->covered++;
+            if (d->rowOpaque[x]) {
+                sum->r += d->rowColours[x * 3];
+                sum->g += d->rowColours[x * 3 + 1];
+                sum->b += d->rowColours[x * 3 + 2];
+                sum->opaque++;
+            }
+        }
+    }
+}
+
+// Draws the frame over what came before it and caches the result. Returns
+// false once no more frames can be cached.
+static bool frame_end(imageDecoder *d, uint16_t delayMillis)
+{
+    uint8_t *cached = d->frames + d->frameCount * IMAGE_FRAME_BYTES;
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        const cellBox *box = &d->boxes[i];
+        const cellSum *sum = &d->sums[i];
+        uint8_t *base = &d->base[i * 3];
+        uint32_t area = (uint32_t) (box->x1 - box->x0) * (box->y1 - box->y0);
+        if (area == 0) {
+            memset(&cached[i * 3], 0, 3);
+            continue;
+        }
+
+        // Pixels of the box this frame leaves alone, or draws transparent, keep
+        // the colour from before
+        uint64_t kept = area - sum->opaque;
+        uint8_t r = (sum->r + base[0] * kept + area / 2) / area;
+        uint8_t g = (sum->g + base[1] * kept + area / 2) / area;
+        uint8_t b = (sum->b + base[2] * kept + area / 2) / area;
+        cached[i * 3] = g;
+        cached[i * 3 + 1] = r;
+        cached[i * 3 + 2] = b;
+
+        if (d->disposal == GIF_DISPOSE_BACKGROUND) {
+            // The frame's rectangle is cleared to black for the next frame
+            uint64_t outside = area - sum->covered;
+            base[0] = base[0] * outside / area;
+            base[1] = base[1] * outside / area;
+            base[2] = base[2] * outside / area;
+        } else if (d->disposal != GIF_DISPOSE_PREVIOUS) {
+            base[0] = r;
+            base[1] = g;
+            base[2] = b;
+        }
+    }
+    d->delays[d->frameCount] = delayMillis;
+
+    if (++d->frameCount == IMAGE_MAX_FRAMES) {
+        ESP_LOGI(TAG, "Only the first %d frames are kept", IMAGE_MAX_FRAMES);
+        return false;
+    }
+    return true;
+}
+
+static void gif_next_row(imageDecoder *d)
+{
+    static const uint8_t passStart[] = {0, 4, 2, 1};
+    static const uint8_t passStep[] = {8, 8, 4, 2};
+
+    d->rowsDone++;
+    if (!d->interlaced) {
+        d->rowY++;
+        return;
+    }
+    d->rowY += passStep[d->pass];
+    while (d->rowY >= d->height && d->pass < 3) {
+        d->pass++;
+        d->rowY = passStart[d->pass];
+    }
+}
+
+static void gif_pixel(imageDecoder *d, uint8_t index)
+{
+    if (d->rowsDone == d->height) {
+        return;
+    }
+    const uint8_t *table = d->localSize > 0 ? d->localTable : d->globalTable;
+    uint16_t tableSize = d->localSize > 0 ? d->localSize : d->globalSize;
+    if (index < tableSize) {
+        memcpy(&d->rowColours[d->rowX * 3], &table[index * 3], 3);
+    } else {
+        memset(&d->rowColours[d->rowX * 3], 0, 3);
+    }
+    d->rowOpaque[d->rowX] = !(d->hasTransparent && index == d->transparentIndex);
+
+    if (++d->rowX == d->width) {
+        frame_row(d);
+        gif_next_row(d);
+        d->rowX = 0;
+    }
+}
+
+static void gif_clear_codes(imageDecoder *d)
+{
+    d->codeSize = d->minCodeSize + 1;
+    d->nextCode = (1 << d->minCodeSize) + 2;
+    d->prevCode = GIF_NO_CODE;
+}
+
+static bool gif_code(imageDecoder *d, uint16_t code)
+{
+    uint16_t clearCode = 1 << d->minCodeSize;
+    if (code == clearCode) {
+        gif_clear_codes(d);
+        return true;
+    }
+    if (code == clearCode + 1) {
+        d->codesEnded = true;
+        return true;
+    }
+    if (d->prevCode == GIF_NO_CODE) {
+        if (code > clearCode) {
+            return false;
+        }
+        gif_pixel(d, code);
+        d->prevCode = code;
+        d->prevFirst = code;
+        return true;
+    }
+    if (code > d->nextCode) {
+        return false;
+    }
+
+    // Strings are stored as a prefix code and a last byte, so are unwound
+    // backwards onto the stack
+    uint16_t depth = 0;
+    uint16_t walk = code;
+    if (code == d->nextCode) {
+        // Not in the table yet, it's the previous string and its first byte
+        d->stack[depth++] = d->prevFirst;
+        walk = d->prevCode;
+    }
+    while (walk > clearCode) {
+        d->stack[depth++] = d->suffix[walk];
+        walk = d->prefix[walk];
+    }
+    uint8_t first = walk;
+    d->stack[depth++] = first;
+    while (depth > 0) {
+        gif_pixel(d, d->stack[--depth]);
+    }
+
+    if (d->nextCode < GIF_MAX_CODES) {
+        d->prefix[d->nextCode] = d->prevCode;
+        d->suffix[d->nextCode] = first;
+        d->nextCode++;
+        if (d->nextCode == (1 << d->codeSize) && d->codeSize < 12) {
+            d->codeSize++;
+        }
+    }
+    d->prevCode = code;
+    d->prevFirst = first;
+    return true;
+}
+
+static bool gif_data(imageDecoder *d, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length && !d->codesEnded; i++) {
+        d->bitBuffer |= (uint32_t) data[i] << d->bitCount;
+        d->bitCount += 8;
+        while (d->bitCount >= d->codeSize && !d->codesEnded) {
+            uint16_t code = d->bitBuffer & ((1 << d->codeSize) - 1);
+            d->bitBuffer >>= d->codeSize;
+            d->bitCount -= d->codeSize;
+            if (!gif_code(d, code)) {
+                ESP_LOGI(TAG, "Bad LZW code %d in frame %d", code, d->frameCount);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void bmp_data(imageDecoder *d, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length && d->rowsDone < d->height; i++) {
+        uint32_t x = d->rowByte / d->bytesPerPixel;
+        uint8_t channel = d->rowByte % d->bytesPerPixel;
+        // Pixels are stored BGR(A) with rows padded to 4 bytes
+        if (x < d->width && channel < 3) {
+            d->rowColours[x * 3 + 2 - channel] = data[i];
+        }
+        if (++d->rowByte == d->rowBytes) {
+            // Rows go from the bottom up unless the height is negative
+            d->rowY = d->topDown ? d->rowsDone : d->height - 1 - d->rowsDone;
+            frame_row(d);
+            d->rowsDone++;
+            d->rowByte = 0;
+        }
+    }
+}
+
+// Handles the fields gathered for the current state and moves on to the next
+static bool decode_step(imageDecoder *d)
+{
+    const uint8_t *g = d->gather;
+
+    switch (d->state) {
+        case DECODE_SIGNATURE:
+            if (g[0] == 'G' && g[1] == 'I') {
+                // The rest of the signature and the logical screen descriptor
+                want(d, GIF_SCREEN, 11);
+                return true;
+            }
+            if (g[0] == 'B' && g[1] == 'M') {
+                want(d, BMP_HEADER, BMP_HEADER_SIZE - 2);
+                return true;
+            }
+            ESP_LOGI(TAG, "Image is not a GIF or BMP");
+            return false;
+
+        case GIF_SCREEN:
+            if (memcmp(g, "F87a", 4) != 0 && memcmp(g, "F89a", 4) != 0) {
+                return false;
+            }
+            d->screenWidth = read16(&g[4]);
+            d->screenHeight = read16(&g[6]);
+            if (d->screenWidth == 0 || d->screenHeight == 0) {
+                return false;
+            }
+            layout_cells(d);
+            if (g[8] & 0x80) {
+                d->globalSize = 2 << (g[8] & 7);
+                want(d, GIF_GLOBAL_TABLE, d->globalSize * 3);
+            } else {
+                want(d, GIF_BLOCK, 1);
+            }
+            return true;
+
+        case GIF_GLOBAL_TABLE:
+            memcpy(d->globalTable, g, d->wanted);
+            want(d, GIF_BLOCK, 1);
+            return true;
+
+        case GIF_BLOCK:
+            if (g[0] == 0x21) {
+                want(d, GIF_EXTENSION, 1);
+            } else if (g[0] == 0x2C) {
+                want(d, GIF_IMAGE, 9);
+            } else if (g[0] == 0x3B) {
+                d->state = DECODE_DONE;
+            } else {
+                ESP_LOGI(TAG, "Unknown GIF block 0x%02x", g[0]);
+                return false;
+            }
+            return true;
+
+        case GIF_EXTENSION:
+            if (g[0] == 0xF9) {
+                // Block size, packed fields, delay, transparent index and terminator
+                want(d, GIF_CONTROL, 6);
+            } else {
+                want(d, GIF_SUB_BLOCK, 1);
+            }
+            return true;
+
+        case GIF_CONTROL:
+            if (g[0] != 4 || g[5] != 0) {
+                return false;
+            }
+            d->disposal = (g[1] >> 2) & 7;
+            d->hasTransparent = g[1] & 1;
+            d->delayMillis = read16(&g[2]) * 10;
+            d->transparentIndex = g[4];
+            want(d, GIF_BLOCK, 1);
+            return true;
+
+        case GIF_SUB_BLOCK:
+            // Extensions other than graphic control are skipped
+            if (g[0] == 0) {
+                want(d, GIF_BLOCK, 1);
+            } else {
+                d->skip = g[0];
+                want(d, GIF_SUB_BLOCK, 1);
+            }
+            return true;
+
+        case GIF_IMAGE:
+            if (!frame_begin(d, read16(&g[0]), read16(&g[2]), read16(&g[4]), read16(&g[6]))) {
+                return false;
+            }
+            d->interlaced = g[8] & 0x40;
+            d->localSize = 0;
+            if (g[8] & 0x80) {
+                want(d, GIF_LOCAL_TABLE, (2 << (g[8] & 7)) * 3);
+            } else {
+                want(d, GIF_CODE_SIZE, 1);
+            }
+            return true;
+
+        case GIF_LOCAL_TABLE:
+            memcpy(d->localTable, g, d->wanted);
+            d->localSize = d->wanted / 3;
+            want(d, GIF_CODE_SIZE, 1);
+            return true;
+
+        case GIF_CODE_SIZE:
+            if (g[0] < 2 || g[0] > 8) {
+                return false;
+            }
+            d->minCodeSize = g[0];
+            d->codesEnded = false;
+            d->bitBuffer = 0;
+            d->bitCount = 0;
+            gif_clear_codes(d);
+            want(d, GIF_DATA_LENGTH, 1);
+            return true;
+
+        case GIF_DATA_LENGTH:
+            if (g[0] > 0) {
+                d->dataRemaining = g[0];
+                d->state = GIF_DATA;
+                return true;
+            }
+            // Rows missing from a short frame are left as they were
+            if (!frame_end(d, d->delayMillis < GIF_MIN_DELAY_MILLIS ? GIF_DEFAULT_DELAY_MILLIS : d->delayMillis)) {
+                d->state = DECODE_DONE;
+                return true;
+            }
+            // Graphic control only applies to the image after it
+            d->disposal = 0;
+            d->hasTransparent = false;
+            d->delayMillis = 0;
+            want(d, GIF_BLOCK, 1);
+            return true;
+
+        case BMP_HEADER: {
+            uint32_t dataOffset = read32(&g[8]);
+            int32_t width = (int32_t) read32(&g[16]);
+            int32_t height = (int32_t) read32(&g[20]);
+            uint16_t bitsPerPixel = read16(&g[26]);
+            uint32_t compression = read32(&g[28]);
+            if (read32(&g[12]) < 40 || dataOffset < BMP_HEADER_SIZE
+                    || width <= 0 || width > IMAGE_MAX_WIDTH || height == 0 || height < -0xFFFF || height > 0xFFFF
+                    || (bitsPerPixel != 24 && bitsPerPixel != 32) || compression != 0) {
+                ESP_LOGI(TAG, "Only uncompressed 24 and 32 bit BMPs are supported");
+                return false;
+            }
+            d->topDown = height < 0;
+            d->screenWidth = width;
+            d->screenHeight = height < 0 ? -height : height;
+            layout_cells(d);
+            frame_begin(d, 0, 0, d->screenWidth, d->screenHeight);
+            memset(d->rowOpaque, true, d->screenWidth);
+            d->bytesPerPixel = bitsPerPixel / 8;
+            d->rowBytes = (width * d->bytesPerPixel + 3) & ~3;
+            d->rowByte = 0;
+            d->skip = dataOffset - BMP_HEADER_SIZE;
+            d->state = BMP_PIXELS;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+void image_scene_initialise()
+{
+    framesLock = xSemaphoreCreateMutex();
+}
+
+bool image_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    bool drawn = false;
+
+    if (xSemaphoreTake(framesLock, 0) != pdTRUE) {
+        return false;
+    }
+
+    if (frameCount > 0) {
+        if (restartPending) {
+            frameNum = 0;
+            restartPending = false;
+            drawn = true;
+        } else if (frameCount > 1 && currMillis - lastMillis >= delays[frameNum]) {
+            frameNum = (frameNum + 1) % frameCount;
+            drawn = true;
+        }
+    }
+
+    bool interpolating = interpolation_enabled(INTERPOLATE_IMAGE);
+    if (drawn) {
+        pixelColor_t pixels[NUM_PIXELS];
+        const uint8_t *cached = frames + frameNum * IMAGE_FRAME_BYTES;
+        for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+            pixels[i].g = cached[i * 3];
+            pixels[i].r = cached[i * 3 + 1];
+            pixels[i].b = cached[i * 3 + 2];
+            pixels[i].w = 0;
+        }
+        if (interpolating) {
+            interpolation_push(INTERPOLATE_IMAGE, pixels, currMillis, currMillis);
+        } else {
+            memcpy(frame->pixels, pixels, sizeof(pixels));
+        }
+        lastMillis = currMillis;
+    }
+    if (interpolating) {
+        drawn = interpolation_render(INTERPOLATE_IMAGE, frame->pixels, currMillis);
+    }
+
+    xSemaphoreGive(framesLock);
+    return drawn;
+}
+
+void image_scene_init()
+{
+    restartPending = true;
+    interpolation_reset(INTERPOLATE_IMAGE);
+}
+
+// The image is scaled to the canvas as it is at upload time, by averaging
+// or, if nearest is set, sampling
+esp_err_t image_scene_write_begin(bool nearest)
+{
+    free(decoder != NULL ? decoder->frames : NULL);
+    free(decoder);
+    decoder = calloc(1, sizeof(imageDecoder));
+    if (decoder == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    decoder->frames = malloc(IMAGE_MAX_FRAMES * IMAGE_FRAME_BYTES);
+    if (decoder->frames == NULL) {
+        free(decoder);
+        decoder = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    decoder->nearest = nearest;
+    want(decoder, DECODE_SIGNATURE, 2);
+    return ESP_OK;
+}
+
+// Decodes the next part of the upload. Returns ESP_ERR_INVALID_ARG if it
+// isn't a valid image.
+esp_err_t image_scene_write(const char *data, size_t length)
+{
+    imageDecoder *d = decoder;
+    const uint8_t *in = (const uint8_t *) data;
+    const uint8_t *end = in + length;
+
+    while (in < end && d->state != DECODE_DONE) {
+        size_t available = end - in;
+        if (d->skip > 0) {
+            size_t skipped = available < d->skip ? available : d->skip;
+            d->skip -= skipped;
+            in += skipped;
+            continue;
+        }
+
+        if (d->state == GIF_DATA) {
+            size_t used = available < d->dataRemaining ? available : d->dataRemaining;
+            if (!gif_data(d, in, used)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            d->dataRemaining -= used;
+            in += used;
+            if (d->dataRemaining == 0) {
+                want(d, GIF_DATA_LENGTH, 1);
+            }
+            continue;
+        }
+
+        if (d->state == BMP_PIXELS) {
+            bmp_data(d, in, available);
+            if (d->rowsDone == d->height) {
+                frame_end(d, 0);
+                d->state = DECODE_DONE;
+            }
+            return ESP_OK;
+        }
+
+        size_t used = d->wanted - d->gathered;
+        if (used > available) {
+            used = available;
+        }
+        memcpy(&d->gather[d->gathered], in, used);
+        d->gathered += used;
+        in += used;
+        if (d->gathered == d->wanted && !decode_step(d)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+// Drops a partly decoded upload, leaving the old frames playing
+void image_scene_write_cancel()
+{
+    free(decoder->frames);
+    free(decoder);
+    decoder = NULL;
+}
+
+// Plays the new frames in place of the old ones if any were decoded
+esp_err_t image_scene_write_end()
+{
+    imageDecoder *d = decoder;
+    decoder = NULL;
+    if (d->frameCount == 0) {
+        ESP_LOGI(TAG, "No frames decoded");
+        free(d->frames);
+        free(d);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *newFrames = realloc(d->frames, d->frameCount * IMAGE_FRAME_BYTES);
+    uint16_t *newDelays = malloc(d->frameCount * sizeof(uint16_t));
+    if (newFrames == NULL || newDelays == NULL) {
+        free(newFrames != NULL ? newFrames : d->frames);
+        free(newDelays);
+        free(d);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(newDelays, d->delays, d->frameCount * sizeof(uint16_t));
+    ESP_LOGI(TAG, "Image: %d x %d, %d frames", d->screenWidth, d->screenHeight, d->frameCount);
+
+    xSemaphoreTake(framesLock, portMAX_DELAY);
+    free(frames);
+    free(delays);
+    frames = newFrames;
+    delays = newDelays;
+    frameCount = d->frameCount;
+    restartPending = true;
+    xSemaphoreGive(framesLock);
+
+    free(d);
+    return ESP_OK;
+}
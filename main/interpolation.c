@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include "frame_base.h"
+
+static const char *TAG = "interpolation";
+
+// Timing is re-estimated from this many frames at a time
+#define WINDOW_FRAMES 32
+// Gaps longer than this are pauses in the source, not its frame rate
+#define MAX_INTERVAL_MILLIS 250
+#define MAX_LATENESS_MILLIS 250
+
+static const char *sourceNames[] = {"stream", "anim", "image"};
+
+// Frames from a source are shown a little late, so there is always a newer
+// frame to blend towards. Each frame is given a time on the local clock from
+// its source timestamp, using the offset between the clocks for the least
+// delayed frame, plus a frame interval and the worst network delay seen on
+// top of that. Frames arriving unevenly are then still shown evenly.
+typedef struct frameInterpolator {
+    pixelColor_t from[NUM_PIXELS];
+    pixelColor_t to[NUM_PIXELS];
+    // Source clock times of from and to
+    uint32_t fromMillis;
+    uint32_t toMillis;
+    bool hasFrame;
+    // Set once to has been drawn, until the next frame
+    bool settled;
+
+    // Local millis minus source millis for the least delayed frame, and how
+    // much later than that frames have arrived
+    int32_t offset;
+    uint32_t lateness;
+    uint32_t interval;
+    int32_t windowOffset;
+    int32_t windowLatest;
+    uint8_t windowFrames;
+
+    uint32_t received;
+    uint32_t interpolated;
+} frameInterpolator;
+
+static frameInterpolator interpolators[NUM_INTERPOLATE_SOURCES];
+
+static interpolationConfig config;
+static portMUX_TYPE configMux = portMUX_INITIALIZER_UNLOCKED;
+
+
+static uint32_t delay_millis(const frameInterpolator *ip)
+{
+    return ip->interval + ip->lateness;
+}
+
+// Blend of from and to at source time now, 256 being all to
+static uint16_t blend_weight(const frameInterpolator *ip, uint32_t now)
+{
+    int32_t span = (int32_t) (ip->toMillis - ip->fromMillis);
+    int32_t elapsed = (int32_t) (now - ip->fromMillis);
+    if (span <= 0 || elapsed >= span) {
+        return 256;
+    }
+    if (elapsed <= 0) {
+        return 0;
+    }
+    return (uint32_t) elapsed * 256 / span;
+}
+
+static void blend(const frameInterpolator *ip, uint16_t weight, pixelColor_t *out)
+{
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        const pixelColor_t *a = &ip->from[i];
+        const pixelColor_t *b = &ip->to[i];
+        out[i].r = a->r + (((b->r - a->r) * weight) >> 8);
+        out[i].g = a->g + (((b->g - a->g) * weight) >> 8);
+        out[i].b = a->b + (((b->b - a->b) * weight) >> 8);
+        out[i].w = a->w + (((b->w - a->w) * weight) >> 8);
+    }
+}
+
+static void update_timing(frameInterpolator *ip, uint32_t sourceMillis, uint32_t localMillis)
+{
+    int32_t sample = (int32_t) (localMillis - sourceMillis);
+    uint32_t gap = sourceMillis - ip->toMillis;
+    if (gap > MAX_INTERVAL_MILLIS) {
+        gap = MAX_INTERVAL_MILLIS;
+    }
+    ip->interval = ip->interval == 0 ? gap : ip->interval + ((int32_t) (gap - ip->interval) >> 3);
+
+    // A less delayed frame, or a later one, is allowed for straight away.
+    // Larger offsets and less lateness are only taken once a whole window
+    // has seen them, in case the clocks drift apart.
+    if (sample - ip->offset < 0) {
+        ip->offset = sample;
+    }
+    if (sample - ip->offset > (int32_t) ip->lateness) {
+        ip->lateness = sample - ip->offset < MAX_LATENESS_MILLIS ? sample - ip->offset : MAX_LATENESS_MILLIS;
+    }
+    if (ip->windowFrames == 0 || sample - ip->windowOffset < 0) {
+        ip->windowOffset = sample;
+    }
+    if (ip->windowFrames == 0 || sample - ip->windowLatest > 0) {
+        ip->windowLatest = sample;
+    }
+    if (++ip->windowFrames == WINDOW_FRAMES) {
+        ip->offset = ip->windowOffset;
+        ip->lateness = ip->windowLatest - ip->windowOffset;
+        if (ip->lateness > MAX_LATENESS_MILLIS) {
+            ip->lateness = MAX_LATENESS_MILLIS;
+        }
+        ip->windowFrames = 0;
+    }
+}
+
+bool interpolation_enabled(interpolateSource source)
+{
+    return (config.sources >> source) & 1;
+}
+
+// Forgets the source's frames, for when it restarts
+void interpolation_reset(interpolateSource source)
+{
+    frameInterpolator *ip = &interpolators[source];
+    ip->hasFrame = false;
+    ip->interval = 0;
+    ip->lateness = 0;
+    ip->windowFrames = 0;
+}
+
+// Adds a new frame, timestamped by the source's clock. Local sources pass the
+// same time for both.
+void interpolation_push(interpolateSource source, const pixelColor_t *pixels, uint32_t sourceMillis, uint32_t localMillis)
+{
+    frameInterpolator *ip = &interpolators[source];
+    ip->received++;
+
+    if (ip->hasFrame && (int32_t) (sourceMillis - ip->toMillis) < -MAX_INTERVAL_MILLIS) {
+        // Too far back to be out of order, the source's clock has restarted
+        interpolation_reset(source);
+    }
+    if (!ip->hasFrame) {
+        memcpy(ip->from, pixels, sizeof(ip->from));
+        memcpy(ip->to, pixels, sizeof(ip->to));
+        ip->fromMillis = sourceMillis;
+        ip->toMillis = sourceMillis;
+        ip->offset = (int32_t) (localMillis - sourceMillis);
+        ip->hasFrame = true;
+        ip->settled = false;
+        return;
+    }
+    if ((int32_t) (sourceMillis - ip->toMillis) <= 0) {
+        // Out of order or a repeat, nothing to blend towards
+        return;
+    }
+
+    update_timing(ip, sourceMillis, localMillis);
+
+    // The blend carries on from whatever is showing now, so a frame arriving
+    // early or late never makes the output jump
+    uint32_t now = localMillis - ip->offset - delay_millis(ip);
+    blend(ip, blend_weight(ip, now), ip->from);
+    ip->fromMillis = (int32_t) (now - ip->toMillis) > 0 ? now : ip->toMillis;
+    memcpy(ip->to, pixels, sizeof(ip->to));
+    ip->toMillis = sourceMillis;
+    ip->settled = false;
+}
+
+// Draws the source as it should look at localMillis. Returns false if
+// nothing has changed since the last call.
+bool interpolation_render(interpolateSource source, pixelColor_t *out, uint32_t localMillis)
+{
+    frameInterpolator *ip = &interpolators[source];
+    if (!ip->hasFrame || ip->settled) {
+        return false;
+    }
+
+    uint16_t weight = blend_weight(ip, localMillis - ip->offset - delay_millis(ip));
+    if (weight == 256) {
+        memcpy(out, ip->to, sizeof(ip->to));
+        ip->settled = true;
+    } else {
+        blend(ip, weight, out);
+        ip->interpolated++;
+    }
+    return true;
+}
+
+void interpolation_get_config(interpolationConfig *result)
+{
+    portENTER_CRITICAL(&configMux);
+    *result = config;
+    portEXIT_CRITICAL(&configMux);
+}
+
+void interpolation_set_config(const interpolationConfig *newConfig)
+{
+    portENTER_CRITICAL(&configMux);
+    config.sources = newConfig->sources & ((1 << NUM_INTERPOLATE_SOURCES) - 1);
+    portEXIT_CRITICAL(&configMux);
+
+    ESP_LOGI(TAG, "Interpolation config: sources = 0x%x", newConfig->sources);
+}
+
+// Applies the settings present in json on top of config, a true or false for
+// each source by name
+void interpolation_parse_config(cJSON *json, interpolationConfig *config)
+{
+    for (uint8_t i = 0; i < NUM_INTERPOLATE_SOURCES; i++) {
+        const cJSON *sourceJson = cJSON_GetObjectItem(json, sourceNames[i]);
+        if (cJSON_IsBool(sourceJson)) {
+            if (cJSON_IsTrue(sourceJson)) {
+                config->sources |= 1 << i;
+            } else {
+                config->sources &= ~(1 << i);
+            }
+        }
+    }
+}
+
+void interpolation_print_config(const interpolationConfig *config, cJSON *json)
+{
+    for (uint8_t i = 0; i < NUM_INTERPOLATE_SOURCES; i++) {
+        cJSON_AddBoolToObject(json, sourceNames[i], (config->sources >> i) & 1);
+    }
+}
+
+// Frames received from each source and the blended frames shown between
+// them, with how far behind the source the output runs
+void interpolation_add_stats(cJSON *json)
+{
+    cJSON *interpolationJson = cJSON_AddObjectToObject(json, "interpolation");
+    for (uint8_t i = 0; i < NUM_INTERPOLATE_SOURCES; i++) {
+        const frameInterpolator *ip = &interpolators[i];
+        cJSON *sourceJson = cJSON_AddObjectToObject(interpolationJson, sourceNames[i]);
+        cJSON_AddBoolToObject(sourceJson, "enabled", interpolation_enabled(i));
+        cJSON_AddNumberToObject(sourceJson, "received", ip->received);
+        cJSON_AddNumberToObject(sourceJson, "interpolated", ip->interpolated);
+        cJSON_AddNumberToObject(sourceJson, "delayMillis", delay_millis(ip));
+    }
+}
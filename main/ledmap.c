@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include "frame_base.h"
+#include "ledmap_format.h"
+
+static const char *TAG = "ledmap";
+static const char *NVS_NAMESPACE = "lightframe";
+static const char *NVS_LEDMAP_KEY = "ledmap";
+
+// The index splits the map's bounds into at most this many buckets each way
+#define INDEX_MAX_SIDE 16
+#define INDEX_MAX_BUCKETS (INDEX_MAX_SIDE * INDEX_MAX_SIDE)
+
+// Without a map every LED is at its place in the grid
+static ledPosition positions[NUM_PIXELS];
+static bool loaded = false;
+// Grid cell each LED takes its colour from in frames drawn by grid scenes
+static uint8_t raster[NUM_PIXELS];
+
+// LEDs sorted by bucket, row by row, so the LEDs of a run of buckets along a
+// row are next to each other. Bucket b holds bucketLeds[bucketStart[b]] up to
+// bucketLeds[bucketStart[b + 1]].
+static int16_t indexX;
+static int16_t indexY;
+static uint8_t bucketShift;
+static uint8_t bucketsWide;
+static uint8_t bucketsHigh;
+static uint16_t bucketStart[INDEX_MAX_BUCKETS + 1];
+static uint8_t bucketLeds[NUM_PIXELS];
+
+// Maps uploaded over HTTP wait here until the render task picks them up
+static ledPosition pendingPositions[NUM_PIXELS];
+static bool pendingLoaded = false;
+static volatile bool mapPending = false;
+static portMUX_TYPE mapMux = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void grid_positions(ledPosition *result)
+{
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            result[pixelIdx(col, row)].x = col << 8;
+            result[pixelIdx(col, row)].y = row << 8;
+        }
+    }
+}
+
+static void build_raster()
+{
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        // Each grid cell reaches half a pixel either side of its centre
+        int32_t col = (positions[i].x + 128) >> 8;
+        int32_t row = (positions[i].y + 128) >> 8;
+        col = col < 0 ? 0 : col >= PIXELS_PER_ROW ? PIXELS_PER_ROW - 1 : col;
+        row = row < 0 ? 0 : row >= NUM_ROWS ? NUM_ROWS - 1 : row;
+        raster[i] = pixelIdx(col, row);
+    }
+}
+
+static inline uint16_t bucket_of(const ledPosition *position)
+{
+    return ((position->y - indexY) >> bucketShift) * bucketsWide + ((position->x - indexX) >> bucketShift);
+}
+
+// Buckets start a pixel wide, and grow by powers of 2 until the map fits
+static void build_index()
+{
+    int16_t maxX = positions[0].x;
+    int16_t maxY = positions[0].y;
+    indexX = positions[0].x;
+    indexY = positions[0].y;
+    for (uint16_t i = 1; i < NUM_PIXELS; i++) {
+        indexX = positions[i].x < indexX ? positions[i].x : indexX;
+        indexY = positions[i].y < indexY ? positions[i].y : indexY;
+        maxX = positions[i].x > maxX ? positions[i].x : maxX;
+        maxY = positions[i].y > maxY ? positions[i].y : maxY;
+    }
+    bucketShift = 8;
+    while (((maxX - indexX) >> bucketShift) >= INDEX_MAX_SIDE || ((maxY - indexY) >> bucketShift) >= INDEX_MAX_SIDE) {
+        bucketShift++;
+    }
+    bucketsWide = ((maxX - indexX) >> bucketShift) + 1;
+    bucketsHigh = ((maxY - indexY) >> bucketShift) + 1;
+
+    // Counting sort of the LEDs into their buckets
+    uint16_t numBuckets = bucketsWide * bucketsHigh;
+    memset(bucketStart, 0, sizeof(bucketStart));
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        bucketStart[bucket_of(&positions[i]) + 1]++;
+    }
+    for (uint16_t b = 0; b < numBuckets; b++) {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    uint16_t next[INDEX_MAX_BUCKETS];
+    memcpy(next, bucketStart, numBuckets * sizeof(uint16_t));
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        bucketLeds[next[bucket_of(&positions[i])]++] = i;
+    }
+}
+
+static void apply_map(const ledPosition *newPositions, bool newLoaded)
+{
+    if (newLoaded) {
+        memcpy(positions, newPositions, sizeof(positions));
+    } else {
+        grid_positions(positions);
+    }
+    loaded = newLoaded;
+    build_raster();
+    build_index();
+}
+
+static bool parse_map(const uint8_t *data, size_t length, ledPosition *result, bool *hasMap)
+{
+    const ledMapHeader *header = (const ledMapHeader *) data;
+    if (length < sizeof(ledMapHeader)
+            || memcmp(header->magic, LEDMAP_MAGIC, sizeof(header->magic)) != 0
+            || header->version != LEDMAP_VERSION
+            || (header->count != 0 && header->count != NUM_PIXELS)
+            || length != sizeof(ledMapHeader) + header->count * sizeof(ledPosition)) {
+        return false;
+    }
+    *hasMap = header->count > 0;
+    memcpy(result, data + sizeof(ledMapHeader), header->count * sizeof(ledPosition));
+    return true;
+}
+
+void ledmap_initialise()
+{
+    apply_map(NULL, false);
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    static uint8_t stored[sizeof(ledMapHeader) + sizeof(positions)];
+    size_t length = sizeof(stored);
+    ledPosition storedPositions[NUM_PIXELS];
+    bool hasMap;
+    if (nvs_get_blob(handle, NVS_LEDMAP_KEY, stored, &length) == ESP_OK
+            && parse_map(stored, length, storedPositions, &hasMap) && hasMap) {
+        apply_map(storedPositions, true);
+        ESP_LOGI(TAG, "Loaded LED map, %d x %d buckets", bucketsWide, bucketsHigh);
+    }
+    nvs_close(handle);
+}
+
+// Stores a new map, to be used from the next frame. Returns
+// ESP_ERR_INVALID_ARG if it isn't valid.
+esp_err_t ledmap_load(const char *data, size_t length)
+{
+    ledPosition parsed[NUM_PIXELS];
+    bool hasMap;
+    if (!parse_map((const uint8_t *) data, length, parsed, &hasMap)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&mapMux);
+    memcpy(pendingPositions, parsed, sizeof(pendingPositions));
+    pendingLoaded = hasMap;
+    mapPending = true;
+    portEXIT_CRITICAL(&mapMux);
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error opening NVS");
+        return ESP_FAIL;
+    }
+    esp_err_t err = hasMap ? nvs_set_blob(handle, NVS_LEDMAP_KEY, data, length) : nvs_erase_key(handle, NVS_LEDMAP_KEY);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    ESP_LOGI(TAG, hasMap ? "New LED map" : "Back to the grid");
+    return err;
+}
+
+// Called by the render task before each frame. Returns true if the map changed.
+bool ledmap_apply_pending()
+{
+    if (!mapPending) {
+        return false;
+    }
+    ledPosition newPositions[NUM_PIXELS];
+    portENTER_CRITICAL(&mapMux);
+    memcpy(newPositions, pendingPositions, sizeof(newPositions));
+    bool newLoaded = pendingLoaded;
+    mapPending = false;
+    portEXIT_CRITICAL(&mapMux);
+
+    apply_map(newPositions, newLoaded);
+    return true;
+}
+
+bool ledmap_loaded()
+{
+    return loaded;
+}
+
+const ledPosition *ledmap_positions()
+{
+    return positions;
+}
+
+// Puts the LEDs with x0 <= x < x1 and y0 <= y < y1 in leds, in no particular
+// order, and returns how many there are. Coordinates are as in ledPosition.
+uint16_t ledmap_query(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint8_t *leds, uint16_t maxLeds)
+{
+    if (x1 <= indexX || y1 <= indexY || x0 >= x1 || y0 >= y1) {
+        return 0;
+    }
+    int32_t firstCol = x0 > indexX ? (x0 - indexX) >> bucketShift : 0;
+    int32_t firstRow = y0 > indexY ? (y0 - indexY) >> bucketShift : 0;
+    int32_t lastCol = (x1 - 1 - indexX) >> bucketShift;
+    int32_t lastRow = (y1 - 1 - indexY) >> bucketShift;
+    lastCol = lastCol < bucketsWide ? lastCol : bucketsWide - 1;
+    lastRow = lastRow < bucketsHigh ? lastRow : bucketsHigh - 1;
+    if (firstCol > lastCol || firstRow > lastRow) {
+        return 0;
+    }
+
+    uint16_t count = 0;
+    for (int32_t row = firstRow; row <= lastRow; row++) {
+        uint16_t end = bucketStart[row * bucketsWide + lastCol + 1];
+        for (uint16_t k = bucketStart[row * bucketsWide + firstCol]; k < end; k++) {
+            const ledPosition *position = &positions[bucketLeds[k]];
+            if (position->x >= x0 && position->x < x1 && position->y >= y0 && position->y < y1 && count < maxLeds) {
+                leds[count++] = bucketLeds[k];
+            }
+        }
+    }
+    return count;
+}
+
+// Gives each LED the colour of the grid cell it sits in
+void ledmap_rasterize(const frameBuffer *grid, frameBuffer *result)
+{
+    result->palette = grid->palette;
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        if (grid->palette != NULL) {
+            result->indices[i] = grid->indices[raster[i]];
+        } else {
+            result->pixels[i] = grid->pixels[raster[i]];
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef LEDMAP_FORMAT_H
+#define LEDMAP_FORMAT_H
+
+#include <stdint.h>
+
+// LED map format, as written by tools/ledmap_encode.py
+//
+// ledMapHeader
+// positions    count ledPositions, one for each LED in strand order
+//
+// Positions are in 1/256 pixels from the top left of the panel's grid, so the
+// LED in column c and row r of a regular panel is at (c * 256, r * 256). count
+// must equal the strand length, NUM_PIXELS in frame_base.h, or be 0 to go back
+// to the grid. Maps with any other count are rejected.
+
+#define LEDMAP_MAGIC "LFMP"
+#define LEDMAP_VERSION 1
+
+typedef struct __attribute__((packed)) ledMapHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t count;
+} ledMapHeader;
+
+#endif /* LEDMAP_FORMAT_H */
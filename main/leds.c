@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <driver/gpio.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -19,6 +20,18 @@ static strand_t STRANDS[] = {
     }
 };
 
+// Applied to every colour as frames are sent, 255 - full brightness
+static uint8_t brightness = 255;
+
+// The last frame sent, before brightness, for the API to read back. Only the
+// render task writes it, making snapshotSeq odd while it does, so readers
+// copy without a lock and retry if the frame changed under them.
+static pixelColor_t snapshot[NUM_PIXELS];
+static volatile uint32_t snapshotSeq = 0;
+
+bool effects_active();
+void effects_apply(pixelColor_t *pixels);
+
 static float my_fmod(float arg1, float arg2)
 {
     int full = (int)(arg1/arg2);
@@ -88,11 +101,100 @@ void leds_initialise()
     digitalLeds_resetPixels(pStrand);
 }
 
-void leds_set_pixel(int pixel, float hue, float sat, float value)
+pixelColor_t leds_hsv_colour(float hue, float sat, float value)
 {
-    strand_t * strand = &STRANDS[0];
-    pixelColor_t colour = pixel_from_hsv(hue, sat, value);
-    strand->pixels[pixel] = colour;
+    return pixel_from_hsv(hue, sat, value);
+}
+
+void leds_set_pixel(frameBuffer *frame, int pixel, float hue, float sat, float value)
+{
+    frame->pixels[pixel] = pixel_from_hsv(hue, sat, value);
+}
+
+// Palettes hold colours already packed in wire order, so frames drawn through
+// a palette need no colour maths per pixel and, at full brightness with no
+// effects, are expanded by the LED library straight into the transmit buffer.
+// The strand's own pixels are still allocated, for every other kind of frame.
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette)
+{
+    frame->palette = palette;
+}
+
+void leds_set_palette_colour(uint32_t *palette, uint8_t entry, float hue, float sat, float value)
+{
+    palette[entry] = digitalLeds_packColor(pixel_from_hsv(hue, sat, value));
+}
+
+void leds_set_pixel_index(frameBuffer *frame, int pixel, uint8_t entry)
+{
+    frame->indices[pixel] = entry;
+}
+
+void leds_clear_frame(frameBuffer *frame)
+{
+    // Zero is black as a colour and as PALETTE_BLACK, and pixels covers indices
+    memset(frame->pixels, 0, sizeof(frame->pixels));
+}
+
+void leds_set_brightness(uint8_t value)
+{
+    brightness = value;
+}
+
+uint8_t leds_get_brightness()
+{
+    return brightness;
+}
+
+static inline void snapshot_begin()
+{
+    snapshotSeq++;
+    __sync_synchronize();
+}
+
+static inline void snapshot_end()
+{
+    __sync_synchronize();
+    snapshotSeq++;
+}
+
+static void snapshot_store(const pixelColor_t *pixels)
+{
+    snapshot_begin();
+    memcpy(snapshot, pixels, sizeof(snapshot));
+    snapshot_end();
+}
+
+// Copies the last frame sent into pixels and returns its frame number
+uint32_t leds_get_snapshot(pixelColor_t *pixels)
+{
+    for (;;) {
+        uint32_t seq = snapshotSeq;
+        if (seq & 1) {
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(pixels, snapshot, sizeof(snapshot));
+        __sync_synchronize();
+        if (snapshotSeq == seq) {
+            return seq / 2;
+        }
+    }
+}
+
+// Scales the strand's pixels by the brightness, ready to be sent
+static void apply_brightness(strand_t *strand)
+{
+    if (brightness == 255) {
+        return;
+    }
+    uint16_t scale = brightness + 1;
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        strand->pixels[i].r = (strand->pixels[i].r * scale) >> 8;
+        strand->pixels[i].g = (strand->pixels[i].g * scale) >> 8;
+        strand->pixels[i].b = (strand->pixels[i].b * scale) >> 8;
+        strand->pixels[i].w = (strand->pixels[i].w * scale) >> 8;
+    }
 }
 
 void leds_update()
@@ -101,6 +203,72 @@ void leds_update()
     digitalLeds_updatePixels(strand);
 }
 
+void leds_show_pixels(const pixelColor_t *pixels)
+{
+    strand_t * strand = &STRANDS[0];
+    boot_trace_mark(BOOT_FIRST_FRAME);
+    memcpy(strand->pixels, pixels, NUM_PIXELS * sizeof(pixelColor_t));
+    if (effects_active()) {
+        effects_apply(strand->pixels);
+    }
+    snapshot_store(strand->pixels);
+    apply_brightness(strand);
+    digitalLeds_updatePixels(strand);
+}
+
+void leds_show(const frameBuffer *frame)
+{
+    strand_t * strand = &STRANDS[0];
+    if (frame->palette != NULL && brightness == 255 && !effects_active()) {
+        boot_trace_mark(BOOT_FIRST_FRAME);
+        snapshot_begin();
+        for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+            snapshot[i] = framePixel(frame, i);
+        }
+        snapshot_end();
+        digitalLeds_updatePixelsIndexed(strand, frame->indices, frame->palette);
+    } else if (frame->palette != NULL) {
+        // Dimmed palette frames, and those with effects, are expanded here so
+        // the palette is left as it is
+        boot_trace_mark(BOOT_FIRST_FRAME);
+        for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+            strand->pixels[i] = framePixel(frame, i);
+        }
+        if (effects_active()) {
+            effects_apply(strand->pixels);
+        }
+        snapshot_store(strand->pixels);
+        apply_brightness(strand);
+        digitalLeds_updatePixels(strand);
+    } else {
+        leds_show_pixels(frame->pixels);
+    }
+}
+
+// Mixes two frames into the strand, weight 0 showing only from and 255 only to
+void leds_show_blend(const frameBuffer *from, const frameBuffer *to, const uint8_t *weights)
+{
+    strand_t * strand = &STRANDS[0];
+    boot_trace_mark(BOOT_FIRST_FRAME);
+
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        pixelColor_t a = framePixel(from, i);
+        pixelColor_t b = framePixel(to, i);
+        // Stretch 0 - 255 to 0 - 256 so both ends are exact
+        int32_t weight = weights[i] + (weights[i] >> 7);
+        strand->pixels[i].r = a.r + (((b.r - a.r) * weight) >> 8);
+        strand->pixels[i].g = a.g + (((b.g - a.g) * weight) >> 8);
+        strand->pixels[i].b = a.b + (((b.b - a.b) * weight) >> 8);
+        strand->pixels[i].w = 0;
+    }
+    if (effects_active()) {
+        effects_apply(strand->pixels);
+    }
+    snapshot_store(strand->pixels);
+    apply_brightness(strand);
+    digitalLeds_updatePixels(strand);
+}
+
 void leds_clear(bool updateLeds)
 {
     strand_t * strand = &STRANDS[0];
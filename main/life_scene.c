@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include "frame_base.h"
+
+static const char *TAG = "scene life";
+
+// Canvases bigger than this only run the automaton in their top left corner
+#define MAX_LIFE_WIDTH 128
+#define MAX_LIFE_HEIGHT 64
+#define LIFE_WORDS (MAX_LIFE_WIDTH / 32)
+// Bits in the dying counter, enough for 8 states
+#define DYING_BITS 3
+#define MAX_STATES (1 << DYING_BITS)
+// Room for the longest rule, B012345678/S012345678/C8, and its terminator
+#define MAX_RULE_LENGTH 25
+// Generations a settled pattern is shown for before starting again
+#define SETTLED_GENERATIONS 16
+// Palette entries 1 to AGE_COLOURS are live cells by age, the ones after dying cells
+#define AGE_COLOURS 32
+#define DYING_ENTRY (AGE_COLOURS + 1)
+
+// One bit per cell, 32 cells to a word, bit 0 being the leftmost
+typedef uint32_t lifePlane[MAX_LIFE_HEIGHT][LIFE_WORDS];
+
+typedef struct namedRule {
+    const char *name;
+    const char *rule;
+} namedRule;
+
+static const namedRule namedRules[] = {
+    {"life", "B3/S23"},
+    {"highlife", "B36/S23"},
+    {"seeds", "B2/S"},
+    {"daynight", "B3678/S34678"},
+    {"brain", "B2/S/C3"},
+    {"starwars", "B2/S345/C4"},
+};
+
+// The last three generations of live cells, so patterns that have stopped or
+// only blink can be spotted. Dying cells are counted up in bit slices, bit n
+// of each cell's count in dying[n], and updated in place.
+static lifePlane generations[3];
+static lifePlane dying[DYING_BITS];
+static uint8_t current = 0;
+static uint16_t width = 0;
+static uint16_t height = 0;
+static uint8_t numWords = 0;
+static uint32_t lastWordMask = 0;
+
+// How long each of this panel's cells has been alive
+static uint8_t ages[NUM_PIXELS];
+static uint32_t life_palette[PALETTE_SIZE];
+
+static uint16_t birth = 1 << 3;
+static uint16_t survive = 1 << 2 | 1 << 3;
+static uint8_t states = 2;
+static uint8_t density = 80;
+static uint16_t generationMillis = 100;
+static uint16_t maxGenerations = 1000;
+static float hue = 0.3;
+static float hueSpread = 0.3;
+static float value = 0.1;
+
+static uint32_t generation = 0;
+static uint8_t settledGenerations = 0;
+static bool restartPending = true;
+static uint32_t randomState = 0;
+static uint32_t lastMillis = 0;
+static int64_t generationMicros = 0;
+static int64_t maxGenerationMicros = 0;
+
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_set_palette_colour(uint32_t *palette, uint8_t entry, float hue, float sat, float value);
+
+
+static void build_palette()
+{
+    for (uint8_t i = 0; i < AGE_COLOURS; i++) {
+        leds_set_palette_colour(life_palette, 1 + i, hue + hueSpread * i / (AGE_COLOURS - 1), 1, value);
+    }
+    // Dying cells fade out in the colour cells are born with
+    for (uint8_t i = 1; i < MAX_STATES - 1; i++) {
+        leds_set_palette_colour(life_palette, DYING_ENTRY + i, hue, 1, value / (2 * i));
+    }
+}
+
+static void seed()
+{
+    const canvasConfig *canvas = getCanvas();
+    width = canvas->width < MAX_LIFE_WIDTH ? canvas->width : MAX_LIFE_WIDTH;
+    height = canvas->height < MAX_LIFE_HEIGHT ? canvas->height : MAX_LIFE_HEIGHT;
+    numWords = (width + 31) / 32;
+    lastWordMask = width % 32 == 0 ? 0xFFFFFFFF : (1u << (width % 32)) - 1;
+
+    memset(generations, 0, sizeof(generations));
+    memset(dying, 0, sizeof(dying));
+    for (uint16_t row = 0; row < height; row++) {
+        for (uint16_t col = 0; col < width; col++) {
+            if ((canvasRandom(&randomState) & 0xFF) < density) {
+                generations[current][row][col >> 5] |= 1u << (col & 31);
+            }
+        }
+    }
+    memset(ages, 0, sizeof(ages));
+    generation = 0;
+    settledGenerations = 0;
+}
+
+// Adds a board of one bit per cell to a 4 bit count held in bit slices
+static inline void add_to_count(uint32_t *count, uint32_t board)
+{
+    for (uint8_t bit = 0; bit < 4; bit++) {
+        uint32_t carry = count[bit] & board;
+        count[bit] ^= board;
+        board = carry;
+    }
+}
+
+// Cells whose count is one of those set in mask
+static inline uint32_t count_matches(const uint32_t *count, uint16_t mask)
+{
+    uint32_t matches = 0;
+    for (uint8_t n = 0; n <= 8; n++) {
+        if (mask & (1 << n)) {
+            matches |= (n & 1 ? count[0] : ~count[0]) & (n & 2 ? count[1] : ~count[1])
+                & (n & 4 ? count[2] : ~count[2]) & (n & 8 ? count[3] : ~count[3]);
+        }
+    }
+    return matches;
+}
+
+// Adds the three cells above, beside or below each cell of word in row, the
+// canvas wrapping round at the edges
+static inline void add_row(uint32_t *count, const uint32_t *row, uint8_t word, bool includeCentre)
+{
+    uint32_t centre = row[word];
+    uint32_t left = centre << 1;
+    uint32_t right = centre >> 1;
+    if (word > 0) {
+        left |= row[word - 1] >> 31;
+    } else {
+        left |= (row[(width - 1) >> 5] >> ((width - 1) & 31)) & 1;
+    }
+    if (word < numWords - 1) {
+        right |= row[word + 1] << 31;
+    } else {
+        right |= (row[0] & 1) << ((width - 1) & 31);
+    }
+    add_to_count(count, left);
+    add_to_count(count, right);
+    if (includeCentre) {
+        add_to_count(count, centre);
+    }
+}
+
+// Works out the next generation 32 cells at a time, with no per cell loop
+static void step()
+{
+    const lifePlane *cells = &generations[current];
+    lifePlane *next = &generations[(current + 1) % 3];
+    uint8_t dyingValue = states - 1;
+
+    for (uint16_t row = 0; row < height; row++) {
+        const uint32_t *above = (*cells)[row == 0 ? height - 1 : row - 1];
+        const uint32_t *below = (*cells)[row == height - 1 ? 0 : row + 1];
+
+        for (uint8_t word = 0; word < numWords; word++) {
+            uint32_t count[4] = {0, 0, 0, 0};
+            add_row(count, above, word, true);
+            add_row(count, (*cells)[row], word, false);
+            add_row(count, below, word, true);
+
+            uint32_t alive = (*cells)[row][word];
+            uint32_t dyingCells = 0;
+            for (uint8_t bit = 0; bit < DYING_BITS; bit++) {
+                dyingCells |= dying[bit][row][word];
+            }
+            uint32_t survivors = alive & count_matches(count, survive);
+            uint32_t born = ~alive & ~dyingCells & count_matches(count, birth);
+            uint32_t mask = word == numWords - 1 ? lastWordMask : 0xFFFFFFFF;
+            (*next)[row][word] = (survivors | born) & mask;
+
+            if (states > 2) {
+                // Count the dying cells up, those reaching states - 1 are dead
+                uint32_t carry = dyingCells;
+                uint32_t done = 0xFFFFFFFF;
+                for (uint8_t bit = 0; bit < DYING_BITS; bit++) {
+                    uint32_t *slice = &dying[bit][row][word];
+                    uint32_t nextCarry = *slice & carry;
+                    *slice ^= carry;
+                    carry = nextCarry;
+                    done &= dyingValue & (1 << bit) ? *slice : ~*slice;
+                }
+                for (uint8_t bit = 0; bit < DYING_BITS; bit++) {
+                    dying[bit][row][word] &= ~done;
+                }
+                // Cells that have just died start at 1
+                dying[0][row][word] |= alive & ~survivors;
+            }
+        }
+    }
+
+    // A pattern that has stopped or is blinking between two states has settled
+    const lifePlane *previous = &generations[(current + 2) % 3];
+    bool settled = generation > 1 && memcmp(next, previous, sizeof(lifePlane)) == 0;
+    settledGenerations = settled ? settledGenerations + 1 : 0;
+    current = (current + 1) % 3;
+    generation++;
+}
+
+static void draw(frameBuffer *frame)
+{
+    const canvasConfig *canvas = getCanvas();
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            uint16_t cellCol = canvas->x + col;
+            uint16_t cellRow = canvas->y + row;
+            uint8_t idx = pixelIdx(col, row);
+            uint8_t entry = PALETTE_BLACK;
+            if (cellCol < width && cellRow < height) {
+                uint32_t bit = 1u << (cellCol & 31);
+                if (generations[current][cellRow][cellCol >> 5] & bit) {
+                    if (ages[idx] < AGE_COLOURS) {
+                        ages[idx]++;
+                    }
+                    entry = ages[idx];
+                } else {
+                    ages[idx] = 0;
+                    uint8_t dyingCount = 0;
+                    for (uint8_t i = 0; i < DYING_BITS; i++) {
+                        dyingCount |= (dying[i][cellRow][cellCol >> 5] & bit ? 1 : 0) << i;
+                    }
+                    entry = dyingCount > 0 ? DYING_ENTRY + dyingCount : PALETTE_BLACK;
+                }
+            }
+            frame->indices[idx] = entry;
+        }
+    }
+}
+
+bool life_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    if (currMillis - lastMillis < generationMillis) {
+        return false;
+    }
+    lastMillis = currMillis;
+
+    if (restartPending || settledGenerations > SETTLED_GENERATIONS
+            || (maxGenerations > 0 && generation >= maxGenerations)) {
+        randomState = restartPending ? getCanvas()->seed : randomState;
+        seed();
+        restartPending = false;
+    } else {
+        int64_t startMicros = esp_timer_get_time();
+        step();
+        generationMicros = esp_timer_get_time() - startMicros;
+        if (generationMicros > maxGenerationMicros) {
+            maxGenerationMicros = generationMicros;
+        }
+    }
+
+    draw(frame);
+    return true;
+}
+
+void life_scene_init(frameBuffer *frame)
+{
+    lastMillis = 0;
+    restartPending = true;
+    build_palette();
+    leds_set_palette(frame, life_palette);
+}
+
+// Parses a rule such as B3/S23, or B2/S/C3 with the number of states, or one
+// of the names in namedRules
+static bool parse_rule(const char *rule, lifeSceneConfig *config)
+{
+    for (uint8_t i = 0; i < sizeof(namedRules) / sizeof(namedRules[0]); i++) {
+        if (strcmp(rule, namedRules[i].name) == 0) {
+            rule = namedRules[i].rule;
+        }
+    }
+
+    uint16_t *mask = NULL;
+    uint16_t newBirth = 0;
+    uint16_t newSurvive = 0;
+    uint8_t newStates = 2;
+    for (const char *c = rule; *c != '\0'; c++) {
+        char upper = toupper((unsigned char) *c);
+        if (upper == 'B') {
+            mask = &newBirth;
+        } else if (upper == 'S') {
+            mask = &newSurvive;
+        } else if (upper == 'C' || upper == 'G') {
+            mask = NULL;
+            newStates = 0;
+            while (isdigit((unsigned char) c[1])) {
+                newStates = newStates * 10 + *++c - '0';
+            }
+        } else if (isdigit((unsigned char) upper) && upper != '9' && mask != NULL) {
+            *mask |= 1 << (upper - '0');
+        } else if (upper != '/') {
+            return false;
+        }
+    }
+    if (newStates < 2 || newStates > MAX_STATES) {
+        return false;
+    }
+    config->birth = newBirth;
+    config->survive = newSurvive;
+    config->states = newStates;
+    return true;
+}
+
+static void print_rule(const lifeSceneConfig *config, char *rule, size_t ruleLength)
+{
+    size_t length = 0;
+    const uint16_t masks[] = {config->birth, config->survive};
+    for (uint8_t i = 0; i < 2; i++) {
+        length += snprintf(rule + length, ruleLength - length, i == 0 ? "B" : "/S");
+        for (uint8_t n = 0; n <= 8; n++) {
+            if (masks[i] & (1 << n)) {
+                length += snprintf(rule + length, ruleLength - length, "%d", n);
+            }
+        }
+    }
+    if (config->states > 2) {
+        snprintf(rule + length, ruleLength - length, "/C%d", config->states);
+    }
+}
+
+void life_scene_get_config(lifeSceneConfig *config)
+{
+    config->birth = birth;
+    config->survive = survive;
+    config->states = states;
+    config->density = density;
+    config->generationMillis = generationMillis;
+    config->maxGenerations = maxGenerations;
+    config->hue = hue;
+    config->hueSpread = hueSpread;
+    config->value = value;
+}
+
+void life_scene_set_config(const lifeSceneConfig *config)
+{
+    birth = config->birth;
+    survive = config->survive;
+    states = config->states >= 2 && config->states <= MAX_STATES ? config->states : 2;
+    density = config->density;
+    generationMillis = config->generationMillis;
+    maxGenerations = config->maxGenerations;
+    hue = config->hue;
+    hueSpread = config->hueSpread;
+    value = config->value;
+    build_palette();
+    restartPending = true;
+}
+
+// Applies the settings present in json on top of config. A rule that can't be
+// parsed is ignored.
+void life_scene_parse_config(cJSON *json, lifeSceneConfig *config)
+{
+    const cJSON *ruleJson = cJSON_GetObjectItem(json, "rule");
+    if (cJSON_IsString(ruleJson) && !parse_rule(ruleJson->valuestring, config)) {
+        ESP_LOGI(TAG, "Rule %s is not valid", ruleJson->valuestring);
+    }
+    const cJSON *densityJson = cJSON_GetObjectItem(json, "density");
+    if (cJSON_IsNumber(densityJson)) {
+        config->density = (uint8_t) densityJson->valueint;
+    }
+    const cJSON *generationMillisJson = cJSON_GetObjectItem(json, "generationMillis");
+    if (cJSON_IsNumber(generationMillisJson)) {
+        config->generationMillis = (uint16_t) generationMillisJson->valueint;
+    }
+    const cJSON *maxGenerationsJson = cJSON_GetObjectItem(json, "maxGenerations");
+    if (cJSON_IsNumber(maxGenerationsJson)) {
+        config->maxGenerations = (uint16_t) maxGenerationsJson->valueint;
+    }
+    const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
+    if (cJSON_IsNumber(hueJson)) {
+        config->hue = (float) hueJson->valuedouble;
+    }
+    const cJSON *hueSpreadJson = cJSON_GetObjectItem(json, "hueSpread");
+    if (cJSON_IsNumber(hueSpreadJson)) {
+        config->hueSpread = (float) hueSpreadJson->valuedouble;
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->value = (float) valueJson->valuedouble;
+        if (config->value > HSV_MAX_VALUE) {
+            config->value = HSV_MAX_VALUE;
+        }
+    }
+}
+
+void life_scene_print_config(const lifeSceneConfig *config, cJSON *json)
+{
+    char rule[MAX_RULE_LENGTH];
+    print_rule(config, rule, sizeof(rule));
+    cJSON_AddStringToObject(json, "rule", rule);
+    cJSON_AddNumberToObject(json, "density", config->density);
+    cJSON_AddNumberToObject(json, "generationMillis", config->generationMillis);
+    cJSON_AddNumberToObject(json, "maxGenerations", config->maxGenerations);
+    cJSON_AddNumberToObject(json, "hue", config->hue);
+    cJSON_AddNumberToObject(json, "hueSpread", config->hueSpread);
+    cJSON_AddNumberToObject(json, "value", config->value);
+}
+
+// Time taken by the last generation and the longest since boot, for the whole
+// canvas rather than only this panel
+void life_scene_add_stats(cJSON *json)
+{
+    cJSON *lifeJson = cJSON_AddObjectToObject(json, "life");
+    cJSON_AddNumberToObject(lifeJson, "width", width);
+    cJSON_AddNumberToObject(lifeJson, "height", height);
+    cJSON_AddNumberToObject(lifeJson, "generation", generation);
+    cJSON_AddNumberToObject(lifeJson, "generationMicros", generationMicros);
+    cJSON_AddNumberToObject(lifeJson, "maxGenerationMicros", maxGenerationMicros);
+    cJSON_AddNumberToObject(lifeJson, "generationsPerSecond", generationMicros > 0 ? 1000000 / generationMicros : 0);
+}
@@ -16,23 +16,79 @@
 // Timer count (alarm value) = 40000
 
 #define TIMER_ALARM_VALUE 40000
+// Clock slewing moves millis by 1 ms every this many ticks
+#define SLEW_TICKS 16
 
 volatile uint32_t millis = 0;
 volatile bool tick = false;
 
+// Time sync corrections, applied by the timer ISR so millis only changes there
+static volatile int32_t millisStep = 0;
+static volatile int32_t millisSlew = 0;
+
+// Set by stop() for the render task, which clears the LEDs and restarts the
+// scene between frames
+static volatile bool stopPending = false;
+// Set once app_main has loaded the stored animation, shader, image, LED map
+// and playlist, which scenes need before they can draw
+static volatile bool assetsReady = false;
+
 void wifi_initialise();
+void anim_scene_initialise();
+void shader_scene_initialise();
+void image_scene_initialise();
+void ledmap_initialise();
+void playlist_initialise();
+void playlist_update(uint32_t millis);
+void settings_initialise();
+void settings_restore();
 void leds_initialise();
 void leds_clear(bool updateLeds);
 
 void tg_timer_isr()
 {
+    static uint8_t slewTicks = 0;
+
     /* Clear the interrupt */
     TIMERG0.int_clr_timers.t1 = 1;
     TIMERG0.hw_timer[1].config.alarm_en = TIMER_ALARM_EN;
     millis++;
+    if (millisStep != 0) {
+        millis += millisStep;
+        millisStep = 0;
+    } else if (millisSlew != 0 && ++slewTicks >= SLEW_TICKS) {
+        slewTicks = 0;
+        if (millisSlew > 0) {
+            millis++;
+            millisSlew--;
+        } else {
+            millis--;
+            millisSlew++;
+        }
+    }
     tick = true;
 }
 
+// Jumps millis by adjust on the next tick
+void millis_step(int32_t adjust)
+{
+    millisSlew = 0;
+    millisStep = adjust;
+}
+
+// Moves millis by adjust gradually, so scenes don't visibly jump
+void millis_slew(int32_t adjust)
+{
+    millisSlew = adjust;
+}
+
+// Lengthens (positive) or shortens (negative) each millisecond by alarmTicks
+// timer ticks, 25 ppm each, to cancel out drift between crystals
+void millis_set_rate(int32_t alarmTicks)
+{
+    timer_set_alarm_value(TIMER_GROUP_0, TIMER_1, TIMER_ALARM_VALUE + alarmTicks);
+}
+
 static void tg_timer_init()
 {
     timer_config_t config;
@@ -64,12 +120,17 @@ void resume()
 void stop()
 {
     pause();
-    leds_clear(true);
-    currentSceneInit();
+    stopPending = true;
 }
 
 static void leds_task(void *pvParameters) {
     leds_initialise();
+    boot_trace_mark(BOOT_LEDS);
+
+    // The LEDs come up while app_main reads the assets from flash
+    while (!assetsReady) {
+        vTaskDelay(1);
+    }
     tg_timer_init();
 
     uint32_t localLastMillis = 0;
@@ -77,11 +138,18 @@ static void leds_task(void *pvParameters) {
     uint32_t lastSeconds = 0;
     UBaseType_t uxHighWaterMark;
 
+    settings_restore();
     currentSceneInit();
 
     printf("LEDs task start\n");
 
     for (;;) {
+        // Checked on every pass, as the timer doesn't tick while stopped
+        if (stopPending) {
+            stopPending = false;
+            leds_clear(true);
+            currentSceneInit();
+        }
         if (tick) {
             if (millis - localLastMillis >= 1000) {
                 seconds++;
@@ -95,6 +163,7 @@ static void leds_task(void *pvParameters) {
                 lastSeconds = seconds;
             }
 
+            playlist_update(millis);
             currentSceneUpdate(millis);
 
             tick = false;
@@ -105,14 +174,27 @@ static void leds_task(void *pvParameters) {
 void app_main()
 {
     ESP_ERROR_CHECK(nvs_flash_init());
-    wifi_initialise();
+    boot_trace_mark(BOOT_NVS);
+    settings_initialise();
 
+    // The LED driver starts while the assets are read from flash, and the
+    // first frame follows as soon as they are loaded, without waiting for the
+    // WiFi driver, which carries on starting up here on core 0
     xTaskCreatePinnedToCore(
         leds_task,
         "leds_task",
-        3000, // Stack size in bytes
+        4096, // Stack size in bytes
         NULL, // Task input parameter
         0, // Priority of task
         NULL, // Task handle
         1); // Core
+
+    anim_scene_initialise();
+    shader_scene_initialise();
+    image_scene_initialise();
+    ledmap_initialise();
+    playlist_initialise();
+    assetsReady = true;
+
+    wifi_initialise();
 }
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include "frame_base.h"
+
+static const char *TAG = "scene particles";
+
+#define MAX_PARTICLES 512
+#define PARTICLES_FRAME_MILLIS 16
+#define HUE_STEPS 64
+#define BURST_PARTICLES 24
+#define NUM_PARTICLE_EFFECTS 3
+
+// Positions and velocities are fixed point with 8 fractional bits, in canvas
+// pixels and canvas pixels per frame. Energy is brightness, 8.8 fixed point,
+// and goes down by decay every frame until the particle dies.
+#define FIXED_SHIFT 8
+#define FIXED_ONE (1 << FIXED_SHIFT)
+
+typedef enum {EFFECT_SPARKLE, EFFECT_RAIN, EFFECT_FIREWORKS} particleEffect;
+
+// The pool is kept as structure of arrays so the update loop streams
+// through each field. Live particles are listed densely in live, so a frame
+// only visits those, and free holds the unused slots as a stack, so spawning
+// and dying are both O(1) with no heap use.
+static int32_t posX[MAX_PARTICLES];
+static int32_t posY[MAX_PARTICLES];
+static int16_t velX[MAX_PARTICLES];
+static int16_t velY[MAX_PARTICLES];
+static uint16_t energy[MAX_PARTICLES];
+static uint16_t decay[MAX_PARTICLES];
+static uint8_t hueStep[MAX_PARTICLES];
+static uint16_t live[MAX_PARTICLES];
+static uint16_t numLive = 0;
+static uint16_t freeSlots[MAX_PARTICLES];
+static uint16_t numFree = 0;
+
+static pixelColor_t hueWheel[HUE_STEPS];
+static const char *effectNames[] = {"sparkle", "rain", "fireworks"};
+
+static uint8_t effect = EFFECT_SPARKLE;
+static uint16_t spawnRate = 40;
+static uint16_t lifeMillis = 600;
+static int8_t gravity = 4;
+static float hue = 0.6;
+static float hueSpread = 0.1;
+static float value = 0.15;
+
+static uint32_t spawnAccumulator = 0;
+static uint32_t randomState = 0;
+static uint32_t lastMillis = 0;
+static uint32_t dropped = 0;
+
+pixelColor_t leds_hsv_colour(float hue, float sat, float value);
+void leds_clear_frame(frameBuffer *frame);
+bool ledmap_loaded();
+uint16_t ledmap_query(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint8_t *leds, uint16_t maxLeds);
+
+
+static void build_hue_wheel()
+{
+    for (uint8_t i = 0; i < HUE_STEPS; i++) {
+        hueWheel[i] = leds_hsv_colour((float) i / HUE_STEPS, 1, value);
+    }
+}
+
+static int32_t random_below(uint32_t limit)
+{
+    return canvasRandom(&randomState) % limit;
+}
+
+static void spawn(int32_t x, int32_t y, int16_t vx, int16_t vy)
+{
+    if (numFree == 0) {
+        dropped++;
+        return;
+    }
+    uint16_t slot = freeSlots[--numFree];
+    live[numLive++] = slot;
+
+    posX[slot] = x;
+    posY[slot] = y;
+    velX[slot] = vx;
+    velY[slot] = vy;
+    energy[slot] = 255 << FIXED_SHIFT;
+    uint32_t frames = lifeMillis / PARTICLES_FRAME_MILLIS;
+    decay[slot] = (255 << FIXED_SHIFT) / (frames > 0 ? frames : 1);
+
+    int32_t spread = hueSpread * HUE_STEPS;
+    int32_t step = hue * HUE_STEPS + (spread > 0 ? random_below(spread * 2 + 1) - spread : 0);
+    hueStep[slot] = step & (HUE_STEPS - 1);
+}
+
+static void spawn_effect()
+{
+    const canvasConfig *canvas = getCanvas();
+    int32_t x = random_below(canvas->width << FIXED_SHIFT);
+    int32_t y = random_below(canvas->height << FIXED_SHIFT);
+
+    switch (effect) {
+        case EFFECT_SPARKLE:
+            spawn(x, y, 0, 0);
+            break;
+        case EFFECT_RAIN:
+            spawn(x, 0, 0, FIXED_ONE / 4 + random_below(FIXED_ONE / 4));
+            break;
+        case EFFECT_FIREWORKS:
+            // A burst flying out in all directions from one point
+            for (uint8_t i = 0; i < BURST_PARTICLES; i++) {
+                int16_t vx = random_below(FIXED_ONE / 2) - FIXED_ONE / 4;
+                int16_t vy = random_below(FIXED_ONE / 2) - FIXED_ONE / 4;
+                spawn(x, y, vx, vy);
+            }
+            break;
+    }
+}
+
+// Additive, so overlapping particles brighten each other
+static inline void add_colour(pixelColor_t *dest, const pixelColor_t *colour, uint8_t level)
+{
+    uint16_t r = dest->r + ((colour->r * level) >> 8);
+    uint16_t g = dest->g + ((colour->g * level) >> 8);
+    uint16_t b = dest->b + ((colour->b * level) >> 8);
+    dest->r = r > 255 ? 255 : r;
+    dest->g = g > 255 ? 255 : g;
+    dest->b = b > 255 ? 255 : b;
+}
+
+bool particles_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    uint32_t elapsedMillis = currMillis - lastMillis;
+    if (elapsedMillis < PARTICLES_FRAME_MILLIS) {
+        return false;
+    }
+    lastMillis = currMillis;
+    if (elapsedMillis > 1000) {
+        elapsedMillis = PARTICLES_FRAME_MILLIS;
+    }
+
+    // Fireworks spawn bursts, so spawnRate counts bursts for them
+    spawnAccumulator += spawnRate * elapsedMillis;
+    while (spawnAccumulator >= 1000) {
+        spawnAccumulator -= 1000;
+        spawn_effect();
+    }
+
+    const canvasConfig *canvas = getCanvas();
+    int32_t width = canvas->width << FIXED_SHIFT;
+    int32_t height = canvas->height << FIXED_SHIFT;
+
+    // With an LED map, particles light the LEDs found near them in its index
+    bool mapped = ledmap_loaded();
+    int32_t originX = canvas->x << FIXED_SHIFT;
+    int32_t originY = canvas->y << FIXED_SHIFT;
+    uint8_t leds[NUM_PIXELS];
+
+    leds_clear_frame(frame);
+
+    for (uint16_t i = 0; i < numLive;) {
+        uint16_t p = live[i];
+
+        velY[p] += gravity;
+        posX[p] += velX[p];
+        posY[p] += velY[p];
+
+        // Particles can fly up out of the canvas and fall back, but not out the sides or bottom
+        if (energy[p] <= decay[p] || posX[p] < 0 || posX[p] >= width || posY[p] >= height) {
+            freeSlots[numFree++] = p;
+            live[i] = live[--numLive];
+            continue;
+        }
+        energy[p] -= decay[p];
+        i++;
+
+        if (posY[p] < 0) {
+            continue;
+        }
+        const pixelColor_t *colour = &hueWheel[hueStep[p]];
+        uint8_t level = energy[p] >> FIXED_SHIFT;
+        if (mapped) {
+            // The LEDs up to a pixel up and left of the particle, which is
+            // the one LED it would light on the grid
+            int32_t x = posX[p] - originX;
+            int32_t y = posY[p] - originY;
+            uint16_t count = ledmap_query(x - FIXED_ONE + 1, y - FIXED_ONE + 1, x + 1, y + 1, leds, NUM_PIXELS);
+            for (uint16_t k = 0; k < count; k++) {
+                add_colour(&frame->pixels[leds[k]], colour, level);
+            }
+            continue;
+        }
+        int16_t pixel = canvasPixelIdx(posX[p] >> FIXED_SHIFT, posY[p] >> FIXED_SHIFT);
+        if (pixel < 0) {
+            continue;
+        }
+        add_colour(&frame->pixels[pixel], colour, level);
+    }
+
+    return true;
+}
+
+void particles_scene_init()
+{
+    numLive = 0;
+    numFree = MAX_PARTICLES;
+    for (uint16_t i = 0; i < MAX_PARTICLES; i++) {
+        freeSlots[i] = MAX_PARTICLES - 1 - i;
+    }
+    spawnAccumulator = 0;
+    randomState = getCanvas()->seed;
+    lastMillis = 0;
+    build_hue_wheel();
+}
+
+void particles_scene_get_config(particlesSceneConfig *config)
+{
+    config->effect = effect;
+    config->spawnRate = spawnRate;
+    config->lifeMillis = lifeMillis;
+    config->gravity = gravity;
+    config->hue = hue;
+    config->hueSpread = hueSpread;
+    config->value = value;
+}
+
+void particles_scene_set_config(const particlesSceneConfig *config)
+{
+    effect = config->effect < NUM_PARTICLE_EFFECTS ? config->effect : EFFECT_SPARKLE;
+    spawnRate = config->spawnRate;
+    lifeMillis = config->lifeMillis;
+    gravity = config->gravity;
+    hue = config->hue;
+    hueSpread = config->hueSpread;
+    value = config->value;
+    build_hue_wheel();
+}
+
+// Applies the settings present in json on top of config
+void particles_scene_parse_config(cJSON *json, particlesSceneConfig *config)
+{
+    const cJSON *effectJson = cJSON_GetObjectItem(json, "effect");
+    if (cJSON_IsString(effectJson)) {
+        for (uint8_t i = 0; i < NUM_PARTICLE_EFFECTS; i++) {
+            if (strcmp(effectJson->valuestring, effectNames[i]) == 0) {
+                config->effect = i;
+            }
+        }
+    }
+    const cJSON *spawnRateJson = cJSON_GetObjectItem(json, "spawnRate");
+    if (cJSON_IsNumber(spawnRateJson)) {
+        config->spawnRate = (uint16_t) spawnRateJson->valueint;
+    }
+    const cJSON *lifeMillisJson = cJSON_GetObjectItem(json, "lifeMillis");
+    if (cJSON_IsNumber(lifeMillisJson)) {
+        config->lifeMillis = (uint16_t) lifeMillisJson->valueint;
+    }
+    const cJSON *gravityJson = cJSON_GetObjectItem(json, "gravity");
+    if (cJSON_IsNumber(gravityJson)) {
+        config->gravity = (int8_t) gravityJson->valueint;
+    }
+    const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
+    if (cJSON_IsNumber(hueJson)) {
+        config->hue = (float) hueJson->valuedouble;
+    }
+    const cJSON *hueSpreadJson = cJSON_GetObjectItem(json, "hueSpread");
+    if (cJSON_IsNumber(hueSpreadJson)) {
+        config->hueSpread = (float) hueSpreadJson->valuedouble;
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->value = (float) valueJson->valuedouble;
+        if (config->value > HSV_MAX_VALUE) {
+            config->value = HSV_MAX_VALUE;
+        }
+    }
+}
+
+void particles_scene_print_config(const particlesSceneConfig *config, cJSON *json)
+{
+    cJSON_AddStringToObject(json, "effect", effectNames[config->effect < NUM_PARTICLE_EFFECTS ? config->effect : 0]);
+    cJSON_AddNumberToObject(json, "spawnRate", config->spawnRate);
+    cJSON_AddNumberToObject(json, "lifeMillis", config->lifeMillis);
+    cJSON_AddNumberToObject(json, "gravity", config->gravity);
+    cJSON_AddNumberToObject(json, "hue", config->hue);
+    cJSON_AddNumberToObject(json, "hueSpread", config->hueSpread);
+    cJSON_AddNumberToObject(json, "value", config->value);
+}
+
+void particles_scene_add_stats(cJSON *json)
+{
+    cJSON *particlesJson = cJSON_AddObjectToObject(json, "particles");
+    cJSON_AddNumberToObject(particlesJson, "live", numLive);
+    cJSON_AddNumberToObject(particlesJson, "dropped", dropped);
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include "frame_base.h"
+
+static const char *TAG = "scene plasma";
+
+#define PLASMA_FRAME_MILLIS 16
+#define NUM_PLASMA_PALETTES 3
+
+// The field is the sum of three sine waves, across, down and diagonally,
+// each moving at its own speed. Everything per pixel is 8 bit table lookups
+// and adds, and the result is a palette entry, so a frame costs a few
+// hundred cycles and no colour maths.
+static uint8_t sinTable[256];
+static bool sinTableReady = false;
+static uint32_t plasma_palette[PALETTE_SIZE];
+static const char *paletteNames[] = {"rainbow", "fire", "ocean"};
+
+static uint8_t scale = 24;
+static uint8_t speed = 16;
+static uint8_t paletteNum = 0;
+static float value = 0.1;
+
+static uint32_t lastMillis = 0;
+
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_set_palette_colour(uint32_t *palette, uint8_t entry, float hue, float sat, float value);
+bool ledmap_loaded();
+const ledPosition *ledmap_positions();
+
+
+static void build_palette()
+{
+    // Entry 0 stays black, so cleared frames look cleared
+    for (uint16_t i = 1; i < PALETTE_SIZE; i++) {
+        float pos = i / 256.0;
+        switch (paletteNum) {
+            case 0:
+                leds_set_palette_colour(plasma_palette, i, pos, 1, value);
+                break;
+            case 1:
+                // Red through yellow, darkest at the ends
+                leds_set_palette_colour(plasma_palette, i, 0.15 * pos, 1, value * (1 - fabsf(pos * 2 - 1)));
+                break;
+            case 2:
+                leds_set_palette_colour(plasma_palette, i, 0.5 + 0.2 * pos, 1 - 0.5 * pos, value);
+                break;
+        }
+    }
+    plasma_palette[PALETTE_BLACK] = 0;
+}
+
+// The same field, sampled at each LED's place in the map. For a map of the
+// grid this gives the same frame as the row by row loop.
+static void draw_mapped(frameBuffer *frame, const canvasConfig *canvas, uint8_t phaseX, uint8_t phaseY, uint8_t phaseDiag)
+{
+    const ledPosition *positions = ledmap_positions();
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        int32_t x = (canvas->x << 8) + positions[i].x;
+        int32_t y = (canvas->y << 8) + positions[i].y;
+        uint16_t sum = sinTable[(uint8_t) (((x * scale) >> 8) + phaseX)]
+            + sinTable[(uint8_t) (((y * scale) >> 8) + phaseY)]
+            + sinTable[(uint8_t) ((((x + y) * (scale >> 1)) >> 8) + phaseDiag)];
+        uint8_t entry = (sum * 85) >> 8;
+        frame->indices[i] = entry + (entry == PALETTE_BLACK);
+    }
+}
+
+bool plasma_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    if (currMillis - lastMillis < PLASMA_FRAME_MILLIS) {
+        return false;
+    }
+    lastMillis = currMillis;
+
+    const canvasConfig *canvas = getCanvas();
+    uint32_t phase = (currMillis * speed) >> 6;
+    uint8_t phaseX = phase;
+    uint8_t phaseY = phase * 3 >> 1;
+    uint8_t phaseDiag = phase >> 1;
+
+    if (ledmap_loaded()) {
+        draw_mapped(frame, canvas, phaseX, phaseY, phaseDiag);
+        return true;
+    }
+
+    uint8_t colWaves[PIXELS_PER_ROW];
+    for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+        colWaves[col] = sinTable[(uint8_t) ((canvas->x + col) * scale + phaseX)];
+    }
+
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        uint16_t canvasRow = canvas->y + row;
+        uint8_t rowWave = sinTable[(uint8_t) (canvasRow * scale + phaseY)];
+        uint8_t diag = (canvas->x + canvasRow) * (scale >> 1) + phaseDiag;
+        uint8_t *indices = &frame->indices[pixelIdx(0, row)];
+        int8_t step = row % 2 == 0 ? 1 : -1;
+
+        for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+            // Mean of the three waves, * 85 >> 8 being close to / 3
+            uint16_t sum = colWaves[col] + rowWave + sinTable[diag];
+            uint8_t entry = (sum * 85) >> 8;
+            *indices = entry + (entry == PALETTE_BLACK);
+            indices += step;
+            diag += scale >> 1;
+        }
+    }
+
+    return true;
+}
+
+void plasma_scene_init(frameBuffer *frame)
+{
+    if (!sinTableReady) {
+        for (uint16_t i = 0; i < 256; i++) {
+            sinTable[i] = 128 + 127 * sinf(i * 2 * M_PI / 256);
+        }
+        sinTableReady = true;
+    }
+    build_palette();
+    lastMillis = 0;
+    leds_set_palette(frame, plasma_palette);
+}
+
+void plasma_scene_get_config(plasmaSceneConfig *config)
+{
+    config->scale = scale;
+    config->speed = speed;
+    config->palette = paletteNum;
+    config->value = value;
+}
+
+void plasma_scene_set_config(const plasmaSceneConfig *config)
+{
+    scale = config->scale;
+    speed = config->speed;
+    paletteNum = config->palette < NUM_PLASMA_PALETTES ? config->palette : 0;
+    value = config->value;
+    build_palette();
+}
+
+// Applies the settings present in json on top of config
+void plasma_scene_parse_config(cJSON *json, plasmaSceneConfig *config)
+{
+    const cJSON *scaleJson = cJSON_GetObjectItem(json, "scale");
+    if (cJSON_IsNumber(scaleJson)) {
+        config->scale = (uint8_t) scaleJson->valueint;
+    }
+    const cJSON *speedJson = cJSON_GetObjectItem(json, "speed");
+    if (cJSON_IsNumber(speedJson)) {
+        config->speed = (uint8_t) speedJson->valueint;
+    }
+    const cJSON *paletteJson = cJSON_GetObjectItem(json, "palette");
+    if (cJSON_IsString(paletteJson)) {
+        for (uint8_t i = 0; i < NUM_PLASMA_PALETTES; i++) {
+            if (strcmp(paletteJson->valuestring, paletteNames[i]) == 0) {
+                config->palette = i;
+            }
+        }
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->value = (float) valueJson->valuedouble;
+        if (config->value > HSV_MAX_VALUE) {
+            config->value = HSV_MAX_VALUE;
+        }
+    }
+}
+
+void plasma_scene_print_config(const plasmaSceneConfig *config, cJSON *json)
+{
+    cJSON_AddNumberToObject(json, "scale", config->scale);
+    cJSON_AddNumberToObject(json, "speed", config->speed);
+    cJSON_AddStringToObject(json, "palette", paletteNames[config->palette < NUM_PLASMA_PALETTES ? config->palette : 0]);
+    cJSON_AddNumberToObject(json, "value", config->value);
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "frame_base.h"
+
+#define MAX_PLAYLIST_ENTRIES 16
+// Bump when playlistEntry or the scene configs change so stored playlists are discarded
+#define PLAYLIST_VERSION 2
+#define WINDOW_CHECK_MILLIS 1000
+#define MINUTES_PER_DAY (24 * 60)
+
+static const char *TAG = "light frame playlist";
+static const char *NVS_NAMESPACE = "lightframe";
+static const char *NVS_PLAYLIST_KEY = "playlist";
+
+// An entry plays for durationMillis, or for as long as its time window is open
+// when durationMillis is 0. Entries with a window are only played inside it:
+// from startMinute up to endMinute (minutes since local midnight, wrapping past
+// midnight when end is before start) on the days set in days (bit 0 Sunday).
+typedef struct playlistEntry {
+    scene entryScene;
+    bool hasConfig;
+    sceneConfig config;
+    uint32_t durationMillis;
+    uint8_t days;
+    uint16_t startMinute;
+    uint16_t endMinute;
+} playlistEntry;
+
+typedef struct storedPlaylist {
+    uint8_t version;
+    uint8_t numEntries;
+    playlistEntry entries[MAX_PLAYLIST_ENTRIES];
+} storedPlaylist;
+
+static storedPlaylist playlist;
+static int8_t currentEntry = -1;
+static uint32_t entryStartMillis = 0;
+static bool windowOpen[MAX_PLAYLIST_ENTRIES];
+static uint32_t lastWindowCheckMillis = 0;
+
+// Held while the playlist is replaced
+static SemaphoreHandle_t playlistLock = NULL;
+
+
+static bool clockSet(struct tm *now)
+{
+    time_t seconds = time(NULL);
+    localtime_r(&seconds, now);
+    // Before SNTP has synced the clock starts in 1970
+    return now->tm_year >= (2020 - 1900);
+}
+
+static void update_windows()
+{
+    struct tm now;
+    bool haveTime = clockSet(&now);
+    uint16_t minute = now.tm_hour * 60 + now.tm_min;
+
+    for (uint8_t i = 0; i < playlist.numEntries; i++) {
+        const playlistEntry *entry = &playlist.entries[i];
+        if (entry->days == 0) {
+            windowOpen[i] = true;
+        } else if (!haveTime || !(entry->days & (1 << now.tm_wday))) {
+            windowOpen[i] = false;
+        } else if (entry->startMinute <= entry->endMinute) {
+            windowOpen[i] = minute >= entry->startMinute && minute < entry->endMinute;
+        } else {
+            windowOpen[i] = minute >= entry->startMinute || minute < entry->endMinute;
+        }
+    }
+}
+
+static void start_entry(uint8_t entryIdx, uint32_t millis)
+{
+    const playlistEntry *entry = &playlist.entries[entryIdx];
+
+    entryStartMillis = millis;
+    if (entryIdx == currentEntry) {
+        return;
+    }
+    currentEntry = entryIdx;
+    if (entry->hasConfig) {
+        applySceneConfig(entry->entryScene, &entry->config);
+    }
+    selectScene(entry->entryScene);
+    ESP_LOGI(TAG, "Playing entry %d", entryIdx);
+}
+
+// Called from the render loop. Switching entries only applies the stored
+// settings, so no JSON is parsed here.
+void playlist_update(uint32_t millis)
+{
+    if (xSemaphoreTake(playlistLock, 0) != pdTRUE) {
+        return;
+    }
+    if (playlist.numEntries == 0) {
+        xSemaphoreGive(playlistLock);
+        return;
+    }
+
+    if (currentEntry < 0 || millis - lastWindowCheckMillis >= WINDOW_CHECK_MILLIS) {
+        update_windows();
+        lastWindowCheckMillis = millis;
+    }
+
+    bool advance = currentEntry < 0 || !windowOpen[currentEntry];
+    if (!advance) {
+        uint32_t durationMillis = playlist.entries[currentEntry].durationMillis;
+        advance = durationMillis > 0 && millis - entryStartMillis >= durationMillis;
+    }
+
+    if (advance) {
+        // Find the next entry that can play, coming back round to the current one last
+        uint8_t first = currentEntry < 0 ? 0 : currentEntry + 1;
+        for (uint8_t i = 0; i < playlist.numEntries; i++) {
+            uint8_t entryIdx = (first + i) % playlist.numEntries;
+            if (windowOpen[entryIdx]) {
+                start_entry(entryIdx, millis);
+                break;
+            }
+        }
+    }
+
+    xSemaphoreGive(playlistLock);
+}
+
+static bool parse_time(const cJSON *json, uint16_t *minute)
+{
+    unsigned int hours, minutes;
+    if (!cJSON_IsString(json) || sscanf(json->valuestring, "%u:%u", &hours, &minutes) != 2
+            || hours > 24 || minutes > 59 || hours * 60 + minutes > MINUTES_PER_DAY) {
+        return false;
+    }
+    *minute = hours * 60 + minutes;
+    return true;
+}
+
+static bool parse_entry(cJSON *json, playlistEntry *entry)
+{
+    memset(entry, 0, sizeof(playlistEntry));
+
+    const cJSON *sceneJson = cJSON_GetObjectItem(json, "scene");
+    if (!cJSON_IsString(sceneJson) || !sceneFromName(sceneJson->valuestring, &entry->entryScene)) {
+        return false;
+    }
+    cJSON *configJson = cJSON_GetObjectItem(json, "config");
+    if (cJSON_IsObject(configJson)) {
+        entry->hasConfig = parseSceneConfig(entry->entryScene, configJson, &entry->config);
+    }
+    const cJSON *durationJson = cJSON_GetObjectItem(json, "durationMillis");
+    if (cJSON_IsNumber(durationJson) && durationJson->valuedouble > 0) {
+        entry->durationMillis = (uint32_t) durationJson->valuedouble;
+    }
+
+    const cJSON *windowJson = cJSON_GetObjectItem(json, "window");
+    if (cJSON_IsObject(windowJson)) {
+        if (!parse_time(cJSON_GetObjectItem(windowJson, "start"), &entry->startMinute)
+                || !parse_time(cJSON_GetObjectItem(windowJson, "end"), &entry->endMinute)) {
+            return false;
+        }
+        const cJSON *daysJson = cJSON_GetObjectItem(windowJson, "days");
+        if (cJSON_IsArray(daysJson)) {
+            const cJSON *dayJson;
+            cJSON_ArrayForEach(dayJson, daysJson) {
+                if (cJSON_IsNumber(dayJson) && dayJson->valueint >= 0 && dayJson->valueint < 7) {
+                    entry->days |= 1 << dayJson->valueint;
+                }
+            }
+        } else {
+            entry->days = 0x7F;
+        }
+        if (entry->days == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void save_playlist()
+{
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error opening NVS");
+        return;
+    }
+    size_t length = offsetof(storedPlaylist, entries) + playlist.numEntries * sizeof(playlistEntry);
+    if (nvs_set_blob(handle, NVS_PLAYLIST_KEY, &playlist, length) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error saving playlist");
+    }
+    nvs_close(handle);
+}
+
+// Replaces the playlist with the entries in json and stores it. An empty list
+// stops the playlist. Returns false if any entry is not valid.
+bool playlist_set(cJSON *json)
+{
+    static storedPlaylist parsed;
+
+    const cJSON *entriesJson = cJSON_GetObjectItem(json, "entries");
+    if (!cJSON_IsArray(entriesJson) || cJSON_GetArraySize(entriesJson) > MAX_PLAYLIST_ENTRIES) {
+        return false;
+    }
+
+    parsed.version = PLAYLIST_VERSION;
+    parsed.numEntries = 0;
+    cJSON *entryJson;
+    cJSON_ArrayForEach(entryJson, entriesJson) {
+        if (!parse_entry(entryJson, &parsed.entries[parsed.numEntries])) {
+            return false;
+        }
+        parsed.numEntries++;
+    }
+
+    xSemaphoreTake(playlistLock, portMAX_DELAY);
+    memcpy(&playlist, &parsed, sizeof(playlist));
+    currentEntry = -1;
+    xSemaphoreGive(playlistLock);
+
+    save_playlist();
+    ESP_LOGI(TAG, "New playlist, %d entries", playlist.numEntries);
+    return true;
+}
+
+void playlist_initialise()
+{
+    playlistLock = xSemaphoreCreateMutex();
+
+    // Time windows are in local time
+    setenv("TZ", CONFIG_TIMEZONE, 1);
+    tzset();
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t length = sizeof(playlist);
+    if (nvs_get_blob(handle, NVS_PLAYLIST_KEY, &playlist, &length) != ESP_OK
+            || playlist.version != PLAYLIST_VERSION
+            || playlist.numEntries > MAX_PLAYLIST_ENTRIES
+            || length != offsetof(storedPlaylist, entries) + playlist.numEntries * sizeof(playlistEntry)) {
+        playlist.numEntries = 0;
+    }
+    nvs_close(handle);
+    ESP_LOGI(TAG, "Loaded playlist, %d entries", playlist.numEntries);
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include "frame_base.h"
+
+// Bump when the scene configs change so stored settings are discarded
+#define SETTINGS_VERSION 2
+// Changes are written at most this often, so dragging a slider doesn't wear the flash
+#define SAVE_DELAY_MICROS (5 * 1000 * 1000)
+
+static const char *TAG = "light frame settings";
+static const char *NVS_NAMESPACE = "lightframe";
+static const char *NVS_VERSION_KEY = "settings_ver";
+static const char *NVS_SCENE_KEY = "scene";
+static const char *NVS_CANVAS_KEY = "canvas";
+static const char *NVS_EFFECTS_KEY = "effects";
+static const char *NVS_INTERPOLATION_KEY = "interpolation";
+
+static esp_timer_handle_t saveTimer = NULL;
+static volatile bool savePending = false;
+
+// What is in NVS, so only settings that changed are written
+static int16_t savedScene = -1;
+static sceneConfig savedConfigs[NUM_SCENES];
+static canvasConfig savedCanvas;
+static effectsConfig savedEffects;
+static interpolationConfig savedInterpolation;
+
+void effects_get_config(effectsConfig *config);
+void effects_set_config(const effectsConfig *config);
+void interpolation_get_config(interpolationConfig *config);
+void interpolation_set_config(const interpolationConfig *config);
+
+
+static void config_key(scene configScene, char *key, size_t keyLength)
+{
+    snprintf(key, keyLength, "cfg_%s", sceneName(configScene));
+}
+
+static void save_settings(void *arg)
+{
+    savePending = false;
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error opening NVS");
+        return;
+    }
+
+    uint8_t written = 0;
+    scene current = getCurrentScene();
+    if (current != savedScene) {
+        nvs_set_u8(handle, NVS_SCENE_KEY, current);
+        savedScene = current;
+        written++;
+    }
+
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        sceneConfig config;
+        memset(&config, 0, sizeof(config));
+        if (!getSceneConfig(i, &config) || memcmp(&config, &savedConfigs[i], sizeof(config)) == 0) {
+            continue;
+        }
+        char key[16];
+        config_key(i, key, sizeof(key));
+        if (nvs_set_blob(handle, key, &config, sizeof(config)) == ESP_OK) {
+            savedConfigs[i] = config;
+            written++;
+        }
+    }
+
+    const canvasConfig *canvas = getCanvas();
+    if (memcmp(canvas, &savedCanvas, sizeof(savedCanvas)) != 0
+            && nvs_set_blob(handle, NVS_CANVAS_KEY, canvas, sizeof(canvasConfig)) == ESP_OK) {
+        savedCanvas = *canvas;
+        written++;
+    }
+
+    effectsConfig effects;
+    memset(&effects, 0, sizeof(effects));
+    effects_get_config(&effects);
+    if (memcmp(&effects, &savedEffects, sizeof(savedEffects)) != 0
+            && nvs_set_blob(handle, NVS_EFFECTS_KEY, &effects, sizeof(effects)) == ESP_OK) {
+        savedEffects = effects;
+        written++;
+    }
+
+    interpolationConfig interpolation;
+    interpolation_get_config(&interpolation);
+    if (memcmp(&interpolation, &savedInterpolation, sizeof(savedInterpolation)) != 0
+            && nvs_set_blob(handle, NVS_INTERPOLATION_KEY, &interpolation, sizeof(interpolation)) == ESP_OK) {
+        savedInterpolation = interpolation;
+        written++;
+    }
+
+    if (written > 0) {
+        nvs_set_u8(handle, NVS_VERSION_KEY, SETTINGS_VERSION);
+        nvs_commit(handle);
+        ESP_LOGI(TAG, "Saved %d settings", written);
+    }
+    nvs_close(handle);
+}
+
+// Marks the current scene, scene settings, canvas, effects and interpolation as
+// changed. They are written together once SAVE_DELAY_MICROS has passed since
+// the first change.
+void settings_save_later()
+{
+    if (saveTimer == NULL || savePending) {
+        return;
+    }
+    savePending = true;
+    esp_timer_start_once(saveTimer, SAVE_DELAY_MICROS);
+}
+
+void settings_initialise()
+{
+    const esp_timer_create_args_t timerArgs = {
+        .callback = save_settings,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "settings save",
+    };
+    esp_timer_create(&timerArgs, &saveTimer);
+}
+
+// Applies the stored scene and scene settings. Called by the render task
+// before its first frame, so the frame doesn't wait for the network.
+void settings_restore()
+{
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    uint8_t version = 0;
+    if (nvs_get_u8(handle, NVS_VERSION_KEY, &version) != ESP_OK || version != SETTINGS_VERSION) {
+        nvs_close(handle);
+        return;
+    }
+
+    for (uint8_t i = 0; i < NUM_SCENES; i++) {
+        sceneConfig config;
+        size_t length = sizeof(config);
+        char key[16];
+        config_key(i, key, sizeof(key));
+        memset(&config, 0, sizeof(config));
+        if (nvs_get_blob(handle, key, &config, &length) == ESP_OK && length == sizeof(config)) {
+            applySceneConfig(i, &config);
+            savedConfigs[i] = config;
+        }
+    }
+
+    canvasConfig canvas;
+    size_t canvasLength = sizeof(canvas);
+    if (nvs_get_blob(handle, NVS_CANVAS_KEY, &canvas, &canvasLength) == ESP_OK && canvasLength == sizeof(canvas)) {
+        setCanvas(&canvas);
+        savedCanvas = canvas;
+    }
+
+    effectsConfig effects;
+    size_t effectsLength = sizeof(effects);
+    if (nvs_get_blob(handle, NVS_EFFECTS_KEY, &effects, &effectsLength) == ESP_OK && effectsLength == sizeof(effects)) {
+        effects_set_config(&effects);
+        savedEffects = effects;
+    }
+
+    interpolationConfig interpolation;
+    size_t interpolationLength = sizeof(interpolation);
+    if (nvs_get_blob(handle, NVS_INTERPOLATION_KEY, &interpolation, &interpolationLength) == ESP_OK && interpolationLength == sizeof(interpolation)) {
+        interpolation_set_config(&interpolation);
+        savedInterpolation = interpolation;
+    }
+
+    uint8_t storedScene;
+    if (nvs_get_u8(handle, NVS_SCENE_KEY, &storedScene) == ESP_OK && storedScene < NUM_SCENES) {
+        setStartScene(storedScene);
+        savedScene = storedScene;
+        ESP_LOGI(TAG, "Restored scene %s", sceneName(storedScene));
+    }
+
+    nvs_close(handle);
+}
@@ -0,0 +1,90 @@
+#ifndef SHADER_FORMAT_H
+#define SHADER_FORMAT_H
+
+#include <stdint.h>
+
+// Pixel shader program format, as written by tools/shader_compile.py
+//
+// shaderHeader
+// constants    numConstants shaderConstants, loaded into registers once
+// frame        frameLength shaderInstructions, run once a frame
+// pixel        pixelLength shaderInstructions, run for each pixel
+//
+// Values are 16.16 fixed point. Before the frame instructions run the
+// registers hold the inputs below, and the rest are 0. The pixel instructions
+// then run with SHADER_REG_X and SHADER_REG_Y set to each pixel's canvas
+// position, and the outputs hold its red, green and blue, from 0 to 1.
+//
+// There are no jumps, so every program finishes. Registers past
+// SHADER_NUM_REGISTERS and unknown operations are rejected when a program is
+// loaded, and division by 0 gives 0.
+
+#define SHADER_MAGIC "LFSH"
+#define SHADER_VERSION 1
+
+#define SHADER_NUM_REGISTERS 32
+#define SHADER_MAX_CONSTANTS SHADER_NUM_REGISTERS
+#define SHADER_MAX_INSTRUCTIONS 128
+#define SHADER_NUM_PARAMS 4
+
+#define SHADER_REG_X 0
+#define SHADER_REG_Y 1
+// Seconds since the scene started
+#define SHADER_REG_T 2
+#define SHADER_REG_WIDTH 3
+#define SHADER_REG_HEIGHT 4
+// First of the SHADER_NUM_PARAMS parameters set through the scene config
+#define SHADER_REG_PARAM 5
+
+typedef enum {
+    // dst = a
+    SHADER_OP_MOV,
+    // dst = a op b
+    SHADER_OP_ADD,
+    SHADER_OP_SUB,
+    SHADER_OP_MUL,
+    SHADER_OP_DIV,
+    SHADER_OP_MOD,
+    SHADER_OP_MIN,
+    SHADER_OP_MAX,
+    // dst = 1 if a < b, otherwise 0
+    SHADER_OP_LT,
+    // dst = a if dst is not 0, otherwise b
+    SHADER_OP_SEL,
+    // dst = op(a)
+    SHADER_OP_ABS,
+    SHADER_OP_NEG,
+    SHADER_OP_FLOOR,
+    SHADER_OP_FRACT,
+    // Sine and cosine of a turns, so a period of 1
+    SHADER_OP_SIN,
+    SHADER_OP_COS,
+    SHADER_OP_SQRT,
+} shaderOp;
+#define SHADER_NUM_OPS (SHADER_OP_SQRT + 1)
+
+typedef struct __attribute__((packed)) shaderHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t numConstants;
+    uint8_t frameLength;
+    uint8_t pixelLength;
+    // Registers holding red, green and blue after the pixel instructions
+    uint8_t outputs[3];
+    uint8_t reserved;
+} shaderHeader;
+
+typedef struct __attribute__((packed)) shaderConstant {
+    uint8_t reg;
+    uint8_t reserved[3];
+    int32_t value;
+} shaderConstant;
+
+typedef struct __attribute__((packed)) shaderInstruction {
+    uint8_t op;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+} shaderInstruction;
+
+#endif /* SHADER_FORMAT_H */
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <nvs.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include "frame_base.h"
+#include "shader_format.h"
+
+static const char *TAG = "scene shader";
+static const char *NVS_NAMESPACE = "lightframe";
+static const char *NVS_SHADER_KEY = "shader";
+
+#define SIN_STEPS 1024
+#define FIXED_ONE (1 << 16)
+
+typedef struct shaderProgram {
+    shaderHeader header;
+    shaderConstant constants[SHADER_MAX_CONSTANTS];
+    shaderInstruction code[SHADER_MAX_INSTRUCTIONS];
+} shaderProgram;
+
+// Uploaded programs wait in pendingProgram until the render task picks them up
+// between frames
+static shaderProgram program;
+static bool programLoaded = false;
+static shaderProgram pendingProgram;
+static volatile bool programPending = false;
+static portMUX_TYPE programMux = portMUX_INITIALIZER_UNLOCKED;
+
+static int32_t sinTable[SIN_STEPS];
+static float params[SHADER_NUM_PARAMS] = {1, 0, 0, 0};
+static uint16_t frameMillis = 16;
+
+static uint32_t startMillis = 0;
+static bool restartPending = true;
+static uint32_t lastMillis = 0;
+static int64_t pixelMicros = 0;
+
+const ledPosition *ledmap_positions();
+
+static inline int32_t fixed_sqrt(int32_t a)
+{
+    if (a <= 0) {
+        return 0;
+    }
+    // Square root of a << 16 is the 16.16 square root of a
+    uint64_t value = (uint64_t) a << 16;
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (int32_t) root;
+}
+
+// Parameters out of the 16.16 range are clamped, as converting them would be
+// undefined
+static inline int32_t float_to_fixed(float value)
+{
+    if (value >= 32767) {
+        return INT32_MAX;
+    }
+    if (value <= -32768) {
+        return INT32_MIN;
+    }
+    return (int32_t) (value * FIXED_ONE);
+}
+
+// Runs straight through the instructions, registers being read and written in
+// place. Every operation is a few integer operations or a table lookup.
+// Uploaded programs can give any values, so results that don't fit wrap
+// around: sums and negations are worked out unsigned and products and
+// quotients in 64 bits.
+static void run(int32_t *regs, const shaderInstruction *code, uint8_t length)
+{
+    for (const shaderInstruction *ins = code; ins < code + length; ins++) {
+        int32_t a = regs[ins->a];
+        int32_t b = regs[ins->b];
+        int32_t *dst = &regs[ins->dst];
+        switch (ins->op) {
+            case SHADER_OP_MOV:
+                *dst = a;
+                break;
+            case SHADER_OP_ADD:
+                *dst = (int32_t) ((uint32_t) a + (uint32_t) b);
+                break;
+            case SHADER_OP_SUB:
+                *dst = (int32_t) ((uint32_t) a - (uint32_t) b);
+                break;
+            case SHADER_OP_MUL:
+                *dst = (int32_t) (((int64_t) a * b) >> 16);
+                break;
+            case SHADER_OP_DIV:
+                *dst = b == 0 ? 0 : (int32_t) ((int64_t) a * FIXED_ONE / b);
+                break;
+            case SHADER_OP_MOD:
+                // Takes the sign of b, like a - b * floor(a / b). Anything
+                // divided by -1 leaves nothing, and INT32_MIN % -1 would trap.
+                *dst = b == 0 || b == -1 ? 0 : a % b;
+                if (*dst != 0 && (*dst ^ b) < 0) {
+                    *dst += b;
+                }
+                break;
+            case SHADER_OP_MIN:
+                *dst = a < b ? a : b;
+                break;
+            case SHADER_OP_MAX:
+                *dst = a > b ? a : b;
+                break;
+            case SHADER_OP_LT:
+                *dst = a < b ? FIXED_ONE : 0;
+                break;
+            case SHADER_OP_SEL:
+                *dst = *dst != 0 ? a : b;
+                break;
+            case SHADER_OP_ABS:
+                *dst = a < 0 ? (int32_t) (0u - (uint32_t) a) : a;
+                break;
+            case SHADER_OP_NEG:
+                *dst = (int32_t) (0u - (uint32_t) a);
+                break;
+            case SHADER_OP_FLOOR:
+                *dst = a & ~(FIXED_ONE - 1);
+                break;
+            case SHADER_OP_FRACT:
+                *dst = a & (FIXED_ONE - 1);
+                break;
+            case SHADER_OP_SIN:
+                *dst = sinTable[(a >> 6) & (SIN_STEPS - 1)];
+                break;
+            case SHADER_OP_COS:
+                *dst = sinTable[((a >> 6) + SIN_STEPS / 4) & (SIN_STEPS - 1)];
+                break;
+            case SHADER_OP_SQRT:
+                *dst = fixed_sqrt(a);
+                break;
+        }
+    }
+}
+
+static inline uint8_t output_channel(int32_t value)
+{
+    if (value <= 0) {
+        return 0;
+    }
+    if (value >= FIXED_ONE) {
+        return 255;
+    }
+    return (value * 255) >> 16;
+}
+
+// Checks everything in data can be run safely before copying it to result
+static bool parse_program(const uint8_t *data, size_t length, shaderProgram *result)
+{
+    if (length < sizeof(shaderHeader)) {
+        return false;
+    }
+    const shaderHeader *header = (const shaderHeader *) data;
+    size_t numInstructions = header->frameLength + header->pixelLength;
+    size_t expectedLength = sizeof(shaderHeader) + header->numConstants * sizeof(shaderConstant)
+        + numInstructions * sizeof(shaderInstruction);
+    if (memcmp(header->magic, SHADER_MAGIC, sizeof(header->magic)) != 0
+            || header->version != SHADER_VERSION
+            || header->numConstants > SHADER_MAX_CONSTANTS
+            || numInstructions > SHADER_MAX_INSTRUCTIONS
+            || length != expectedLength) {
+        return false;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        if (header->outputs[i] >= SHADER_NUM_REGISTERS) {
+            return false;
+        }
+    }
+
+    const shaderConstant *constants = (const shaderConstant *) (data + sizeof(shaderHeader));
+    for (uint8_t i = 0; i < header->numConstants; i++) {
+        if (constants[i].reg >= SHADER_NUM_REGISTERS) {
+            return false;
+        }
+    }
+    const shaderInstruction *code = (const shaderInstruction *) (constants + header->numConstants);
+    for (size_t i = 0; i < numInstructions; i++) {
+        if (code[i].op >= SHADER_NUM_OPS || code[i].dst >= SHADER_NUM_REGISTERS
+                || code[i].a >= SHADER_NUM_REGISTERS || code[i].b >= SHADER_NUM_REGISTERS) {
+            return false;
+        }
+    }
+
+    memset(result, 0, sizeof(shaderProgram));
+    result->header = *header;
+    memcpy(result->constants, constants, header->numConstants * sizeof(shaderConstant));
+    memcpy(result->code, code, numInstructions * sizeof(shaderInstruction));
+    return true;
+}
+
+static void take_pending_program()
+{
+    portENTER_CRITICAL(&programMux);
+    if (programPending) {
+        program = pendingProgram;
+        programLoaded = true;
+        programPending = false;
+        restartPending = true;
+    }
+    portEXIT_CRITICAL(&programMux);
+}
+
+bool shader_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    if (currMillis - lastMillis < frameMillis) {
+        return false;
+    }
+    lastMillis = currMillis;
+
+    take_pending_program();
+    if (restartPending) {
+        startMillis = currMillis;
+        restartPending = false;
+    }
+    if (!programLoaded) {
+        return false;
+    }
+
+    const canvasConfig *canvas = getCanvas();
+    int32_t regs[SHADER_NUM_REGISTERS];
+    memset(regs, 0, sizeof(regs));
+    regs[SHADER_REG_T] = (int32_t) (((int64_t) (currMillis - startMillis) << 16) / 1000);
+    regs[SHADER_REG_WIDTH] = canvas->width << 16;
+    regs[SHADER_REG_HEIGHT] = canvas->height << 16;
+    for (uint8_t i = 0; i < SHADER_NUM_PARAMS; i++) {
+        regs[SHADER_REG_PARAM + i] = float_to_fixed(params[i]);
+    }
+    // Constants and everything that doesn't depend on the pixel are worked out
+    // once, before the pixel loop
+    for (uint8_t i = 0; i < program.header.numConstants; i++) {
+        regs[program.constants[i].reg] = program.constants[i].value;
+    }
+    run(regs, program.code, program.header.frameLength);
+
+    const shaderInstruction *pixelCode = program.code + program.header.frameLength;
+    uint8_t pixelLength = program.header.pixelLength;
+    const uint8_t *outputs = program.header.outputs;
+    int64_t loopStartMicros = esp_timer_get_time();
+    // Each LED is shaded at its place in the LED map, the grid by default
+    const ledPosition *positions = ledmap_positions();
+    for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+        // Map positions can be negative, so these are shifted unsigned
+        regs[SHADER_REG_X] = (int32_t) ((uint32_t) ((canvas->x << 8) + positions[i].x) << 8);
+        regs[SHADER_REG_Y] = (int32_t) ((uint32_t) ((canvas->y << 8) + positions[i].y) << 8);
+        run(regs, pixelCode, pixelLength);
+        pixelColor_t *pixel = &frame->pixels[i];
+        pixel->r = output_channel(regs[outputs[0]]);
+        pixel->g = output_channel(regs[outputs[1]]);
+        pixel->b = output_channel(regs[outputs[2]]);
+        pixel->w = 0;
+    }
+    pixelMicros = esp_timer_get_time() - loopStartMicros;
+
+    return true;
+}
+
+void shader_scene_init()
+{
+    lastMillis = 0;
+    restartPending = true;
+}
+
+// Loads the program stored by the last upload
+void shader_scene_initialise()
+{
+    for (uint16_t i = 0; i < SIN_STEPS; i++) {
+        sinTable[i] = (int32_t) (sinf(i * 2 * M_PI / SIN_STEPS) * FIXED_ONE);
+    }
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    static uint8_t stored[sizeof(shaderProgram)];
+    size_t length = sizeof(stored);
+    if (nvs_get_blob(handle, NVS_SHADER_KEY, stored, &length) == ESP_OK && parse_program(stored, length, &program)) {
+        programLoaded = true;
+        ESP_LOGI(TAG, "Loaded shader, %d + %d instructions", program.header.frameLength, program.header.pixelLength);
+    }
+    nvs_close(handle);
+}
+
+// Checks and stores a compiled program, which replaces the running one at the
+// next frame
+esp_err_t shader_scene_load(const char *data, size_t length)
+{
+    static shaderProgram parsed;
+    if (!parse_program((const uint8_t *) data, length, &parsed)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&programMux);
+    pendingProgram = parsed;
+    programPending = true;
+    portEXIT_CRITICAL(&programMux);
+
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "Error opening NVS");
+        return ESP_FAIL;
+    }
+    esp_err_t err = nvs_set_blob(handle, NVS_SHADER_KEY, data, length);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    ESP_LOGI(TAG, "New shader, %d + %d instructions", parsed.header.frameLength, parsed.header.pixelLength);
+    return err;
+}
+
+void shader_scene_get_config(shaderSceneConfig *config)
+{
+    memcpy(config->params, params, sizeof(params));
+    config->frameMillis = frameMillis;
+}
+
+void shader_scene_set_config(const shaderSceneConfig *config)
+{
+    memcpy(params, config->params, sizeof(params));
+    frameMillis = config->frameMillis;
+}
+
+// Applies the settings present in json on top of config
+void shader_scene_parse_config(cJSON *json, shaderSceneConfig *config)
+{
+    const cJSON *paramsJson = cJSON_GetObjectItem(json, "params");
+    if (cJSON_IsArray(paramsJson)) {
+        uint8_t i = 0;
+        const cJSON *paramJson;
+        cJSON_ArrayForEach(paramJson, paramsJson) {
+            if (i < SHADER_NUM_PARAMS && cJSON_IsNumber(paramJson)) {
+                config->params[i] = (float) paramJson->valuedouble;
+            }
+            i++;
+        }
+    }
+    const cJSON *frameMillisJson = cJSON_GetObjectItem(json, "frameMillis");
+    if (cJSON_IsNumber(frameMillisJson)) {
+        config->frameMillis = (uint16_t) frameMillisJson->valueint;
+    }
+}
+
+void shader_scene_print_config(const shaderSceneConfig *config, cJSON *json)
+{
+    cJSON *paramsJson = cJSON_AddArrayToObject(json, "params");
+    for (uint8_t i = 0; i < SHADER_NUM_PARAMS; i++) {
+        cJSON_AddItemToArray(paramsJson, cJSON_CreateNumber(config->params[i]));
+    }
+    cJSON_AddNumberToObject(json, "frameMillis", config->frameMillis);
+}
+
+// Time spent in the pixel loop of the last frame, and per pixel instruction
+void shader_scene_add_stats(cJSON *json)
+{
+    cJSON *shaderJson = cJSON_AddObjectToObject(json, "shader");
+    cJSON_AddBoolToObject(shaderJson, "loaded", programLoaded);
+    cJSON_AddNumberToObject(shaderJson, "frameInstructions", program.header.frameLength);
+    cJSON_AddNumberToObject(shaderJson, "pixelInstructions", program.header.pixelLength);
+    cJSON_AddNumberToObject(shaderJson, "pixelMicros", pixelMicros);
+    uint32_t instructions = NUM_PIXELS * program.header.pixelLength;
+    cJSON_AddNumberToObject(shaderJson, "nanosPerInstruction", instructions > 0 ? pixelMicros * 1000 / instructions : 0);
+}
@@ -1,257 +1,318 @@
 #include <stdio.h>
+#include <string.h>
 #include <esp_log.h>
-#include <esp_system.h>
 #include "frame_base.h"
 
-#define LENGTH 5
+static const char *TAG = "scene snake";
 
-typedef struct segment {
-    uint8_t col;
-    uint8_t row;
-    float hue;
-    float sat;
-    float value;
-} segment;
+#define MAX_SNAKES 256
+// Body cells shared by all the snakes, so count * length can't be more than this
+#define MAX_SNAKE_CELLS 2048
+// Canvases with more pixels than this are played without collisions
+#define MAX_GRID_CELLS (128 * 128)
+#define HUE_STEPS 64
+
+// Cells are in canvas coordinates, so snakes can move between frames
+typedef struct cell {
+    uint16_t col;
+    uint16_t row;
+} cell;
+
+// Each body is a ring of length cells starting at base in the cell pool, the
+// head at head and the tail size - 1 cells behind it. A move writes one cell,
+// so the body never has to be shifted.
+typedef struct snake {
+    uint16_t base;
+    uint16_t head;
+    // 0 until the snake has found somewhere to start
+    uint16_t size;
+    // Position on the hue wheel, the whole wheel being 65536
+    uint16_t hue;
+    uint8_t direction;
+    uint8_t movesSinceDirChange;
+} snake;
 typedef enum {UP, RIGHT, DOWN, LEFT} direction;
 
-static segment segments[LENGTH];
+// Indexed by direction
+static const int8_t dirCols[] = {0, 1, 0, -1};
+static const int8_t dirRows[] = {-1, 0, 1, 0};
+
+static snake snakes[MAX_SNAKES];
+static cell cells[MAX_SNAKE_CELLS];
+// One bit per canvas pixel, set where a snake is
+static uint32_t occupied[MAX_GRID_CELLS / 32];
+static bool gridEnabled = false;
+static pixelColor_t hueWheel[HUE_STEPS];
+
+static uint16_t numSnakes = 1;
+static uint16_t length = 5;
+static uint16_t millisBeforeMove = 100;
 static uint8_t movesBeforeDirChange = 2;
-static uint8_t millisBeforeMove = 100;
-static uint8_t movesSinceDirChange = 0;
-static direction currentDirection = DOWN;
 static hsvColour colour = {
     .hue = 0.01,
     .sat = 1,
     .value = 0.07
 };
-static hsvColourChangeConfig colourChange = {
-    .hueChange = 0.01,
-    .valueChange = 0,
-    .maxValue = HSV_MAX_VALUE
-};
+static float hueChange = 0.01;
+static uint16_t hueStep = 0;
 
+static bool restartPending = true;
 static uint32_t lastMillis = 0;
+// Every frame of the canvas makes the same turns from the same seed
+static uint32_t randomState = 0;
+
+void leds_clear_frame(frameBuffer *frame);
+pixelColor_t leds_hsv_colour(float hue, float sat, float value);
 
-void leds_set_pixel(int pixel, float hue, float sat, float value);
-void leds_clear(bool updateLeds);
-void leds_update();
 
-static direction newDirection(direction currentDir, uint8_t col, uint8_t row)
+static inline bool is_occupied(uint16_t col, uint16_t row)
 {
-    uint8_t dirChoice = esp_random() & 0x01;
-    if (currentDirection == UP) {
-        if (col == 0) {
-            if (row == 0) {
-                // Top left corner, can only go right
-                return RIGHT;
-            }
-            // Left hand column, can only go right or continue up
-            if (dirChoice == 1) {
-                return RIGHT;
-            } else {
-                return UP;
-            }
-        } else if (col == PIXELS_PER_ROW - 1) {
-            if (row == 0) {
-                // Top right corner, can only go left
-                return LEFT;
-            }
-            // Right hand column, can only go left or continue up
-            if (dirChoice == 1) {
-                return LEFT;
-            } else {
-                return UP;
-            }
-        } else {
-            if (dirChoice == 1) {
-                return LEFT;
-            } else {
-                return RIGHT;
-            }
-        }
-    } else if (currentDir == RIGHT) {
-        if (row == 0) {
-            if (col == PIXELS_PER_ROW - 1) {
-                // Top right corner, can only go down
-                return DOWN;
-            }
-            // Top row, can only go down or continue right
-            if (dirChoice == 1) {
-                return DOWN;
-            } else {
-                return RIGHT;
-            }
-        } else if (row == NUM_ROWS - 1) {
-            if (col == PIXELS_PER_ROW - 1) {
-                // Bottom right corner, can only go up
-                return UP;
-            }
-            // Bottom row, can only go up or continue right
-            if (dirChoice == 1) {
-                return UP;
-            } else {
-                return RIGHT;
-            }
-        } else {
-            if (dirChoice == 1) {
-                return UP;
-            } else {
-                return DOWN;
-            }
-        }
-    } else if (currentDir == DOWN) {
-        if (col == 0) {
-            if (row == NUM_ROWS - 1) {
-                // Bottom left corner, can only go right
-                return RIGHT;
-            }
-            // Left hand column, can only go right or continue down
-            if (dirChoice == 1) {
-                return RIGHT;
-            } else {
-                return DOWN;
-            }
-        } else if (col == PIXELS_PER_ROW - 1) {
-            if (row == NUM_ROWS - 1) {
-                // Bottom right corner, can only go left
-                return LEFT;
-            }
-            // Right hand column, can only go left or continue down
-            if (dirChoice == 1) {
-                return LEFT;
-            } else {
-                return DOWN;
-            }
-        } else {
-            if (dirChoice == 1) {
-                return RIGHT;
-            } else {
-                return LEFT;
-            }
-        }
-    } else if (currentDir == LEFT) {
-        if (row == 0) {
-            if (col == 0) {
-                // Top left corner, can only go down
-                return DOWN;
-            }
-            // Top row, can only go down or continue left
-            if (dirChoice == 1) {
-                return DOWN;
-            } else {
-                return LEFT;
-            }
-        } else if (row == NUM_ROWS - 1) {
-            if (col == 0) {
-                // Bottom left corner, can only go up
-                return UP;
-            }
-            // Bottom row, can only go up or continue left
-            if (dirChoice == 1) {
-                return UP;
-            } else {
-                return LEFT;
-            }
-        } else {
-            if (dirChoice == 1) {
-                return DOWN;
-            } else {
-                return UP;
-            }
-        }
+    if (!gridEnabled) {
+        return false;
     }
+    uint32_t bit = row * getCanvas()->width + col;
+    return occupied[bit >> 5] & (1u << (bit & 31));
+}
 
-    // Default to DOWN, this shouldn't be reached
-    return DOWN;
+static inline void set_occupied(uint16_t col, uint16_t row, bool value)
+{
+    if (!gridEnabled) {
+        return;
+    }
+    uint32_t bit = row * getCanvas()->width + col;
+    if (value) {
+        occupied[bit >> 5] |= 1u << (bit & 31);
+    } else {
+        occupied[bit >> 5] &= ~(1u << (bit & 31));
+    }
 }
 
-void snake_scene_update(uint32_t currMillis)
+static inline void draw_cell(frameBuffer *frame, const cell *position, pixelColor_t pixelColour)
 {
-    uint32_t elapsedMillis = currMillis - lastMillis;
-
-    if (elapsedMillis >= millisBeforeMove) {
-        leds_clear(false);
-
-        for (uint8_t i = 0; i < LENGTH; i++) {
-            leds_set_pixel(
-                pixelIdx(segments[i].col, segments[i].row),
-                segments[i].hue,
-                segments[i].sat,
-                segments[i].value
-            );
-        }
-        leds_update();
+    int16_t idx = canvasPixelIdx(position->col, position->row);
+    if (idx >= 0) {
+        frame->pixels[idx] = pixelColour;
+    }
+}
 
-        if (++movesSinceDirChange > movesBeforeDirChange) {
-            currentDirection = newDirection(currentDirection, segments[0].col, segments[0].row);
-            movesSinceDirChange = 0;
-        }
+static void build_hue_wheel()
+{
+    hueStep = (uint16_t) (int32_t) (hueChange * 65536);
+    for (uint8_t i = 0; i < HUE_STEPS; i++) {
+        hueWheel[i] = leds_hsv_colour((float) i / HUE_STEPS, colour.sat, colour.value);
+    }
+}
 
-        // Move tail segments to preceding segment position
-        for (uint8_t i = LENGTH - 1; i > 0; i--) {
-            segments[i].col = segments[i - 1].col;
-            segments[i].row = segments[i - 1].row;
-        }
+static void reset_snakes()
+{
+    const canvasConfig *canvas = getCanvas();
+    gridEnabled = (uint32_t) canvas->width * canvas->height <= MAX_GRID_CELLS;
+    if (!gridEnabled) {
+        ESP_LOGI(TAG, "Canvas is too large for collisions");
+    }
+    memset(occupied, 0, sizeof(occupied));
+    randomState = canvas->seed;
 
-        // Attempt to move head
-        // If move hits side find new direction
-        bool moved = false;
-        while (!moved) {
-            if (currentDirection == UP) {
-                if (--segments[0].row == 255) {
-                    segments[0].row = 0;
-                    currentDirection = newDirection(currentDirection, segments[0].col, segments[0].row);
-                    movesSinceDirChange = 0;
-                    continue;
-                }
-                moved = true;
-            } else if (currentDirection == RIGHT) {
-                if (++segments[0].col == PIXELS_PER_ROW) {
-                    segments[0].col = PIXELS_PER_ROW - 1;
-                    currentDirection = newDirection(currentDirection, segments[0].col, segments[0].row);
-                    movesSinceDirChange = 0;
-                    continue;
-                }
-                moved = true;
-            } else if (currentDirection == DOWN) {
-                if (++segments[0].row == NUM_ROWS) {
-                    segments[0].row = NUM_ROWS - 1;
-                    currentDirection = newDirection(currentDirection, segments[0].col, segments[0].row);
-                    movesSinceDirChange = 0;
-                    continue;
-                }
-                moved = true;
-            } else if (currentDirection == LEFT) {
-                if (--segments[0].col == 255) {
-                    segments[0].col = 0;
-                    currentDirection = newDirection(currentDirection, segments[0].col, segments[0].row);
-                    movesSinceDirChange = 0;
-                    continue;
-                }
-                moved = true;
-            }
-        }
+    for (uint16_t i = 0; i < numSnakes; i++) {
+        snakes[i].base = i * length;
+        snakes[i].head = 0;
+        snakes[i].size = 0;
+        snakes[i].hue = (uint16_t) ((int32_t) (colour.hue * 65536) + i * (65536 / numSnakes));
+        snakes[i].movesSinceDirChange = 0;
+    }
+}
+
+static void remove_tail(frameBuffer *frame, snake *s)
+{
+    const cell *tail = &cells[s->base + (s->head + length - s->size + 1) % length];
+    const pixelColor_t black = {0};
+    set_occupied(tail->col, tail->row, false);
+    draw_cell(frame, tail, black);
+    s->size--;
+}
+
+static void add_head(frameBuffer *frame, snake *s, uint16_t col, uint16_t row)
+{
+    if (s->size > 0) {
+        s->head = (s->head + 1) % length;
+    }
+    cell *head = &cells[s->base + s->head];
+    head->col = col;
+    head->row = row;
+    s->size++;
+    set_occupied(col, row, true);
+    draw_cell(frame, head, hueWheel[s->hue >> 10]);
+    s->hue += hueStep;
+}
+
+// Drops the snake on a random free pixel. If the pixel is taken it tries again
+// on the next move.
+static void start_snake(frameBuffer *frame, snake *s)
+{
+    const canvasConfig *canvas = getCanvas();
+    uint16_t col = canvasRandom(&randomState) % canvas->width;
+    uint16_t row = canvasRandom(&randomState) % canvas->height;
+    s->direction = canvasRandom(&randomState) % 4;
+    if (!is_occupied(col, row)) {
+        add_head(frame, s, col, row);
+    }
+}
+
+static void move_snake(frameBuffer *frame, snake *s)
+{
+    const canvasConfig *canvas = getCanvas();
+
+    if (++s->movesSinceDirChange > movesBeforeDirChange) {
+        s->direction = (s->direction + (canvasRandom(&randomState) >> 31 ? 1 : 3)) % 4;
+        s->movesSinceDirChange = 0;
+    }
 
-        for (uint8_t i = 0; i < LENGTH; i++) {
-            segments[i].hue += colourChange.hueChange;
-            segments[i].value += colourChange.valueChange;
-            if (segments[i].value > colourChange.maxValue) {
-                segments[i].value = 0;
-            }
+    // A full snake's tail moves on first, so the head can follow it round
+    bool shrunk = false;
+    if (s->size == length) {
+        remove_tail(frame, s);
+        shrunk = true;
+    }
+
+    // Carry on if possible, otherwise turn either way, and back as a last resort
+    const cell *head = &cells[s->base + s->head];
+    uint8_t turn = canvasRandom(&randomState) >> 31 ? 1 : 3;
+    uint8_t tries[] = {0, turn, 4 - turn, 2};
+    for (uint8_t i = 0; i < sizeof(tries); i++) {
+        uint8_t dir = (s->direction + tries[i]) % 4;
+        int32_t col = head->col + dirCols[dir];
+        int32_t row = head->row + dirRows[dir];
+        if (col < 0 || col >= canvas->width || row < 0 || row >= canvas->height || is_occupied(col, row)) {
+            continue;
+        }
+        if (i > 0) {
+            s->direction = dir;
+            s->movesSinceDirChange = 0;
         }
+        add_head(frame, s, col, row);
+        return;
+    }
+
+    // Boxed in, shrink until there is a way out
+    if (!shrunk && s->size > 1) {
+        remove_tail(frame, s);
+    }
+}
+
+bool snake_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    if (currMillis - lastMillis < millisBeforeMove) {
+        return false;
+    }
+    lastMillis = currMillis;
+
+    if (restartPending) {
+        leds_clear_frame(frame);
+        reset_snakes();
+        restartPending = false;
+    }
 
-        lastMillis = currMillis;
+    for (uint16_t i = 0; i < numSnakes; i++) {
+        if (snakes[i].size == 0) {
+            start_snake(frame, &snakes[i]);
+        } else {
+            move_snake(frame, &snakes[i]);
+        }
     }
+
+    return true;
 }
 
 void snake_scene_init()
 {
     lastMillis = 0;
-    for (uint8_t i = 0; i < LENGTH; i++) {
-        segments[i].col = 0;
-        segments[i].row = 0;
-        segments[i].hue = colour.hue;
-        segments[i].sat = colour.sat;
-        segments[i].value = colour.value;
+    build_hue_wheel();
+    restartPending = true;
+}
+
+void snake_scene_get_config(snakeSceneConfig *config)
+{
+    config->count = numSnakes;
+    config->length = length;
+    config->moveMillis = millisBeforeMove;
+    config->movesBeforeDirChange = movesBeforeDirChange;
+    config->colour = colour;
+    config->hueChange = hueChange;
+}
+
+void snake_scene_set_config(const snakeSceneConfig *config)
+{
+    // Snakes keep their length, so fewer fit when they are longer
+    uint16_t newLength = config->length > 0 ? config->length : 1;
+    if (newLength > MAX_SNAKE_CELLS) {
+        newLength = MAX_SNAKE_CELLS;
+    }
+    uint16_t maxCount = MAX_SNAKE_CELLS / newLength < MAX_SNAKES ? MAX_SNAKE_CELLS / newLength : MAX_SNAKES;
+    uint16_t newCount = config->count > 0 ? config->count : 1;
+    if (newCount > maxCount) {
+        newCount = maxCount;
+    }
+
+    if (newLength != length || newCount != numSnakes) {
+        length = newLength;
+        numSnakes = newCount;
+        restartPending = true;
+    }
+    millisBeforeMove = config->moveMillis;
+    movesBeforeDirChange = config->movesBeforeDirChange;
+    colour = config->colour;
+    hueChange = config->hueChange;
+    build_hue_wheel();
+}
+
+// Applies the settings present in json on top of config
+void snake_scene_parse_config(cJSON *json, snakeSceneConfig *config)
+{
+    const cJSON *countJson = cJSON_GetObjectItem(json, "count");
+    if (cJSON_IsNumber(countJson) && countJson->valueint > 0) {
+        config->count = (uint16_t) countJson->valueint;
+    }
+    const cJSON *lengthJson = cJSON_GetObjectItem(json, "length");
+    if (cJSON_IsNumber(lengthJson) && lengthJson->valueint > 0) {
+        config->length = (uint16_t) lengthJson->valueint;
+    }
+    const cJSON *moveMillisJson = cJSON_GetObjectItem(json, "moveMillis");
+    if (cJSON_IsNumber(moveMillisJson)) {
+        config->moveMillis = (uint16_t) moveMillisJson->valueint;
     }
-}
\ No newline at end of file
+    const cJSON *movesBeforeDirChangeJson = cJSON_GetObjectItem(json, "movesBeforeDirChange");
+    if (cJSON_IsNumber(movesBeforeDirChangeJson)) {
+        config->movesBeforeDirChange = (uint8_t) movesBeforeDirChangeJson->valueint;
+    }
+    const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
+    if (cJSON_IsNumber(hueJson)) {
+        config->colour.hue = (float) hueJson->valuedouble;
+    }
+    const cJSON *satJson = cJSON_GetObjectItem(json, "sat");
+    if (cJSON_IsNumber(satJson)) {
+        config->colour.sat = (float) satJson->valuedouble;
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->colour.value = (float) valueJson->valuedouble;
+        if (config->colour.value > HSV_MAX_VALUE) {
+            config->colour.value = HSV_MAX_VALUE;
+        }
+    }
+    const cJSON *hueChangeJson = cJSON_GetObjectItem(json, "hueChange");
+    if (cJSON_IsNumber(hueChangeJson)) {
+        config->hueChange = (float) hueChangeJson->valuedouble;
+    }
+}
+
+void snake_scene_print_config(const snakeSceneConfig *config, cJSON *json)
+{
+    cJSON_AddNumberToObject(json, "count", config->count);
+    cJSON_AddNumberToObject(json, "length", config->length);
+    cJSON_AddNumberToObject(json, "moveMillis", config->moveMillis);
+    cJSON_AddNumberToObject(json, "movesBeforeDirChange", config->movesBeforeDirChange);
+    cJSON_AddNumberToObject(json, "hue", config->colour.hue);
+    cJSON_AddNumberToObject(json, "sat", config->colour.sat);
+    cJSON_AddNumberToObject(json, "value", config->colour.value);
+    cJSON_AddNumberToObject(json, "hueChange", config->hueChange);
+}
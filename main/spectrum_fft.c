@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <math.h>
+#include "spectrum_fft.h"
+
+// Q15 tables, built once. twiddleCos[k] - i twiddleSin[k] is e^(-2 pi i k / FFT_SIZE).
+static int16_t window[FFT_SIZE];
+static int16_t twiddleCos[FFT_HALF];
+static int16_t twiddleSin[FFT_HALF];
+static uint8_t bitReverse[FFT_HALF];
+static bool tablesBuilt = false;
+
+static int32_t re[FFT_HALF];
+static int32_t im[FFT_HALF];
+
+void spectrum_fft_build_tables()
+{
+    if (tablesBuilt) {
+        return;
+    }
+    for (uint16_t i = 0; i < FFT_SIZE; i++) {
+        // Hann window
+        window[i] = (int16_t) lroundf(32767 * 0.5f * (1 - cosf(2 * M_PI * i / FFT_SIZE)));
+    }
+    for (uint16_t k = 0; k < FFT_HALF; k++) {
+        twiddleCos[k] = (int16_t) lroundf(32767 * cosf(2 * M_PI * k / FFT_SIZE));
+        twiddleSin[k] = (int16_t) lroundf(32767 * sinf(2 * M_PI * k / FFT_SIZE));
+        uint8_t reversed = 0;
+        for (uint16_t bit = 1; bit < FFT_HALF; bit <<= 1) {
+            reversed = (reversed << 1) | ((k & bit) ? 1 : 0);
+        }
+        bitReverse[k] = reversed;
+    }
+    tablesBuilt = true;
+}
+
+static inline uint16_t log2_sixteenths(uint64_t value)
+{
+    if (value == 0) {
+        return 0;
+    }
+    uint8_t msb = 63 - __builtin_clzll(value);
+    uint8_t fraction = msb >= 4 ? (value >> (msb - 4)) & 15 : (value << (4 - msb)) & 15;
+    return msb * 16 + fraction;
+}
+
+// Fills binLog, FFT_HALF entries, with log2 of the power of each bin of the
+// FFT_SIZE samples, in 1/16ths. The even and odd samples are packed into the
+// real and imaginary parts of a half size complex transform, which is split
+// into the real transform's bins afterwards. Every stage halves the values,
+// so they stay in range whatever the input.
+void spectrum_fft_transform(const int16_t *samples, uint16_t *binLog)
+{
+    for (uint16_t i = 0; i < FFT_HALF; i++) {
+        uint8_t j = bitReverse[i];
+        re[j] = (samples[2 * i] * window[2 * i]) >> 15;
+        im[j] = (samples[2 * i + 1] * window[2 * i + 1]) >> 15;
+    }
+
+    // Radix-2 decimation in time. The half size transform's twiddles are
+    // every other entry of the full size table.
+    for (uint16_t half = 1, step = FFT_HALF; half < FFT_HALF; half <<= 1, step >>= 1) {
+        for (uint16_t start = 0; start < FFT_HALF; start += 2 * half) {
+            for (uint16_t k = 0; k < half; k++) {
+                int32_t c = twiddleCos[k * step];
+                int32_t s = twiddleSin[k * step];
+                uint16_t a = start + k;
+                uint16_t b = a + half;
+                int32_t tr = ((int64_t) re[b] * c + (int64_t) im[b] * s) >> 15;
+                int32_t ti = ((int64_t) im[b] * c - (int64_t) re[b] * s) >> 15;
+                re[b] = (re[a] - tr) >> 1;
+                im[b] = (im[a] - ti) >> 1;
+                re[a] = (re[a] + tr) >> 1;
+                im[a] = (im[a] + ti) >> 1;
+            }
+        }
+    }
+
+    // Bin k of the real transform is E + W^k O, E and O being the transforms
+    // of the even and odd samples, recovered from bins k and FFT_HALF - k
+    binLog[0] = 0;
+    for (uint16_t k = 1; k < FFT_HALF; k++) {
+        int32_t evenRe = (re[k] + re[FFT_HALF - k]) >> 1;
+        int32_t evenIm = (im[k] - im[FFT_HALF - k]) >> 1;
+        int32_t oddRe = (im[k] + im[FFT_HALF - k]) >> 1;
+        int32_t oddIm = (re[FFT_HALF - k] - re[k]) >> 1;
+        int32_t c = twiddleCos[k];
+        int32_t s = twiddleSin[k];
+        int64_t binRe = evenRe + (((int64_t) oddRe * c + (int64_t) oddIm * s) >> 15);
+        int64_t binIm = evenIm + (((int64_t) oddIm * c - (int64_t) oddRe * s) >> 15);
+        binLog[k] = log2_sixteenths(binRe * binRe + binIm * binIm);
+    }
+}
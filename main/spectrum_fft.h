@@ -0,0 +1,19 @@
+#ifndef SPECTRUM_FFT_H
+#define SPECTRUM_FFT_H
+
+#include <stdint.h>
+
+// The spectrum scene's fixed point FFT, apart from the audio and drawing code
+// so tools/host can run the same transform on a PC
+
+// Real samples in each transform, done as a complex transform of half the size
+#define FFT_SIZE 512
+#define FFT_HALF (FFT_SIZE / 2)
+// log2 of the power of a full scale sine in its bin after the transform's
+// scaling, in 1/16ths. Levels are measured down from this.
+#define FULL_SCALE_LOG (28 * 16)
+
+void spectrum_fft_build_tables();
+void spectrum_fft_transform(const int16_t *samples, uint16_t *binLog);
+
+#endif /* SPECTRUM_FFT_H */
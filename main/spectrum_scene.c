@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <lwip/sockets.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "frame_base.h"
+#include "audio_format.h"
+#include "spectrum_fft.h"
+
+static const char *TAG = "scene spectrum";
+
+#define SPECTRUM_FRAME_MILLIS 16
+// Samples kept from the stream, more than a transform so packets can arrive
+// while the last one is read
+#define RING_SIZE 2048
+#define MAX_COLUMNS 128
+
+static TaskHandle_t receiveTask = NULL;
+static int sock = -1;
+static uint8_t packet[AUDIO_MAX_PACKET_BYTES];
+
+// Mono samples from the stream. written counts every sample ever received, so
+// the newest is at (written - 1) % RING_SIZE.
+static int16_t ring[RING_SIZE];
+static volatile uint32_t written = 0;
+static volatile uint16_t streamRate = 0;
+static portMUX_TYPE ringMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool receiving = false;
+static uint32_t lastSeq = 0;
+static uint32_t packets = 0;
+static uint32_t lostPackets = 0;
+
+static int16_t samples[FFT_SIZE];
+// log2 of each bin's power in 1/16ths
+static uint16_t binLog[FFT_HALF];
+
+// Bins firstBin[col] up to lastBin[col] make up each column of the canvas
+static uint16_t numColumns = 0;
+static uint8_t firstBin[MAX_COLUMNS];
+static uint8_t lastBin[MAX_COLUMNS];
+static uint16_t bandsRate = 0;
+// Heights in 1/256ths of a row
+static int32_t bars[MAX_COLUMNS];
+static int32_t peaks[MAX_COLUMNS];
+static uint32_t peakMillis[MAX_COLUMNS];
+static pixelColor_t rowColours[NUM_ROWS];
+static pixelColor_t peakColour;
+
+static uint16_t minHz = 60;
+static uint16_t maxHz = 12000;
+static uint8_t rangeDb = 48;
+static uint16_t fallMillis = 40;
+static uint16_t peakHoldMillis = 500;
+static float hue = 0.35;
+static float hueSpread = 0.35;
+static float value = 0.1;
+
+static uint32_t lastMillis = 0;
+static uint32_t lastWritten = 0;
+static uint32_t fftMicros = 0;
+static uint32_t maxFftMicros = 0;
+
+pixelColor_t leds_hsv_colour(float hue, float sat, float value);
+void leds_clear_frame(frameBuffer *frame);
+
+
+static void packet_received(int length)
+{
+    const audioPacketHeader *header = (const audioPacketHeader *) packet;
+    if (length < (int) sizeof(audioPacketHeader)
+            || memcmp(header->magic, AUDIO_MAGIC, sizeof(header->magic)) != 0
+            || header->version != AUDIO_VERSION
+            || header->channels == 0 || header->channels > AUDIO_MAX_CHANNELS
+            || header->sampleRate == 0
+            || length < (int) (sizeof(audioPacketHeader) + header->sampleCount * header->channels * 2)) {
+        return;
+    }
+
+    if (receiving && header->seq != lastSeq + 1) {
+        int32_t gap = (int32_t) (header->seq - lastSeq - 1);
+        if (gap > 0) {
+            lostPackets += gap;
+        }
+    }
+    receiving = true;
+    lastSeq = header->seq;
+    packets++;
+
+    // Channels are mixed to mono as they are copied in
+    const int16_t *pcm = (const int16_t *) (packet + sizeof(audioPacketHeader));
+    portENTER_CRITICAL(&ringMux);
+    uint32_t position = written;
+    for (uint16_t i = 0; i < header->sampleCount; i++) {
+        int32_t sum = 0;
+        for (uint8_t channel = 0; channel < header->channels; channel++) {
+            sum += *pcm++;
+        }
+        ring[position++ % RING_SIZE] = header->channels == 2 ? sum >> 1 : sum;
+    }
+    written = position;
+    streamRate = header->sampleRate;
+    portEXIT_CRITICAL(&ringMux);
+}
+
+static void receive_task(void *pvParameters)
+{
+    for (;;) {
+        int length = recv(sock, packet, sizeof(packet), 0);
+        if (length > 0) {
+            packet_received(length);
+        }
+    }
+}
+
+// Called once the network is up
+void spectrum_start()
+{
+    if (receiveTask != NULL) {
+        return;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGI(TAG, "Error creating socket");
+        return;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CONFIG_AUDIO_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ESP_LOGI(TAG, "Error binding socket");
+        closesocket(sock);
+        sock = -1;
+        return;
+    }
+
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    inet_aton(CONFIG_STREAM_MULTICAST_ADDR, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        ESP_LOGI(TAG, "Error joining multicast group %s", CONFIG_STREAM_MULTICAST_ADDR);
+        closesocket(sock);
+        sock = -1;
+        return;
+    }
+
+    xTaskCreate(receive_task, "audio_task", 2048, NULL, 5, &receiveTask);
+    ESP_LOGI(TAG, "Receiving audio from %s:%d", CONFIG_STREAM_MULTICAST_ADDR, CONFIG_AUDIO_PORT);
+}
+
+// Spaces the columns evenly in pitch from minHz to maxHz, each at least one bin wide
+static void build_bands(uint16_t rate)
+{
+    const canvasConfig *canvas = getCanvas();
+    numColumns = canvas->width < MAX_COLUMNS ? canvas->width : MAX_COLUMNS;
+    bandsRate = rate;
+    float ratio = (float) maxHz / minHz;
+    for (uint16_t col = 0; col < numColumns; col++) {
+        float lowHz = minHz * powf(ratio, (float) col / numColumns);
+        float highHz = minHz * powf(ratio, (float) (col + 1) / numColumns);
+        int32_t low = lroundf(lowHz * FFT_SIZE / rate);
+        int32_t high = lroundf(highHz * FFT_SIZE / rate) - 1;
+        if (low < 1) {
+            low = 1;
+        }
+        if (low > FFT_HALF - 1) {
+            low = FFT_HALF - 1;
+        }
+        if (high < low) {
+            high = low;
+        }
+        if (high > FFT_HALF - 1) {
+            high = FFT_HALF - 1;
+        }
+        firstBin[col] = low;
+        lastBin[col] = high;
+    }
+}
+
+static void build_colours()
+{
+    const canvasConfig *canvas = getCanvas();
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        // Rows count up from the bottom of the canvas
+        int32_t height = canvas->height - 1 - (canvas->y + row);
+        float position = canvas->height > 1 ? (float) height / (canvas->height - 1) : 0;
+        rowColours[row] = leds_hsv_colour(hue + hueSpread * position, 1, value);
+    }
+    peakColour = leds_hsv_colour(0, 0, value);
+}
+
+// Height of a column's loudest bin in 1/256ths of a row, full scale being the
+// canvas height and rangeDb below it empty
+static int32_t column_level(uint16_t col)
+{
+    uint16_t loudest = 0;
+    for (uint16_t bin = firstBin[col]; bin <= lastBin[col]; bin++) {
+        if (binLog[bin] > loudest) {
+            loudest = binLog[bin];
+        }
+    }
+    int32_t full = getCanvas()->height * 256;
+    // Each 1/16th of log2 power is 3.01 / 16 dB
+    int32_t below = FULL_SCALE_LOG - loudest;
+    int32_t level = full - (int32_t) ((int64_t) below * 301 * full / (1600 * rangeDb));
+    if (level < 0) {
+        return 0;
+    }
+    return level > full ? full : level;
+}
+
+// Bars jump up to the level and fall at one row per fallMillis. Peaks stay
+// at the highest the bar has been for peakHoldMillis, then fall the same way.
+static void update_bars(uint32_t currMillis, uint32_t elapsed, bool sound)
+{
+    int32_t fall = elapsed * 256 / (fallMillis > 0 ? fallMillis : 1);
+    for (uint16_t col = 0; col < numColumns; col++) {
+        int32_t level = sound ? column_level(col) : 0;
+        if (level > bars[col] - fall) {
+            bars[col] = level;
+        } else {
+            bars[col] -= fall;
+        }
+        if (bars[col] >= peaks[col]) {
+            peaks[col] = bars[col];
+            peakMillis[col] = currMillis;
+        } else if (currMillis - peakMillis[col] > peakHoldMillis) {
+            peaks[col] -= fall;
+            if (peaks[col] < bars[col]) {
+                peaks[col] = bars[col];
+            }
+        }
+    }
+}
+
+static void draw(frameBuffer *frame)
+{
+    const canvasConfig *canvas = getCanvas();
+    leds_clear_frame(frame);
+    for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+        uint16_t column = canvas->x + col;
+        if (column >= numColumns) {
+            break;
+        }
+        for (uint8_t row = 0; row < NUM_ROWS; row++) {
+            int32_t height = canvas->height - 1 - (canvas->y + row);
+            if (height < 0) {
+                break;
+            }
+            uint8_t idx = pixelIdx(col, row);
+            // Lit once the bar covers half the pixel
+            if (bars[column] >= height * 256 + 128) {
+                frame->pixels[idx] = rowColours[row];
+            }
+            if (peaks[column] >= 128 && (peaks[column] - 128) >> 8 == height) {
+                frame->pixels[idx] = peakColour;
+            }
+        }
+    }
+}
+
+bool spectrum_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    uint32_t elapsed = currMillis - lastMillis;
+    if (elapsed < SPECTRUM_FRAME_MILLIS) {
+        return false;
+    }
+    lastMillis = currMillis;
+
+    // The newest FFT_SIZE samples, if any came since the last frame
+    portENTER_CRITICAL(&ringMux);
+    uint32_t end = written;
+    uint16_t rate = streamRate;
+    bool sound = end != lastWritten && end >= FFT_SIZE;
+    if (sound) {
+        for (uint16_t i = 0; i < FFT_SIZE; i++) {
+            samples[i] = ring[(end - FFT_SIZE + i) % RING_SIZE];
+        }
+    }
+    portEXIT_CRITICAL(&ringMux);
+    lastWritten = end;
+
+    if (sound) {
+        if (rate != bandsRate) {
+            build_bands(rate);
+        }
+        int64_t startMicros = esp_timer_get_time();
+        spectrum_fft_transform(samples, binLog);
+        fftMicros = esp_timer_get_time() - startMicros;
+        if (fftMicros > maxFftMicros) {
+            maxFftMicros = fftMicros;
+        }
+    }
+
+    update_bars(currMillis, elapsed, sound);
+    draw(frame);
+    return true;
+}
+
+void spectrum_scene_init()
+{
+    spectrum_fft_build_tables();
+    // Bands are built for the canvas once samples arrive
+    bandsRate = 0;
+    numColumns = 0;
+    memset(bars, 0, sizeof(bars));
+    memset(peaks, 0, sizeof(peaks));
+    build_colours();
+    lastMillis = 0;
+}
+
+void spectrum_scene_get_config(spectrumSceneConfig *config)
+{
+    config->minHz = minHz;
+    config->maxHz = maxHz;
+    config->rangeDb = rangeDb;
+    config->fallMillis = fallMillis;
+    config->peakHoldMillis = peakHoldMillis;
+    config->hue = hue;
+    config->hueSpread = hueSpread;
+    config->value = value;
+}
+
+void spectrum_scene_set_config(const spectrumSceneConfig *config)
+{
+    minHz = config->minHz > 0 ? config->minHz : 1;
+    maxHz = config->maxHz > minHz ? config->maxHz : minHz + 1;
+    rangeDb = config->rangeDb > 0 ? config->rangeDb : 1;
+    fallMillis = config->fallMillis;
+    peakHoldMillis = config->peakHoldMillis;
+    hue = config->hue;
+    hueSpread = config->hueSpread;
+    value = config->value;
+    build_colours();
+    bandsRate = 0;
+}
+
+// Applies the settings present in json on top of config
+void spectrum_scene_parse_config(cJSON *json, spectrumSceneConfig *config)
+{
+    const cJSON *minHzJson = cJSON_GetObjectItem(json, "minHz");
+    if (cJSON_IsNumber(minHzJson) && minHzJson->valueint > 0) {
+        config->minHz = (uint16_t) minHzJson->valueint;
+    }
+    const cJSON *maxHzJson = cJSON_GetObjectItem(json, "maxHz");
+    if (cJSON_IsNumber(maxHzJson) && maxHzJson->valueint > 0) {
+        config->maxHz = (uint16_t) maxHzJson->valueint;
+    }
+    const cJSON *rangeDbJson = cJSON_GetObjectItem(json, "rangeDb");
+    if (cJSON_IsNumber(rangeDbJson) && rangeDbJson->valueint > 0) {
+        config->rangeDb = (uint8_t) rangeDbJson->valueint;
+    }
+    const cJSON *fallMillisJson = cJSON_GetObjectItem(json, "fallMillis");
+    if (cJSON_IsNumber(fallMillisJson)) {
+        config->fallMillis = (uint16_t) fallMillisJson->valueint;
+    }
+    const cJSON *peakHoldMillisJson = cJSON_GetObjectItem(json, "peakHoldMillis");
+    if (cJSON_IsNumber(peakHoldMillisJson)) {
+        config->peakHoldMillis = (uint16_t) peakHoldMillisJson->valueint;
+    }
+    const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
+    if (cJSON_IsNumber(hueJson)) {
+        config->hue = (float) hueJson->valuedouble;
+    }
+    const cJSON *hueSpreadJson = cJSON_GetObjectItem(json, "hueSpread");
+    if (cJSON_IsNumber(hueSpreadJson)) {
+        config->hueSpread = (float) hueSpreadJson->valuedouble;
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->value = (float) valueJson->valuedouble;
+        if (config->value > HSV_MAX_VALUE) {
+            config->value = HSV_MAX_VALUE;
+        }
+    }
+}
+
+void spectrum_scene_print_config(const spectrumSceneConfig *config, cJSON *json)
+{
+    cJSON_AddNumberToObject(json, "minHz", config->minHz);
+    cJSON_AddNumberToObject(json, "maxHz", config->maxHz);
+    cJSON_AddNumberToObject(json, "rangeDb", config->rangeDb);
+    cJSON_AddNumberToObject(json, "fallMillis", config->fallMillis);
+    cJSON_AddNumberToObject(json, "peakHoldMillis", config->peakHoldMillis);
+    cJSON_AddNumberToObject(json, "hue", config->hue);
+    cJSON_AddNumberToObject(json, "hueSpread", config->hueSpread);
+    cJSON_AddNumberToObject(json, "value", config->value);
+}
+
+void spectrum_scene_add_stats(cJSON *json)
+{
+    cJSON *spectrumJson = cJSON_AddObjectToObject(json, "spectrum");
+    cJSON_AddNumberToObject(spectrumJson, "packets", packets);
+    cJSON_AddNumberToObject(spectrumJson, "lostPackets", lostPackets);
+    cJSON_AddNumberToObject(spectrumJson, "sampleRate", streamRate);
+    cJSON_AddNumberToObject(spectrumJson, "fftMicros", fftMicros);
+    cJSON_AddNumberToObject(spectrumJson, "maxFftMicros", maxFftMicros);
+}
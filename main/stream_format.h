@@ -0,0 +1,35 @@
+#ifndef STREAM_FORMAT_H
+#define STREAM_FORMAT_H
+
+#include <stdint.h>
+
+// Multicast frame stream format, as sent by tools/stream_send.py
+//
+// Each UDP datagram is a streamChunkHeader followed by pixelCount RGB
+// triplets. A frame of the whole canvas is split into chunkCount chunks, each
+// holding a run of pixels numbered row by row from the top left of the canvas.
+// Every chunk of a frame has the same frameSeq, which goes up by one each frame,
+// and the same frameMillis, the sender's clock when the frame was made, used
+// to space out interpolated frames evenly however the chunks arrive.
+
+#define STREAM_MAGIC "LFST"
+#define STREAM_VERSION 2
+
+// Chunks are kept under a typical MTU so they are never fragmented
+#define STREAM_MAX_CHUNK_BYTES 1472
+
+typedef struct __attribute__((packed)) streamChunkHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t chunk;
+    uint16_t chunkCount;
+    uint16_t canvasWidth;
+    uint16_t canvasHeight;
+    uint16_t pixelCount;
+    uint32_t frameSeq;
+    uint32_t firstPixel;
+    uint32_t frameMillis;
+} streamChunkHeader;
+
+#endif /* STREAM_FORMAT_H */
@@ -0,0 +1,240 @@
+#include <string.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include <lwip/sockets.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "frame_base.h"
+#include "stream_format.h"
+
+static const char *TAG = "scene stream";
+
+// A chunk at most this far behind the current frame is late, further behind
+// and the sender has restarted its count, so the stream starts over from it
+#define MAX_LATE_FRAMES 16
+// Likewise for a chunk made this long before the current frame, which means
+// a new sender clock even if the count happens to be close
+#define MAX_LATE_MILLIS 1000
+
+static TaskHandle_t receiveTask = NULL;
+static int sock = -1;
+
+// Chunks are decoded straight out of the receive buffer into received, so
+// only this frame's pixels are ever copied. Pixels of chunks that don't
+// arrive keep their value from the previous frame.
+static uint8_t packet[STREAM_MAX_CHUNK_BYTES];
+static pixelColor_t received[NUM_PIXELS];
+static pixelColor_t latest[NUM_PIXELS];
+// Sender and local times of the latest frame
+static uint32_t latestFrameMillis = 0;
+static uint32_t latestArrivalMillis = 0;
+static volatile bool frameReady = false;
+static portMUX_TYPE latestMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool receiving = false;
+static uint32_t currentSeq = 0;
+static uint32_t currentFrameMillis = 0;
+static uint16_t currentChunks = 0;
+static uint16_t currentChunkCount = 0;
+
+static uint32_t frames = 0;
+static uint32_t chunks = 0;
+static uint32_t missedChunks = 0;
+static uint32_t lateChunks = 0;
+static uint32_t restarts = 0;
+
+extern volatile uint32_t millis;
+
+bool interpolation_enabled(interpolateSource source);
+void interpolation_reset(interpolateSource source);
+void interpolation_push(interpolateSource source, const pixelColor_t *pixels, uint32_t sourceMillis, uint32_t localMillis);
+bool interpolation_render(interpolateSource source, pixelColor_t *out, uint32_t localMillis);
+
+
+static void publish_frame()
+{
+    portENTER_CRITICAL(&latestMux);
+    memcpy(latest, received, sizeof(latest));
+    latestFrameMillis = currentFrameMillis;
+    latestArrivalMillis = millis;
+    frameReady = true;
+    portEXIT_CRITICAL(&latestMux);
+
+    frames++;
+    if (currentChunks < currentChunkCount) {
+        missedChunks += currentChunkCount - currentChunks;
+    }
+}
+
+// Copies the parts of the chunk's pixel run on this panel, a row at a time
+static void extract_region(const streamChunkHeader *header, const uint8_t *data)
+{
+    const canvasConfig *canvas = getCanvas();
+    uint32_t chunkStart = header->firstPixel;
+    uint32_t chunkEnd = chunkStart + header->pixelCount;
+
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        uint32_t canvasRow = canvas->y + row;
+        if (canvasRow >= header->canvasHeight) {
+            break;
+        }
+        uint32_t rowStart = canvasRow * header->canvasWidth + canvas->x;
+        uint32_t rowEnd = canvasRow * header->canvasWidth + header->canvasWidth;
+        if (rowEnd > rowStart + PIXELS_PER_ROW) {
+            rowEnd = rowStart + PIXELS_PER_ROW;
+        }
+        if (rowEnd <= chunkStart) {
+            continue;
+        }
+        if (rowStart >= chunkEnd) {
+            break;
+        }
+
+        uint32_t start = rowStart > chunkStart ? rowStart : chunkStart;
+        uint32_t end = rowEnd < chunkEnd ? rowEnd : chunkEnd;
+        const uint8_t *pixel = data + (start - chunkStart) * 3;
+        for (uint32_t i = start; i < end; i++) {
+            pixelColor_t *dest = &received[pixelIdx(i - rowStart, row)];
+            dest->r = pixel[0];
+            dest->g = pixel[1];
+            dest->b = pixel[2];
+            dest->w = 0;
+            pixel += 3;
+        }
+    }
+}
+
+static void chunk_received(int length)
+{
+    const streamChunkHeader *header = (const streamChunkHeader *) packet;
+    if (length < (int) sizeof(streamChunkHeader)
+            || memcmp(header->magic, STREAM_MAGIC, sizeof(header->magic)) != 0
+            || header->version != STREAM_VERSION
+            || length < (int) (sizeof(streamChunkHeader) + header->pixelCount * 3)) {
+        return;
+    }
+
+    if (receiving) {
+        int32_t seqChange = (int32_t) (header->frameSeq - currentSeq);
+        int32_t millisChange = (int32_t) (header->frameMillis - currentFrameMillis);
+        if (seqChange < -MAX_LATE_FRAMES || millisChange < -MAX_LATE_MILLIS) {
+            // A new stream, drop what arrived of the old one's last frame
+            restarts++;
+            currentChunks = 0;
+        } else if (seqChange < 0) {
+            // Part of a frame that has already been shown
+            lateChunks++;
+            return;
+        } else if (seqChange > 0) {
+            // The rest of the last frame isn't coming, show what arrived
+            if (currentChunks < currentChunkCount) {
+                publish_frame();
+            }
+            currentChunks = 0;
+        }
+    }
+    receiving = true;
+    currentSeq = header->frameSeq;
+    currentFrameMillis = header->frameMillis;
+    currentChunkCount = header->chunkCount;
+    chunks++;
+
+    extract_region(header, packet + sizeof(streamChunkHeader));
+
+    if (++currentChunks == currentChunkCount) {
+        publish_frame();
+    }
+}
+
+static void receive_task(void *pvParameters)
+{
+    for (;;) {
+        int length = recv(sock, packet, sizeof(packet), 0);
+        if (length > 0) {
+            chunk_received(length);
+        }
+    }
+}
+
+// Called once the network is up
+void stream_start()
+{
+    if (receiveTask != NULL) {
+        return;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGI(TAG, "Error creating socket");
+        return;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CONFIG_STREAM_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ESP_LOGI(TAG, "Error binding socket");
+        closesocket(sock);
+        sock = -1;
+        return;
+    }
+
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    inet_aton(CONFIG_STREAM_MULTICAST_ADDR, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        ESP_LOGI(TAG, "Error joining multicast group %s", CONFIG_STREAM_MULTICAST_ADDR);
+        closesocket(sock);
+        sock = -1;
+        return;
+    }
+
+    xTaskCreate(receive_task, "stream_task", 2048, NULL, 5, &receiveTask);
+    ESP_LOGI(TAG, "Receiving stream from %s:%d", CONFIG_STREAM_MULTICAST_ADDR, CONFIG_STREAM_PORT);
+}
+
+bool stream_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    static pixelColor_t pixels[NUM_PIXELS];
+
+    if (!interpolation_enabled(INTERPOLATE_STREAM)) {
+        if (!frameReady) {
+            return false;
+        }
+        portENTER_CRITICAL(&latestMux);
+        memcpy(frame->pixels, latest, sizeof(latest));
+        frameReady = false;
+        portEXIT_CRITICAL(&latestMux);
+        return true;
+    }
+
+    if (frameReady) {
+        portENTER_CRITICAL(&latestMux);
+        memcpy(pixels, latest, sizeof(latest));
+        uint32_t frameMillis = latestFrameMillis;
+        uint32_t arrivalMillis = latestArrivalMillis;
+        frameReady = false;
+        portEXIT_CRITICAL(&latestMux);
+        interpolation_push(INTERPOLATE_STREAM, pixels, frameMillis, arrivalMillis);
+    }
+    return interpolation_render(INTERPOLATE_STREAM, frame->pixels, currMillis);
+}
+
+void stream_scene_init()
+{
+    frameReady = false;
+    interpolation_reset(INTERPOLATE_STREAM);
+}
+
+void stream_add_stats(cJSON *json)
+{
+    cJSON *streamJson = cJSON_AddObjectToObject(json, "stream");
+    cJSON_AddNumberToObject(streamJson, "frames", frames);
+    cJSON_AddNumberToObject(streamJson, "chunks", chunks);
+    cJSON_AddNumberToObject(streamJson, "missedChunks", missedChunks);
+    cJSON_AddNumberToObject(streamJson, "lateChunks", lateChunks);
+    cJSON_AddNumberToObject(streamJson, "restarts", restarts);
+}
@@ -0,0 +1,215 @@
+#include <string.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include <lwip/sockets.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "frame_base.h"
+#include "sync_filter.h"
+
+// Frames mounted together share the leader's millis. The leader broadcasts its
+// clock every SYNC_INTERVAL_MILLIS, and each follower runs the packets through
+// sync_filter.c to keep its own clock in step.
+
+#define SYNC_MAGIC "LFTS"
+#define SYNC_VERSION 1
+#define SYNC_INTERVAL_MILLIS 1000
+#define SYNC_SCENE_REPEATS 3
+
+typedef enum {SYNC_TIME, SYNC_SCENE} syncPacketType;
+
+typedef struct __attribute__((packed)) syncPacket {
+    char magic[4];
+    uint8_t version;
+    uint8_t type;
+    uint8_t packetScene;
+    uint8_t reserved;
+    uint16_t seq;
+    uint16_t reserved2;
+    uint32_t leaderMillis;
+    // For SYNC_SCENE, the leader's millis to start the scene at
+    uint32_t startMillis;
+} syncPacket;
+
+static const char *TAG = "light frame sync";
+
+extern volatile uint32_t millis;
+
+#if defined(CONFIG_SYNC_ROLE_LEADER) || defined(CONFIG_SYNC_ROLE_FOLLOWER)
+static TaskHandle_t syncTask = NULL;
+static int sock = -1;
+#endif
+
+#ifdef CONFIG_SYNC_ROLE_LEADER
+static uint16_t sceneSeq = 0;
+#endif
+
+#ifdef CONFIG_SYNC_ROLE_FOLLOWER
+static syncFilter filter;
+static uint32_t packets = 0;
+#endif
+
+void millis_step(int32_t adjust);
+void millis_slew(int32_t adjust);
+void millis_set_rate(int32_t alarmTicks);
+
+
+#ifdef CONFIG_SYNC_ROLE_LEADER
+static void send_packet(syncPacket *packet)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CONFIG_SYNC_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+
+    memcpy(packet->magic, SYNC_MAGIC, sizeof(packet->magic));
+    packet->version = SYNC_VERSION;
+    packet->leaderMillis = millis;
+    sendto(sock, packet, sizeof(syncPacket), 0, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static void leader_task(void *pvParameters)
+{
+    syncPacket packet;
+    for (;;) {
+        memset(&packet, 0, sizeof(packet));
+        packet.type = SYNC_TIME;
+        send_packet(&packet);
+        vTaskDelay(pdMS_TO_TICKS(SYNC_INTERVAL_MILLIS));
+    }
+}
+#endif
+
+#ifdef CONFIG_SYNC_ROLE_FOLLOWER
+static void time_received(const syncPacket *packet)
+{
+    bool wasSynced = filter.synced;
+    syncCorrection correction;
+    sync_filter_time(&filter, packet->leaderMillis, millis, &correction);
+
+    if (correction.action == SYNC_STEP) {
+        millis_step(correction.offset);
+        if (wasSynced) {
+            ESP_LOGI(TAG, "Clock stepped by %d ms", correction.offset);
+        } else {
+            ESP_LOGI(TAG, "Synced to leader, offset %d ms", correction.offset);
+        }
+    } else if (correction.action == SYNC_SLEW) {
+        millis_slew(correction.offset);
+    }
+    if (correction.setRate) {
+        millis_set_rate(filter.rateTicks);
+    }
+}
+
+static void scene_received(const syncPacket *packet)
+{
+    uint32_t startMillis;
+    if (packet->packetScene < NUM_SCENES
+            && sync_filter_scene(&filter, packet->seq, packet->startMillis, millis, &startMillis)) {
+        scheduleScene(packet->packetScene, startMillis);
+    }
+}
+
+static void follower_task(void *pvParameters)
+{
+    syncPacket packet;
+    for (;;) {
+        int received = recv(sock, &packet, sizeof(packet), 0);
+        if (received != sizeof(packet) || memcmp(packet.magic, SYNC_MAGIC, sizeof(packet.magic)) != 0
+                || packet.version != SYNC_VERSION) {
+            continue;
+        }
+        packets++;
+        switch (packet.type)
+        {
+            case SYNC_TIME:
+                time_received(&packet);
+                break;
+            case SYNC_SCENE:
+                scene_received(&packet);
+                break;
+            default:
+                break;
+        }
+    }
+}
+#endif
+
+// Returns the millis a newly selected scene should start at. The leader
+// announces the scene to the followers so they all start it together.
+uint32_t sync_scene_start(scene startScene)
+{
+#ifdef CONFIG_SYNC_ROLE_LEADER
+    if (sock >= 0) {
+        syncPacket packet;
+        memset(&packet, 0, sizeof(packet));
+        packet.type = SYNC_SCENE;
+        packet.packetScene = startScene;
+        packet.seq = ++sceneSeq;
+        packet.startMillis = millis + SYNC_SCENE_LEAD_MILLIS;
+        for (uint8_t i = 0; i < SYNC_SCENE_REPEATS; i++) {
+            send_packet(&packet);
+        }
+        return packet.startMillis;
+    }
+#endif
+    return millis;
+}
+
+// Called once the network is up
+void sync_start()
+{
+#if defined(CONFIG_SYNC_ROLE_LEADER) || defined(CONFIG_SYNC_ROLE_FOLLOWER)
+    if (syncTask != NULL) {
+        return;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGI(TAG, "Error creating socket");
+        return;
+    }
+
+#ifdef CONFIG_SYNC_ROLE_LEADER
+    int broadcast = 1;
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+    xTaskCreate(leader_task, "sync_task", 2048, NULL, 5, &syncTask);
+    ESP_LOGI(TAG, "Sync leader on port %d", CONFIG_SYNC_PORT);
+#else
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CONFIG_SYNC_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        ESP_LOGI(TAG, "Error binding socket");
+        closesocket(sock);
+        sock = -1;
+        return;
+    }
+    sync_filter_init(&filter);
+    xTaskCreate(follower_task, "sync_task", 2048, NULL, 5, &syncTask);
+    ESP_LOGI(TAG, "Sync follower on port %d", CONFIG_SYNC_PORT);
+#endif
+#endif
+}
+
+void sync_add_stats(cJSON *json)
+{
+    cJSON *syncJson = cJSON_AddObjectToObject(json, "sync");
+    cJSON_AddNumberToObject(syncJson, "millis", millis);
+#if defined(CONFIG_SYNC_ROLE_LEADER)
+    cJSON_AddStringToObject(syncJson, "role", "leader");
+#elif defined(CONFIG_SYNC_ROLE_FOLLOWER)
+    cJSON_AddStringToObject(syncJson, "role", "follower");
+    cJSON_AddBoolToObject(syncJson, "synced", filter.synced);
+    cJSON_AddNumberToObject(syncJson, "offsetMillis", filter.lastOffset);
+    cJSON_AddNumberToObject(syncJson, "rateAdjustPpm", -filter.rateTicks * PPM_PER_RATE_TICK);
+    cJSON_AddNumberToObject(syncJson, "steps", filter.steps);
+    cJSON_AddNumberToObject(syncJson, "packets", packets);
+#else
+    cJSON_AddStringToObject(syncJson, "role", "none");
+#endif
+}
@@ -0,0 +1,81 @@
+#include <string.h>
+#include "sync_filter.h"
+
+void sync_filter_init(syncFilter *filter)
+{
+    memset(filter, 0, sizeof(syncFilter));
+    filter->lastSceneSeq = -1;
+}
+
+static void window_complete(syncFilter *filter, uint32_t leaderMillis, syncCorrection *result)
+{
+    int32_t offset = filter->windowMaxOffset;
+    uint32_t windowMillis = leaderMillis - filter->windowStartMillis;
+    filter->lastOffset = offset;
+    result->offset = offset;
+
+    if (offset > SYNC_STEP_MILLIS || offset < -SYNC_STEP_MILLIS) {
+        result->action = SYNC_STEP;
+        filter->steps++;
+    } else {
+        result->action = SYNC_SLEW;
+        // Offset left over after a window is drift, so trim the rate by a
+        // quarter of it to settle without overshooting
+        if (windowMillis > 0) {
+            int32_t driftPpm = (int64_t) offset * 1000000 / windowMillis;
+            filter->rateTicks -= driftPpm / (4 * PPM_PER_RATE_TICK);
+            if (filter->rateTicks > MAX_RATE_TICKS) {
+                filter->rateTicks = MAX_RATE_TICKS;
+            } else if (filter->rateTicks < -MAX_RATE_TICKS) {
+                filter->rateTicks = -MAX_RATE_TICKS;
+            }
+            result->setRate = true;
+        }
+    }
+
+    filter->windowSamples = 0;
+    filter->windowStartMillis = leaderMillis;
+}
+
+// Takes a time packet sent at the leader's leaderMillis and received at the
+// local localMillis
+void sync_filter_time(syncFilter *filter, uint32_t leaderMillis, uint32_t localMillis, syncCorrection *result)
+{
+    int32_t offset = (int32_t) (leaderMillis - localMillis);
+    memset(result, 0, sizeof(syncCorrection));
+
+    if (!filter->synced) {
+        result->action = SYNC_STEP;
+        result->offset = offset;
+        filter->synced = true;
+        filter->windowSamples = 0;
+        filter->windowStartMillis = leaderMillis;
+        return;
+    }
+
+    // Network delay only ever makes the leader look behind
+    if (filter->windowSamples == 0 || offset > filter->windowMaxOffset) {
+        filter->windowMaxOffset = offset;
+    }
+    if (++filter->windowSamples == SYNC_WINDOW_SAMPLES) {
+        window_complete(filter, leaderMillis, result);
+    }
+}
+
+// Takes a scene packet, repeated by the leader, and gives the local millis to
+// start the scene at. Returns false for repeats already taken.
+bool sync_filter_scene(syncFilter *filter, uint16_t seq, uint32_t startMillis, uint32_t localMillis, uint32_t *result)
+{
+    if (seq == filter->lastSceneSeq) {
+        return false;
+    }
+    filter->lastSceneSeq = seq;
+
+    // Without a synced clock, or if the start has gone, change straight away
+    int32_t untilStart = (int32_t) (startMillis - localMillis);
+    if (!filter->synced || untilStart < 0 || untilStart > SYNC_SCENE_LEAD_MILLIS * 2) {
+        startMillis = localMillis;
+    }
+    *result = startMillis;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef SYNC_FILTER_H
+#define SYNC_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// How a follower keeps its clock to the leader's, apart from the network and
+// timer code so tools/host can run the same filter on a PC
+//
+// A follower takes the largest offset seen over a window of samples as the
+// one least delayed by the network, slews its clock by that offset, and trims
+// its timer period to cancel out the drift.
+
+#define SYNC_WINDOW_SAMPLES 16
+// Offsets bigger than this are stepped rather than slewed
+#define SYNC_STEP_MILLIS 50
+// Scene changes are announced this far ahead so every frame has them in time
+#define SYNC_SCENE_LEAD_MILLIS 200
+// Each timer alarm tick is 1 / 40000 of a millisecond, 25 ppm
+#define PPM_PER_RATE_TICK 25
+#define MAX_RATE_TICKS 400
+
+typedef struct syncFilter {
+    bool synced;
+    uint8_t windowSamples;
+    int32_t windowMaxOffset;
+    uint32_t windowStartMillis;
+    int32_t lastOffset;
+    int32_t rateTicks;
+    uint32_t steps;
+    int32_t lastSceneSeq;
+} syncFilter;
+
+typedef enum {SYNC_KEEP, SYNC_STEP, SYNC_SLEW} syncAction;
+
+// What to do to the local clock after a time packet
+typedef struct syncCorrection {
+    syncAction action;
+    int32_t offset;
+    // Set when the timer period is to be trimmed to the filter's rateTicks
+    bool setRate;
+} syncCorrection;
+
+void sync_filter_init(syncFilter *filter);
+void sync_filter_time(syncFilter *filter, uint32_t leaderMillis, uint32_t localMillis, syncCorrection *result);
+bool sync_filter_scene(syncFilter *filter, uint16_t seq, uint32_t startMillis, uint32_t localMillis, uint32_t *result);
+
+#endif /* SYNC_FILTER_H */
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <esp_log.h>
+#include <cJSON.h>
+#include "frame_base.h"
+
+static const char *TAG = "scene text";
+
+#define GLYPH_WIDTH 3
+#define GLYPH_HEIGHT 5
+// Glyph plus one blank column between characters
+#define GLYPH_ADVANCE (GLYPH_WIDTH + 1)
+#define FIRST_GLYPH ' '
+#define LAST_GLYPH '_'
+#define MAX_TEXT_COLUMNS (MAX_TEXT_LENGTH * GLYPH_ADVANCE)
+#define TEXT_COLOUR 1
+
+// 3 x 5 font for ' ' to '_', lower case is shown as upper case. Each glyph is
+// three columns of five bits, left column in the low bits and the top row as
+// bit 0 of each column.
+static const uint16_t font[LAST_GLYPH - FIRST_GLYPH + 1] = {
+    0x0000, 0x02e0, 0x0c03, 0x7d5f, 0x27f2, 0x4c99, 0x6aaa, 0x0060, //  !"#$%&'
+    0x45c0, 0x01d1, 0x288a, 0x11c4, 0x0110, 0x1084, 0x0200, 0x0c98, // ()*+,-./
+    0x7e3f, 0x43f2, 0x4ab9, 0x2ab1, 0x7c87, 0x26b7, 0x76be, 0x0fa1, // 01234567
+    0x7ebf, 0x3eb7, 0x0140, 0x0150, 0x4544, 0x294a, 0x1151, 0x0aa1, // 89:;<=>?
+    0x5aae, 0x78be, 0x2abf, 0x462e, 0x3a3f, 0x56bf, 0x14bf, 0x762e, // @ABCDEFG
+    0x7c9f, 0x47f1, 0x3e08, 0x6c9f, 0x421f, 0x7cdf, 0x783f, 0x3a2e, // HIJKLMNO
+    0x08bf, 0x7b2e, 0x68bf, 0x26b2, 0x07e1, 0x7e1f, 0x1f07, 0x7d9f, // PQRSTUVW
+    0x6c9b, 0x0f83, 0x4eb9, 0x023f, 0x6083, 0x7e20, 0x0822, 0x4210, // XYZ[\]^_
+};
+
+// The text is rasterised once, when it is set, into one byte per column with
+// bit 0 as the top row. Scrolling only moves the window of columns shown.
+static uint8_t columns[MAX_TEXT_COLUMNS];
+static uint16_t numColumns = 0;
+static uint32_t text_palette[PALETTE_SIZE];
+
+static char text[MAX_TEXT_LENGTH + 1] = "HELLO";
+static uint16_t columnMillis = 80;
+static uint8_t scale = 1;
+static float hue = 0.0;
+static float value = 0.1;
+
+static uint32_t lastShift = UINT32_MAX;
+
+void leds_set_palette(frameBuffer *frame, const uint32_t *palette);
+void leds_set_palette_colour(uint32_t *palette, uint8_t entry, float hue, float sat, float value);
+void leds_clear_frame(frameBuffer *frame);
+bool ledmap_loaded();
+const ledPosition *ledmap_positions();
+
+
+static void build_columns()
+{
+    uint16_t count = 0;
+    for (const char *c = text; *c != '\0'; c++) {
+        char glyph = toupper((unsigned char) *c);
+        if (glyph < FIRST_GLYPH || glyph > LAST_GLYPH) {
+            glyph = '?';
+        }
+        uint16_t bits = font[glyph - FIRST_GLYPH];
+        for (uint8_t i = 0; i < GLYPH_WIDTH; i++) {
+            columns[count++] = (bits >> (i * GLYPH_HEIGHT)) & ((1 << GLYPH_HEIGHT) - 1);
+        }
+        columns[count++] = 0;
+    }
+    // No gap is needed after the last character
+    numColumns = count > 0 ? count - 1 : 0;
+}
+
+bool text_scene_update(frameBuffer *frame, uint32_t currMillis)
+{
+    const canvasConfig *canvas = getCanvas();
+    uint32_t textWidth = numColumns * scale;
+    // The text enters from the right of the canvas and leaves off the left
+    uint32_t shift = (currMillis / columnMillis) % (textWidth + canvas->width);
+    if (shift == lastShift) {
+        return false;
+    }
+    lastShift = shift;
+
+    // Centred on taller canvases, cut off at the bottom on shorter ones
+    int32_t top = canvas->height > GLYPH_HEIGHT * scale ? (canvas->height - GLYPH_HEIGHT * scale) / 2 : 0;
+
+    if (ledmap_loaded()) {
+        // Each LED shows the text pixel nearest to it in the map
+        const ledPosition *positions = ledmap_positions();
+        for (uint16_t i = 0; i < NUM_PIXELS; i++) {
+            int32_t glyphRow = canvas->y + ((positions[i].y + 128) >> 8) - top;
+            int32_t textCol = canvas->x + ((positions[i].x + 128) >> 8) + (int32_t) shift - canvas->width;
+            bool lit = glyphRow >= 0 && glyphRow < GLYPH_HEIGHT * scale && textCol >= 0 && textCol < (int32_t) textWidth
+                && (columns[textCol / scale] >> (glyphRow / scale)) & 1;
+            frame->indices[i] = lit ? TEXT_COLOUR : PALETTE_BLACK;
+        }
+        return true;
+    }
+
+    uint8_t rowBits[NUM_ROWS];
+    for (uint8_t row = 0; row < NUM_ROWS; row++) {
+        int32_t glyphRow = (int32_t) (canvas->y + row) - top;
+        rowBits[row] = glyphRow >= 0 && glyphRow < GLYPH_HEIGHT * scale ? 1 << (glyphRow / scale) : 0;
+    }
+
+    for (uint8_t col = 0; col < PIXELS_PER_ROW; col++) {
+        int32_t textCol = (int32_t) (canvas->x + col + shift) - canvas->width;
+        uint8_t bits = textCol >= 0 && textCol < (int32_t) textWidth ? columns[textCol / scale] : 0;
+        for (uint8_t row = 0; row < NUM_ROWS; row++) {
+            frame->indices[pixelIdx(col, row)] = bits & rowBits[row] ? TEXT_COLOUR : PALETTE_BLACK;
+        }
+    }
+
+    return true;
+}
+
+void text_scene_init(frameBuffer *frame)
+{
+    leds_set_palette_colour(text_palette, TEXT_COLOUR, hue, 1, value);
+    build_columns();
+    leds_clear_frame(frame);
+    leds_set_palette(frame, text_palette);
+    lastShift = UINT32_MAX;
+}
+
+void text_scene_get_config(textSceneConfig *config)
+{
+    strcpy(config->text, text);
+    config->columnMillis = columnMillis;
+    config->scale = scale;
+    config->hue = hue;
+    config->value = value;
+}
+
+void text_scene_set_config(const textSceneConfig *config)
+{
+    strncpy(text, config->text, MAX_TEXT_LENGTH);
+    text[MAX_TEXT_LENGTH] = '\0';
+    columnMillis = config->columnMillis > 0 ? config->columnMillis : 1;
+    scale = config->scale > 0 ? config->scale : 1;
+    hue = config->hue;
+    value = config->value;
+    leds_set_palette_colour(text_palette, TEXT_COLOUR, hue, 1, value);
+    build_columns();
+    lastShift = UINT32_MAX;
+}
+
+// Applies the settings present in json on top of config. Text longer than
+// MAX_TEXT_LENGTH is cut short.
+void text_scene_parse_config(cJSON *json, textSceneConfig *config)
+{
+    const cJSON *textJson = cJSON_GetObjectItem(json, "text");
+    if (cJSON_IsString(textJson)) {
+        strncpy(config->text, textJson->valuestring, MAX_TEXT_LENGTH);
+        config->text[MAX_TEXT_LENGTH] = '\0';
+    }
+    const cJSON *columnMillisJson = cJSON_GetObjectItem(json, "columnMillis");
+    if (cJSON_IsNumber(columnMillisJson) && columnMillisJson->valueint > 0) {
+        config->columnMillis = (uint16_t) columnMillisJson->valueint;
+    }
+    const cJSON *scaleJson = cJSON_GetObjectItem(json, "scale");
+    if (cJSON_IsNumber(scaleJson) && scaleJson->valueint > 0) {
+        config->scale = (uint8_t) scaleJson->valueint;
+    }
+    const cJSON *hueJson = cJSON_GetObjectItem(json, "hue");
+    if (cJSON_IsNumber(hueJson)) {
+        config->hue = (float) hueJson->valuedouble;
+    }
+    const cJSON *valueJson = cJSON_GetObjectItem(json, "value");
+    if (cJSON_IsNumber(valueJson)) {
+        config->value = (float) valueJson->valuedouble;
+        if (config->value > HSV_MAX_VALUE) {
+            config->value = HSV_MAX_VALUE;
+        }
+    }
+}
+
+void text_scene_print_config(const textSceneConfig *config, cJSON *json)
+{
+    cJSON_AddStringToObject(json, "text", config->text);
+    cJSON_AddNumberToObject(json, "columnMillis", config->columnMillis);
+    cJSON_AddNumberToObject(json, "scale", config->scale);
+    cJSON_AddNumberToObject(json, "hue", config->hue);
+    cJSON_AddNumberToObject(json, "value", config->value);
+}
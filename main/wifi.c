@@ -1,6 +1,8 @@
 #include <esp_http_server.h>
 #include <esp_log.h>
 #include <esp_wifi.h>
+#include <lwip/apps/sntp.h>
+#include "frame_base.h"
 
 static const char *TAG = "light frame wifi";
 
@@ -8,6 +10,9 @@ static httpd_handle_t server = NULL;
 
 httpd_handle_t http_start_webserver(void);
 void http_stop_webserver(httpd_handle_t server);
+void sync_start();
+void stream_start();
+void spectrum_start();
 
 static esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
 {
@@ -20,10 +25,30 @@ static esp_err_t wifi_event_handler(void *ctx, system_event_t *event)
         ESP_LOGI(TAG, "SYSTEM_EVENT_STA_GOT_IP");
         ESP_LOGI(TAG, "Got IP: '%s'",
                 ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
+        boot_trace_mark(BOOT_WIFI);
+
+        /* Start syncing the clock for playlist time windows */
+        if (!sntp_enabled()) {
+            sntp_setoperatingmode(SNTP_OPMODE_POLL);
+            sntp_setservername(0, CONFIG_SNTP_SERVER);
+            sntp_init();
+        }
+
+        /* Start keeping time with the other frames */
+        sync_start();
+
+        /* Start listening for streamed frames */
+        stream_start();
+
+        /* Start listening for audio */
+        spectrum_start();
 
         /* Start the web server */
         if (server == NULL) {
             server = http_start_webserver();
+            if (server != NULL) {
+                boot_trace_mark(BOOT_HTTPD);
+            }
         }
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
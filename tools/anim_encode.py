@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Encode raw RGB frames into the light frame animation format.
+
+The input is a file of concatenated frames, each width * height RGB triplets
+row by row from the top left. Each frame is stored as whichever of a key or
+delta frame, raw or run length encoded, is smallest. If there are no more than
+256 colours the animation is stored with a palette.
+
+Usage:
+    anim_encode.py --width 8 --height 6 --fps 30 frames.rgb anim.bin
+    curl --data-binary @anim.bin http://<frame>/animation
+
+See main/anim_format.h for the format.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LFAN"
+VERSION = 1
+FRAME_KEY = 0
+FRAME_DELTA = 1
+ENCODING_RAW = 0
+ENCODING_RLE = 1
+MAX_RUN = 255
+
+
+def encode_records(pixels, previous, rle):
+    """Encodes a frame as (skip, count, data) records.
+
+    Pixels equal to those in previous are skipped. For a key frame previous
+    is all black, matching the frame being cleared on the device.
+    """
+    out = bytearray()
+    i = 0
+    skip = 0
+    while i < len(pixels):
+        if pixels[i] == previous[i]:
+            skip += 1
+            i += 1
+            continue
+        while skip > MAX_RUN:
+            out += bytes([MAX_RUN, 0])
+            skip -= MAX_RUN
+
+        if rle:
+            count = 1
+            while (i + count < len(pixels) and count < MAX_RUN
+                    and pixels[i + count] == pixels[i]):
+                count += 1
+            out += bytes([skip, count]) + pixels[i]
+        else:
+            count = 1
+            while (i + count < len(pixels) and count < MAX_RUN
+                    and pixels[i + count] != previous[i + count]):
+                count += 1
+            out += bytes([skip, count]) + b"".join(pixels[i:i + count])
+        i += count
+        skip = 0
+    return bytes(out)
+
+
+def encode_frame(pixels, previous, black):
+    candidates = []
+    for encoding, rle in ((ENCODING_RAW, False), (ENCODING_RLE, True)):
+        candidates.append((FRAME_KEY, encoding, encode_records(pixels, black, rle)))
+        if previous is not None:
+            candidates.append((FRAME_DELTA, encoding, encode_records(pixels, previous, rle)))
+    frame_type, encoding, records = min(candidates, key=lambda c: len(c[2]))
+    return struct.pack("<BBHI", frame_type, encoding, 0, len(records)) + records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--width", type=int, required=True)
+    parser.add_argument("--height", type=int, required=True)
+    parser.add_argument("--fps", type=float, default=30)
+    parser.add_argument("--no-palette", action="store_true",
+                        help="store RGB pixels even if a palette would fit")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        raw = f.read()
+    frame_size = args.width * args.height * 3
+    if len(raw) == 0 or len(raw) % frame_size != 0:
+        sys.exit("input is not a whole number of %d x %d frames" % (args.width, args.height))
+    frames = [[raw[offset + p:offset + p + 3] for p in range(0, frame_size, 3)]
+              for offset in range(0, len(raw), frame_size)]
+    if len(frames) > 0xFFFF:
+        sys.exit("too many frames")
+
+    # Black is always palette entry 0 so cleared pixels need no entry
+    black_rgb = bytes(3)
+    colours = sorted({p for frame in frames for p in frame} - {black_rgb})
+    use_palette = not args.no_palette and len(colours) < 256
+    palette = b""
+    if use_palette:
+        entries = {black_rgb: 0}
+        for colour in colours:
+            entries[colour] = len(entries)
+        frames = [[bytes([entries[p]]) for p in frame] for frame in frames]
+        palette = b"".join(sorted(entries, key=entries.get))
+        black = [bytes(1)] * (args.width * args.height)
+    else:
+        black = [black_rgb] * (args.width * args.height)
+
+    data = bytearray(palette)
+    previous = None
+    for frame in frames:
+        data += encode_frame(frame, previous, black)
+        previous = frame
+
+    frame_millis = max(1, round(1000 / args.fps))
+    header = struct.pack("<4sBBHHHHHI", MAGIC, VERSION, 0, args.width, args.height,
+                         len(frames), frame_millis, len(palette) // 3, len(data))
+    with open(args.output, "wb") as f:
+        f.write(header + data)
+
+    print("%d frames, %s, %d bytes (%.1f%% of raw)" % (
+        len(frames), "%d colour palette" % (len(palette) // 3) if use_palette else "RGB",
+        len(header) + len(data), 100.0 * (len(header) + len(data)) / len(raw)))
+
+
+if __name__ == "__main__":
+    main()
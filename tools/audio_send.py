@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Multicast PCM audio to light frames running the spectrum scene.
+
+Sends a 16 bit WAV file, mono or stereo, in real time as sequence numbered
+UDP packets, or a built in test sweep if no file is given.
+
+Usage:
+    audio_send.py music.wav
+    audio_send.py --loop music.wav
+    audio_send.py --seconds 10
+
+To try it out without a frame, run spectrum_sim.py alongside.
+
+See main/audio_format.h for the format.
+"""
+
+import argparse
+import math
+import socket
+import struct
+import time
+import wave
+
+from stream_send import DEFAULT_GROUP
+
+MAGIC = b"LFAU"
+VERSION = 1
+HEADER = struct.Struct("<4sBBHHHI")
+DEFAULT_PORT = 4212
+# Samples of each channel per packet, a few milliseconds each
+PACKET_SAMPLES = 256
+
+
+def wav_blocks(path, loop):
+    """Yields (channels, rate, pcm bytes) blocks of PACKET_SAMPLES samples."""
+    while True:
+        with wave.open(path, "rb") as wav:
+            if wav.getsampwidth() != 2 or wav.getnchannels() > 2:
+                raise SystemExit("%s is not 16 bit mono or stereo" % path)
+            channels = wav.getnchannels()
+            rate = wav.getframerate()
+            if rate > 65535:
+                raise SystemExit("%s has a sample rate over 65535" % path)
+            while True:
+                pcm = wav.readframes(PACKET_SAMPLES)
+                if not pcm:
+                    break
+                yield channels, rate, pcm
+        if not loop:
+            return
+
+
+def sweep_blocks(rate=44100):
+    """A tone sweeping from 50 Hz to 10 kHz and back every 8 seconds."""
+    phase = 0.0
+    sample = 0
+    while True:
+        pcm = bytearray()
+        for _ in range(PACKET_SAMPLES):
+            t = sample / rate
+            position = 1 - abs((t / 4) % 2 - 1)
+            freq = 50 * (10000 / 50) ** position
+            phase += 2 * math.pi * freq / rate
+            pcm += struct.pack("<h", int(12000 * math.sin(phase)))
+            sample += 1
+        yield 1, rate, bytes(pcm)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="16 bit WAV file, otherwise a test sweep")
+    parser.add_argument("--loop", action="store_true", help="play the file over and over")
+    parser.add_argument("--group", default=DEFAULT_GROUP)
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--ttl", type=int, default=1)
+    parser.add_argument("--seconds", type=float, help="stop after this long")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, args.ttl)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+
+    blocks = wav_blocks(args.input, args.loop) if args.input else sweep_blocks()
+    start = time.monotonic()
+    sent_seconds = 0.0
+    seq = 0
+    for channels, rate, pcm in blocks:
+        if args.seconds is not None and sent_seconds >= args.seconds:
+            break
+        count = len(pcm) // (2 * channels)
+        header = HEADER.pack(MAGIC, VERSION, channels, rate, count, 0, seq & 0xFFFFFFFF)
+        sock.sendto(header + pcm, (args.group, args.port))
+        seq += 1
+
+        # Keep to real time, so the frames see the audio as it plays
+        sent_seconds += count / rate
+        delay = start + sent_seconds - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    elapsed = time.monotonic() - start
+    print("sent %d packets, %.1f s of audio in %.1f s" % (seq, sent_seconds, elapsed))
+
+
+if __name__ == "__main__":
+    main()
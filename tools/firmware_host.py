@@ -0,0 +1,63 @@
+"""Runs firmware code built for the PC by tools/host, for the simulators."""
+
+import os
+import struct
+import subprocess
+import sys
+
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "host")
+HOST_BINARY = os.path.join(HOST_DIR, "lightframe_host")
+
+
+def start(command, text=True):
+    """Starts lightframe_host running command, building it first if needed."""
+    if subprocess.run(["make", "-s", "-C", HOST_DIR], stdout=subprocess.DEVNULL).returncode != 0:
+        sys.exit("couldn't build %s" % HOST_BINARY)
+    return subprocess.Popen([HOST_BINARY, command], stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            text=text, bufsize=1 if text else 0)
+
+
+class SyncFilter:
+    """One follower's clock filter, from main/sync_filter.c."""
+
+    def __init__(self):
+        self.process = start("sync")
+
+    def request(self, line):
+        self.process.stdin.write(line + "\n")
+        self.process.stdin.flush()
+        return self.process.stdout.readline().split()
+
+    def time(self, leader_millis, local_millis):
+        """Returns the action, offset, new rate ticks or None, and steps so far."""
+        action, offset, set_rate, rate_ticks, steps = self.request("time %d %d" % (leader_millis, local_millis))
+        return action, int(offset), int(rate_ticks) if set_rate == "1" else None, int(steps)
+
+    def scene(self, seq, start_millis, local_millis):
+        """Returns the local millis to start the scene at, or None for a repeat."""
+        reply = self.request("scene %d %d %d" % (seq, start_millis, local_millis))
+        return int(reply[1]) if reply[0] == "start" else None
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
+
+
+class SpectrumFft:
+    """The spectrum scene's transform, from main/spectrum_fft.c."""
+
+    FFT_SIZE = 512
+    FFT_HALF = FFT_SIZE // 2
+
+    def __init__(self):
+        self.process = start("fft", text=False)
+
+    def transform(self, samples):
+        """log2 of the power of each bin of FFT_SIZE samples, in 1/16ths."""
+        self.process.stdin.write(struct.pack("=%dh" % self.FFT_SIZE, *samples))
+        self.process.stdin.flush()
+        return list(struct.unpack("=%dH" % self.FFT_HALF, self.process.stdout.read(2 * self.FFT_HALF)))
+
+    def close(self):
+        self.process.stdin.close()
+        self.process.wait()
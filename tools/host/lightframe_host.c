@@ -0,0 +1,77 @@
+// Runs parts of the firmware on a PC for the simulators in tools/, built from
+// the same source files as the firmware. Each command reads requests from
+// stdin and answers each on stdout straight away.
+//
+// lightframe_host sync
+//     One follower's clock filter, from main/sync_filter.c. Takes lines of
+//         time <leaderMillis> <localMillis>
+//         scene <seq> <startMillis> <localMillis>
+//     and answers a time line with
+//         <keep|step|slew> <offset> <setRate 0|1> <rateTicks> <steps>
+//     and a scene line with "start <localMillis>" or "repeat".
+//
+// lightframe_host fft
+//     The spectrum scene's transform, from main/spectrum_fft.c. Takes blocks
+//     of FFT_SIZE int16_t samples and answers each with FFT_HALF uint16_t
+//     bin levels, all in the PC's byte order.
+
+#include <stdio.h>
+#include <string.h>
+#include "sync_filter.h"
+#include "spectrum_fft.h"
+
+static int run_sync()
+{
+    static const char *actionNames[] = {"keep", "step", "slew"};
+    syncFilter filter;
+    sync_filter_init(&filter);
+
+    char line[128];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        unsigned long a, b, c;
+        if (sscanf(line, "time %lu %lu", &a, &b) == 2) {
+            syncCorrection correction;
+            sync_filter_time(&filter, (uint32_t) a, (uint32_t) b, &correction);
+            printf("%s %d %d %d %u\n", actionNames[correction.action], (int) correction.offset,
+                   correction.setRate, (int) filter.rateTicks, (unsigned) filter.steps);
+        } else if (sscanf(line, "scene %lu %lu %lu", &a, &b, &c) == 3) {
+            uint32_t startMillis;
+            if (sync_filter_scene(&filter, (uint16_t) a, (uint32_t) b, (uint32_t) c, &startMillis)) {
+                printf("start %u\n", (unsigned) startMillis);
+            } else {
+                printf("repeat\n");
+            }
+        } else {
+            fprintf(stderr, "sync: bad request: %s", line);
+            return 1;
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int run_fft()
+{
+    int16_t samples[FFT_SIZE];
+    uint16_t binLog[FFT_HALF];
+    spectrum_fft_build_tables();
+
+    while (fread(samples, sizeof(samples), 1, stdin) == 1) {
+        spectrum_fft_transform(samples, binLog);
+        fwrite(binLog, sizeof(binLog), 1, stdout);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "sync") == 0) {
+        return run_sync();
+    }
+    if (argc == 2 && strcmp(argv[1], "fft") == 0) {
+        return run_fft();
+    }
+    fprintf(stderr, "usage: lightframe_host sync|fft\n");
+    return 2;
+}
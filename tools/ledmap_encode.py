@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Encode LED positions into a light frame LED map.
+
+The input has one LED per line, in strand order, as its x and y in pixels
+from the top left of the panel's grid, separated by a space or a comma.
+Blank lines and lines starting with # are skipped. For example, for a
+strand wound around a ring:
+
+    3.5, 0
+    5.2, 0.7
+    ...
+
+--fit scales and moves the positions to fill the grid given by --size,
+keeping their shape, so they can be given in any units. --ring makes the positions of
+LEDs evenly spaced around a circle filling the grid instead of reading a
+file, and --grid makes a map that goes back to the grid.
+
+The frame only takes a map with a position for every LED on its strand, so
+the number of positions must match --leds, the firmware's NUM_PIXELS.
+
+Usage:
+    ledmap_encode.py --size 8x6 --fit positions.txt ledmap.bin
+    curl --data-binary @ledmap.bin http://<frame>/led-map
+
+Each grid cell in the preview shows how many LEDs take their colour from it
+when a scene draws the grid.
+
+See main/ledmap_format.h for the format.
+"""
+
+import argparse
+import math
+import struct
+import sys
+
+MAGIC = b"LFMP"
+VERSION = 1
+HEADER = struct.Struct("<4sBBH")
+POSITION = struct.Struct("<hh")
+# NUM_PIXELS in main/frame_base.h
+NUM_PIXELS = 48
+
+
+def read_positions(path):
+    positions = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            fields = line.replace(",", " ").split()
+            if len(fields) != 2:
+                sys.exit("%s:%d: expected x and y" % (path, number))
+            try:
+                positions.append((float(fields[0]), float(fields[1])))
+            except ValueError:
+                sys.exit("%s:%d: expected x and y" % (path, number))
+    return positions
+
+
+def ring_positions(count, width, height):
+    """count LEDs clockwise from the top of a circle filling the grid."""
+    radius_x = (width - 1) / 2
+    radius_y = (height - 1) / 2
+    return [(radius_x + radius_x * math.sin(2 * math.pi * i / count),
+             radius_y - radius_y * math.cos(2 * math.pi * i / count)) for i in range(count)]
+
+
+def fit(positions, width, height):
+    """Scales positions evenly to fill a width by height grid, centred."""
+    min_x = min(x for x, _ in positions)
+    min_y = min(y for _, y in positions)
+    span_x = max(x for x, _ in positions) - min_x
+    span_y = max(y for _, y in positions) - min_y
+    scales = [(width - 1) / span_x if span_x > 0 else None, (height - 1) / span_y if span_y > 0 else None]
+    scale = min((s for s in scales if s is not None), default=1)
+    offset_x = (width - 1 - span_x * scale) / 2
+    offset_y = (height - 1 - span_y * scale) / 2
+    return [((x - min_x) * scale + offset_x, (y - min_y) * scale + offset_y) for x, y in positions]
+
+
+def encode(positions):
+    data = HEADER.pack(MAGIC, VERSION, 0, len(positions))
+    for x, y in positions:
+        fixed = (round(x * 256), round(y * 256))
+        if not all(-32768 <= n <= 32767 for n in fixed):
+            sys.exit("position (%g, %g) is out of range" % (x, y))
+        data += POSITION.pack(*fixed)
+    return data
+
+
+def preview(positions, width, height):
+    """The cell each LED is drawn from, rounded and clamped as the frame does."""
+    counts = [[0] * width for _ in range(height)]
+    for x, y in positions:
+        col = min(max((round(x * 256) + 128) >> 8, 0), width - 1)
+        row = min(max((round(y * 256) + 128) >> 8, 0), height - 1)
+        counts[row][col] += 1
+    for row in counts:
+        print(" ".join("%2d" % n if n else " ." for n in row))
+    shared = sum(n - 1 for row in counts for n in row if n > 1)
+    if shared:
+        print("%d LEDs share a cell with another LED" % shared)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--size", metavar="WIDTHxHEIGHT", default="8x6",
+                        help="the panel's grid, for --fit, --ring and the preview")
+    parser.add_argument("--fit", action="store_true", help="scale the positions to fill the grid")
+    parser.add_argument("--ring", type=int, metavar="LEDS", help="LEDs around a circle instead of a file")
+    parser.add_argument("--grid", action="store_true", help="a map going back to the grid")
+    parser.add_argument("--leds", type=int, default=NUM_PIXELS,
+                        help="LEDs on the frame's strand (default %(default)s)")
+    parser.add_argument("input", nargs="?")
+    parser.add_argument("output")
+    args = parser.parse_args()
+    width, height = (int(n) for n in args.size.split("x"))
+
+    if args.grid:
+        positions = []
+    elif args.ring:
+        positions = ring_positions(args.ring, width, height)
+    elif args.input:
+        positions = read_positions(args.input)
+        if not positions:
+            sys.exit("%s: no positions" % args.input)
+        if args.fit:
+            positions = fit(positions, width, height)
+    else:
+        parser.error("an input file, --ring or --grid is needed")
+
+    if positions and len(positions) != args.leds:
+        sys.exit("%d positions, the frame only takes a map with one for each of its %d LEDs" % (
+            len(positions), args.leds))
+
+    data = encode(positions)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print("%d LEDs, %d bytes" % (len(positions), len(data)))
+    if positions:
+        preview(positions, width, height)
+
+
+if __name__ == "__main__":
+    main()
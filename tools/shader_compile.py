@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""Compile a pixel shader into the light frame shader bytecode.
+
+A shader is a list of assignments in Python expression syntax. It must set
+r, g and b, the pixel's red, green and blue from 0 to 1, and can set other
+names on the way. The inputs are x and y (the pixel's canvas position), t
+(seconds since the scene started), width and height (of the canvas) and
+p0 to p3 (set through the scene config). For example:
+
+    wave = sin(x / width + t * p0)
+    r = 0.05 + 0.05 * wave
+    g = 0.02 if y < height / 2 else 0
+    b = 0.05 * fract(t)
+
+Operators are + - * / % and < > <= >= (giving 1 or 0). Functions are sin
+and cos (of turns, so a period of 1), abs, min, max, floor, fract and sqrt.
+Anything that doesn't depend on x or y is worked out once a frame rather
+than for every pixel.
+
+Usage:
+    shader_compile.py shader.txt shader.bin
+    curl --data-binary @shader.bin http://<frame>/shader
+
+--preview runs the compiled program here and prints a frame, which uses the
+same fixed point maths as the frame.
+
+See main/shader_format.h for the format.
+"""
+
+import argparse
+import ast
+import math
+import struct
+import sys
+
+MAGIC = b"LFSH"
+VERSION = 1
+NUM_REGISTERS = 32
+MAX_INSTRUCTIONS = 128
+FIXED_ONE = 1 << 16
+SIN_STEPS = 1024
+
+INPUTS = {"x": 0, "y": 1, "t": 2, "width": 3, "height": 4,
+          "p0": 5, "p1": 6, "p2": 7, "p3": 8}
+PIXEL_INPUTS = {"x", "y"}
+FIRST_FREE_REGISTER = 9
+OUTPUTS = ("r", "g", "b")
+
+OPS = ["mov", "add", "sub", "mul", "div", "mod", "min", "max", "lt", "sel",
+       "abs", "neg", "floor", "fract", "sin", "cos", "sqrt"]
+OP = {name: i for i, name in enumerate(OPS)}
+BINARY_OPS = {ast.Add: "add", ast.Sub: "sub", ast.Mult: "mul", ast.Div: "div", ast.Mod: "mod"}
+UNARY_FUNCTIONS = {"abs", "floor", "fract", "sin", "cos", "sqrt"}
+BINARY_FUNCTIONS = {"min", "max"}
+
+
+class CompileError(Exception):
+    def __init__(self, node, message):
+        super().__init__("line %d: %s" % (getattr(node, "lineno", 0), message))
+
+
+class Value:
+    """A register holding a value, and whether it changes from pixel to pixel."""
+
+    def __init__(self, reg, per_pixel, temporary):
+        self.reg = reg
+        self.per_pixel = per_pixel
+        self.temporary = temporary
+
+
+class Compiler:
+    def __init__(self):
+        self.frame_code = []
+        self.pixel_code = []
+        self.constants = {}
+        self.names = {name: Value(reg, name in PIXEL_INPUTS, False) for name, reg in INPUTS.items()}
+        self.next_register = FIRST_FREE_REGISTER
+        # Registers only ever used for per pixel temporaries. Values worked out
+        # once a frame keep their register, so the pixel code can't overwrite them.
+        self.free_pixel_registers = []
+        # Values worked out once a frame, by (op, a, b), so they're only worked out once
+        self.frame_values = {}
+
+    def new_register(self, node, per_pixel):
+        if per_pixel and self.free_pixel_registers:
+            return self.free_pixel_registers.pop()
+        if self.next_register >= NUM_REGISTERS:
+            raise CompileError(node, "out of registers")
+        self.next_register += 1
+        return self.next_register - 1
+
+    def release(self, value):
+        if value.temporary and value.per_pixel:
+            self.free_pixel_registers.append(value.reg)
+
+    def constant(self, node, number):
+        fixed = int(round(number * FIXED_ONE))
+        if not -(1 << 31) <= fixed < (1 << 31):
+            raise CompileError(node, "%g is out of range" % number)
+        if fixed not in self.constants:
+            self.constants[fixed] = self.new_register(node, False)
+        return Value(self.constants[fixed], False, False)
+
+    def emit(self, node, op, a, b=None, dst=None):
+        operands = [v for v in (a, b, dst) if v is not None]
+        per_pixel = any(v.per_pixel for v in operands)
+        b_reg = b.reg if b is not None else 0
+        key = (op, a.reg, b_reg)
+        if dst is None and not per_pixel and key in self.frame_values:
+            return Value(self.frame_values[key].reg, False, False)
+        for value in operands:
+            self.release(value)
+        if dst is None:
+            dst = Value(self.new_register(node, per_pixel), per_pixel, True)
+        else:
+            # The old value is gone, so it can't be reused
+            self.frame_values = {k: v for k, v in self.frame_values.items() if v.reg != dst.reg}
+            dst = Value(dst.reg, per_pixel, True)
+        code = self.pixel_code if per_pixel else self.frame_code
+        code.append((OP[op], dst.reg, a.reg, b_reg))
+        if not per_pixel and op != "sel":
+            self.frame_values[key] = dst
+        return dst
+
+    def writable(self, node, value):
+        """A temporary copy of value, so an instruction can overwrite it."""
+        if value.temporary:
+            return value
+        return self.emit(node, "mov", value)
+
+    def expression(self, node):
+        if isinstance(node, ast.Constant) and isinstance(node.value, (int, float)) \
+                and not isinstance(node.value, bool):
+            return self.constant(node, node.value)
+        if isinstance(node, ast.Name):
+            if node.id not in self.names:
+                raise CompileError(node, "%s is not set" % node.id)
+            return self.names[node.id]
+        if isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.USub):
+            if isinstance(node.operand, ast.Constant):
+                return self.constant(node, -node.operand.value)
+            return self.emit(node, "neg", self.expression(node.operand))
+        if isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.UAdd):
+            return self.expression(node.operand)
+        if isinstance(node, ast.BinOp) and type(node.op) in BINARY_OPS:
+            a = self.expression(node.left)
+            b = self.expression(node.right)
+            return self.emit(node, BINARY_OPS[type(node.op)], a, b)
+        if isinstance(node, ast.Compare) and len(node.ops) == 1:
+            a = self.expression(node.left)
+            b = self.expression(node.comparators[0])
+            op = type(node.ops[0])
+            if op is ast.Lt:
+                return self.emit(node, "lt", a, b)
+            if op is ast.Gt:
+                return self.emit(node, "lt", b, a)
+            if op in (ast.LtE, ast.GtE):
+                # a <= b is 1 - (b < a)
+                less = self.emit(node, "lt", b, a) if op is ast.LtE else self.emit(node, "lt", a, b)
+                return self.emit(node, "sub", self.constant(node, 1), less)
+        if isinstance(node, ast.IfExp):
+            condition = self.writable(node, self.expression(node.test))
+            a = self.expression(node.body)
+            b = self.expression(node.orelse)
+            return self.emit(node, "sel", a, b, dst=condition)
+        if isinstance(node, ast.Call) and isinstance(node.func, ast.Name) and not node.keywords:
+            name = node.func.id
+            args = [self.expression(arg) for arg in node.args]
+            if name in UNARY_FUNCTIONS and len(args) == 1:
+                return self.emit(node, name, args[0])
+            if name in BINARY_FUNCTIONS and len(args) == 2:
+                return self.emit(node, name, args[0], args[1])
+            raise CompileError(node, "%s() is not a function of %d arguments" % (name, len(args)))
+        raise CompileError(node, "can't compile %s" % ast.dump(node))
+
+    def compile(self, source):
+        try:
+            tree = ast.parse(source)
+        except SyntaxError as e:
+            raise CompileError(e, e.msg)
+        for statement in tree.body:
+            if not isinstance(statement, ast.Assign) or len(statement.targets) != 1 \
+                    or not isinstance(statement.targets[0], ast.Name):
+                raise CompileError(statement, "only name = expression is allowed")
+            name = statement.targets[0].id
+            if name in INPUTS:
+                raise CompileError(statement, "%s is an input" % name)
+            value = self.expression(statement.value)
+            # Named values are kept, as they can be used again
+            self.names[name] = Value(value.reg, value.per_pixel, False)
+        for name in OUTPUTS:
+            if name not in self.names:
+                raise CompileError(tree, "%s is not set" % name)
+
+        if len(self.frame_code) + len(self.pixel_code) > MAX_INSTRUCTIONS:
+            raise CompileError(tree, "more than %d instructions" % MAX_INSTRUCTIONS)
+        outputs = [self.names[name].reg for name in OUTPUTS]
+        data = struct.pack("<4sBBBB3BB", MAGIC, VERSION, len(self.constants),
+                           len(self.frame_code), len(self.pixel_code), *outputs, 0)
+        for value, reg in self.constants.items():
+            data += struct.pack("<B3xi", reg, value)
+        for instruction in self.frame_code + self.pixel_code:
+            data += struct.pack("<4B", *instruction)
+        return data
+
+
+def to_int32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+SIN_TABLE = [int(math.sin(i * 2 * math.pi / SIN_STEPS) * FIXED_ONE) for i in range(SIN_STEPS)]
+
+
+def fixed_sqrt(a):
+    return math.isqrt(a << 16) if a > 0 else 0
+
+
+def run(regs, code):
+    """Runs instructions the way the frame does, 16.16 fixed point in int32."""
+    for op, dst, ra, rb in code:
+        a, b = regs[ra], regs[rb]
+        name = OPS[op]
+        if name == "mov":
+            result = a
+        elif name == "add":
+            result = a + b
+        elif name == "sub":
+            result = a - b
+        elif name == "mul":
+            result = (a * b) >> 16
+        elif name == "div":
+            # Rounds towards 0, like C
+            quotient = abs(a << 16) // abs(b) if b != 0 else 0
+            result = -quotient if (a < 0) != (b < 0) else quotient
+        elif name == "mod":
+            result = 0 if b == 0 else a - b * (a // b)
+        elif name == "min":
+            result = min(a, b)
+        elif name == "max":
+            result = max(a, b)
+        elif name == "lt":
+            result = FIXED_ONE if a < b else 0
+        elif name == "sel":
+            result = a if regs[dst] != 0 else b
+        elif name == "abs":
+            result = abs(a)
+        elif name == "neg":
+            result = -a
+        elif name == "floor":
+            result = a & ~(FIXED_ONE - 1)
+        elif name == "fract":
+            result = a & (FIXED_ONE - 1)
+        elif name == "sin":
+            result = SIN_TABLE[(a >> 6) & (SIN_STEPS - 1)]
+        elif name == "cos":
+            result = SIN_TABLE[((a >> 6) + SIN_STEPS // 4) & (SIN_STEPS - 1)]
+        else:
+            result = fixed_sqrt(a)
+        regs[dst] = to_int32(result)
+
+
+def preview(data, width, height, seconds, params):
+    magic, version, num_constants, frame_length, pixel_length, *rest = struct.unpack_from("<4sBBBB3BB", data)
+    outputs = rest[:3]
+    offset = struct.calcsize("<4sBBBB3BB")
+    regs = [0] * NUM_REGISTERS
+    regs[INPUTS["t"]] = int(seconds * FIXED_ONE)
+    regs[INPUTS["width"]] = width << 16
+    regs[INPUTS["height"]] = height << 16
+    for i, param in enumerate(params):
+        regs[INPUTS["p%d" % i]] = int(param * FIXED_ONE)
+    for _ in range(num_constants):
+        reg, value = struct.unpack_from("<B3xi", data, offset)
+        regs[reg] = value
+        offset += 8
+    code = [struct.unpack_from("<4B", data, offset + i * 4) for i in range(frame_length + pixel_length)]
+    run(regs, code[:frame_length])
+    for y in range(height):
+        row = []
+        regs[INPUTS["y"]] = y << 16
+        for x in range(width):
+            regs[INPUTS["x"]] = x << 16
+            run(regs, code[frame_length:])
+            row.append("".join("%02x" % min(255, max(0, regs[o] * 255 >> 16)) for o in outputs))
+        print(" ".join(row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--preview", metavar="WIDTHxHEIGHT",
+                        help="print the RGB of each pixel of a frame this size")
+    parser.add_argument("--time", type=float, default=0, help="t for --preview")
+    parser.add_argument("--params", type=float, nargs="*", default=[1, 0, 0, 0],
+                        help="p0 to p3 for --preview")
+    parser.add_argument("input")
+    parser.add_argument("output", nargs="?")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        source = f.read()
+    compiler = Compiler()
+    try:
+        data = compiler.compile(source)
+    except CompileError as e:
+        sys.exit("%s: %s" % (args.input, e))
+
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(data)
+    print("%d constants, %d instructions a frame, %d a pixel, %d registers, %d bytes" % (
+        len(compiler.constants), len(compiler.frame_code), len(compiler.pixel_code),
+        compiler.next_register, len(data)))
+    if args.preview:
+        width, height = (int(n) for n in args.preview.split("x"))
+        preview(data, width, height, args.time, args.params)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Simulate the spectrum scene receiving multicast audio.
+
+Runs the scene's column bands, falling bars and peaks on the audio from
+audio_send.py and draws the canvas in the terminal, so the scene can be tried
+out over loopback without any hardware. The transform is the firmware's own
+fixed point FFT, main/spectrum_fft.c built for the PC by tools/host.
+
+Usage:
+    spectrum_sim.py --width 16 --height 6 &
+    audio_send.py music.wav
+"""
+
+import argparse
+import math
+import socket
+import struct
+import sys
+import time
+
+import firmware_host
+from audio_send import DEFAULT_PORT, HEADER, MAGIC, VERSION
+from stream_send import DEFAULT_GROUP
+
+FRAME_MILLIS = 16
+FFT_SIZE = 512
+FFT_HALF = FFT_SIZE // 2
+RING_SIZE = 2048
+FULL_SCALE_LOG = 28 * 16
+
+
+def c_round(value):
+    """Rounds halves away from 0, like lroundf."""
+    return int(math.copysign(math.floor(abs(value) + 0.5), value))
+
+
+def trunc_div(a, b):
+    quotient = abs(a) // abs(b)
+    return -quotient if (a < 0) != (b < 0) else quotient
+
+
+class SimSpectrum:
+    def __init__(self, args):
+        self.args = args
+        self.ring = [0] * RING_SIZE
+        self.written = 0
+        self.last_written = 0
+        self.rate = 0
+        self.bands_rate = 0
+        self.bands = []
+        self.bars = [0] * args.width
+        self.peaks = [0] * args.width
+        self.peak_millis = [0] * args.width
+        self.last_seq = None
+        self.packets = 0
+        self.lost = 0
+        self.fft = firmware_host.SpectrumFft()
+
+    def packet_received(self, datagram):
+        if len(datagram) < HEADER.size:
+            return
+        magic, version, channels, rate, count, _, seq = HEADER.unpack_from(datagram)
+        if magic != MAGIC or version != VERSION or not 1 <= channels <= 2 or rate == 0 \
+                or len(datagram) < HEADER.size + count * channels * 2:
+            return
+        if self.last_seq is not None:
+            gap = (seq - self.last_seq - 1) % 2 ** 32
+            if 0 < gap < 2 ** 31:
+                self.lost += gap
+        self.last_seq = seq
+        self.packets += 1
+        pcm = struct.unpack_from("<%dh" % (count * channels), datagram, HEADER.size)
+        for i in range(count):
+            total = sum(pcm[i * channels:(i + 1) * channels])
+            self.ring[self.written % RING_SIZE] = total >> 1 if channels == 2 else total
+            self.written += 1
+        self.rate = rate
+
+    def build_bands(self):
+        args = self.args
+        ratio = args.max_hz / args.min_hz
+        columns = self.args.width
+        self.bands = []
+        for col in range(columns):
+            low_hz = args.min_hz * ratio ** (col / columns)
+            high_hz = args.min_hz * ratio ** ((col + 1) / columns)
+            low = min(max(c_round(low_hz * FFT_SIZE / self.rate), 1), FFT_HALF - 1)
+            high = min(max(c_round(high_hz * FFT_SIZE / self.rate) - 1, low), FFT_HALF - 1)
+            self.bands.append((low, high))
+        self.bands_rate = self.rate
+
+    def update(self, millis, elapsed):
+        args = self.args
+        sound = self.written != self.last_written and self.written >= FFT_SIZE
+        logs = None
+        if sound:
+            if self.rate != self.bands_rate:
+                self.build_bands()
+            end = self.written
+            logs = self.fft.transform([self.ring[(end - FFT_SIZE + i) % RING_SIZE] for i in range(FFT_SIZE)])
+        self.last_written = self.written
+
+        full = args.height * 256
+        fall = elapsed * 256 // max(args.fall_millis, 1)
+        for col in range(min(len(self.bands), args.width)):
+            level = 0
+            if logs:
+                low, high = self.bands[col]
+                below = FULL_SCALE_LOG - max(logs[low:high + 1])
+                level = min(max(full - trunc_div(below * 301 * full, 1600 * args.range_db), 0), full)
+            if level > self.bars[col] - fall:
+                self.bars[col] = level
+            else:
+                self.bars[col] -= fall
+            if self.bars[col] >= self.peaks[col]:
+                self.peaks[col] = self.bars[col]
+                self.peak_millis[col] = millis
+            elif millis - self.peak_millis[col] > args.peak_hold_millis:
+                self.peaks[col] = max(self.peaks[col] - fall, self.bars[col])
+
+    def draw(self):
+        lines = []
+        for row in range(self.args.height):
+            height = self.args.height - 1 - row
+            line = ""
+            for col in range(self.args.width):
+                if self.peaks[col] >= 128 and (self.peaks[col] - 128) >> 8 == height:
+                    line += "──"
+                elif self.bars[col] >= height * 256 + 128:
+                    line += "██"
+                else:
+                    line += "  "
+            lines.append(line)
+        status = "%d Hz, %d packets, %d lost" % (self.rate, self.packets, self.lost)
+        sys.stdout.write("\x1b[H" + "\n".join(lines) + "\n" + status + "\x1b[K\n")
+        sys.stdout.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--width", type=int, default=16, help="canvas width, a column per pixel")
+    parser.add_argument("--height", type=int, default=6)
+    parser.add_argument("--min-hz", type=int, default=60)
+    parser.add_argument("--max-hz", type=int, default=12000)
+    parser.add_argument("--range-db", type=int, default=48)
+    parser.add_argument("--fall-millis", type=int, default=40)
+    parser.add_argument("--peak-hold-millis", type=int, default=500)
+    parser.add_argument("--group", default=DEFAULT_GROUP)
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--seconds", type=float, help="stop after this long")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    mreq = struct.pack("4s4s", socket.inet_aton(args.group), socket.inet_aton("0.0.0.0"))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    sock.setblocking(False)
+
+    sim = SimSpectrum(args)
+    sys.stdout.write("\x1b[2J")
+    start = time.monotonic()
+    last_millis = 0
+    while args.seconds is None or time.monotonic() - start < args.seconds:
+        try:
+            while True:
+                sim.packet_received(sock.recv(2048))
+        except BlockingIOError:
+            pass
+        millis = int((time.monotonic() - start) * 1000)
+        if millis - last_millis >= FRAME_MILLIS:
+            sim.update(millis, millis - last_millis)
+            sim.draw()
+            last_millis = millis
+        time.sleep(0.002)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Multicast frames of a canvas to light frames running the stream scene.
+
+Each frame of the whole canvas is sent as sequence numbered UDP chunks, and
+every light frame picks out its own part. Frames come from a file of raw RGB
+frames (as for anim_encode.py), looped, or from a built in test pattern.
+
+Usage:
+    stream_send.py --width 48 --height 30 --fps 60
+    stream_send.py --width 16 --height 6 --input frames.rgb
+
+See main/stream_format.h for the format.
+"""
+
+import argparse
+import colorsys
+import math
+import socket
+import struct
+import time
+
+MAGIC = b"LFST"
+VERSION = 2
+MAX_CHUNK_BYTES = 1472
+HEADER = struct.Struct("<4sBBHHHHHIII")
+DEFAULT_GROUP = "239.255.70.1"
+DEFAULT_PORT = 4211
+
+
+def chunk_frame(frame, width, height, seq, millis, chunk_bytes=MAX_CHUNK_BYTES):
+    """Splits a frame of width * height RGB triplets into datagrams.
+
+    millis is the time the frame was made, on any clock counting milliseconds.
+    """
+    pixels_per_chunk = (chunk_bytes - HEADER.size) // 3
+    num_pixels = width * height
+    chunk_count = (num_pixels + pixels_per_chunk - 1) // pixels_per_chunk
+    chunks = []
+    for chunk in range(chunk_count):
+        first = chunk * pixels_per_chunk
+        count = min(pixels_per_chunk, num_pixels - first)
+        header = HEADER.pack(MAGIC, VERSION, 0, chunk, chunk_count, width, height,
+                             count, seq & 0xFFFFFFFF, first, millis & 0xFFFFFFFF)
+        chunks.append(header + frame[first * 3:(first + count) * 3])
+    return chunks
+
+
+def test_pattern(width, height, t):
+    """Diagonal rainbow bands moving across the canvas."""
+    out = bytearray()
+    for y in range(height):
+        for x in range(width):
+            hue = (x + y) / (width + height) - t * 0.25
+            r, g, b = colorsys.hsv_to_rgb(hue % 1.0, 1.0, 0.3)
+            out += bytes((int(r * 255), int(g * 255), int(b * 255)))
+    return bytes(out)
+
+
+def file_frames(path, width, height):
+    with open(path, "rb") as f:
+        raw = f.read()
+    frame_size = width * height * 3
+    if len(raw) == 0 or len(raw) % frame_size != 0:
+        raise SystemExit("input is not a whole number of %d x %d frames" % (width, height))
+    return [raw[offset:offset + frame_size] for offset in range(0, len(raw), frame_size)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--width", type=int, required=True)
+    parser.add_argument("--height", type=int, required=True)
+    parser.add_argument("--fps", type=float, default=60)
+    parser.add_argument("--group", default=DEFAULT_GROUP)
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--ttl", type=int, default=1)
+    parser.add_argument("--input", help="raw RGB frames to loop instead of the test pattern")
+    parser.add_argument("--seconds", type=float, help="stop after this long")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, args.ttl)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+
+    frames = file_frames(args.input, args.width, args.height) if args.input else None
+    frame_seconds = 1.0 / args.fps
+    start = time.monotonic()
+    next_frame = start
+    seq = 0
+    while args.seconds is None or time.monotonic() - start < args.seconds:
+        if frames:
+            frame = frames[seq % len(frames)]
+        else:
+            frame = test_pattern(args.width, args.height, next_frame - start)
+        millis = int((next_frame - start) * 1000)
+        for datagram in chunk_frame(frame, args.width, args.height, seq, millis):
+            sock.sendto(datagram, (args.group, args.port))
+        seq += 1
+
+        next_frame += frame_seconds
+        delay = next_frame - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        elif delay < -1:
+            # Fell well behind, don't try to catch up
+            next_frame = time.monotonic()
+
+    elapsed = time.monotonic() - start
+    print("sent %d frames in %.1f s, %.1f fps" % (seq, elapsed, seq / elapsed))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Simulate a wall of light frames receiving the multicast stream.
+
+Each simulated frame joins the multicast group with its own socket and picks
+its 8 x 6 tile out of the chunks the way the stream scene does, keeping the
+previous pixels for chunks that don't arrive. Prints frame rates and missed
+chunks, so stream_send.py can be tried out without any hardware.
+
+Usage:
+    stream_sim.py --cols 6 --rows 5 &
+    stream_send.py --width 48 --height 30 --fps 60 --seconds 10
+"""
+
+import argparse
+import random
+import selectors
+import socket
+import struct
+import time
+
+from stream_send import DEFAULT_GROUP, DEFAULT_PORT, HEADER, MAGIC, VERSION
+
+PANEL_WIDTH = 8
+PANEL_HEIGHT = 6
+# As in main/stream_scene.c, chunks further behind than these start a new stream
+MAX_LATE_FRAMES = 16
+MAX_LATE_MILLIS = 1000
+
+
+class SimFrame:
+    def __init__(self, x, y, group, port):
+        self.x = x
+        self.y = y
+        self.pixels = bytearray(PANEL_WIDTH * PANEL_HEIGHT * 3)
+        self.receiving = False
+        self.seq = 0
+        self.millis = 0
+        self.chunks = 0
+        self.chunk_count = 0
+        self.frames = 0
+        self.missed = 0
+        self.late = 0
+        self.restarts = 0
+
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        if hasattr(socket, "SO_REUSEPORT"):
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+        self.sock.bind(("", port))
+        mreq = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+        self.sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+        self.sock.setblocking(False)
+
+    def publish(self):
+        self.frames += 1
+        if self.chunks < self.chunk_count:
+            self.missed += self.chunk_count - self.chunks
+
+    def extract(self, width, height, first, count, data):
+        end = first + count
+        for row in range(PANEL_HEIGHT):
+            canvas_row = self.y + row
+            if canvas_row >= height:
+                break
+            row_start = canvas_row * width + self.x
+            row_end = min(canvas_row * width + width, row_start + PANEL_WIDTH)
+            if row_end <= first:
+                continue
+            if row_start >= end:
+                break
+            start = max(row_start, first)
+            stop = min(row_end, end)
+            dest = (row * PANEL_WIDTH + start - row_start) * 3
+            self.pixels[dest:dest + (stop - start) * 3] = data[(start - first) * 3:(stop - first) * 3]
+
+    def chunk_received(self, datagram):
+        if len(datagram) < HEADER.size:
+            return
+        (magic, version, _, _, chunk_count, width, height, count, seq,
+         first, millis) = HEADER.unpack_from(datagram)
+        if magic != MAGIC or version != VERSION or len(datagram) < HEADER.size + count * 3:
+            return
+
+        if self.receiving:
+            change = (seq - self.seq + 2 ** 31) % 2 ** 32 - 2 ** 31
+            millis_change = (millis - self.millis + 2 ** 31) % 2 ** 32 - 2 ** 31
+            if change < -MAX_LATE_FRAMES or millis_change < -MAX_LATE_MILLIS:
+                self.restarts += 1
+                self.chunks = 0
+            elif change < 0:
+                self.late += 1
+                return
+            elif change > 0:
+                if self.chunks < self.chunk_count:
+                    self.publish()
+                self.chunks = 0
+        self.receiving = True
+        self.seq = seq
+        self.millis = millis
+        self.chunk_count = chunk_count
+        self.extract(width, height, first, count, memoryview(datagram)[HEADER.size:])
+        self.chunks += 1
+        if self.chunks == self.chunk_count:
+            self.publish()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cols", type=int, default=6, help="frames across the canvas")
+    parser.add_argument("--rows", type=int, default=5, help="frames down the canvas")
+    parser.add_argument("--group", default=DEFAULT_GROUP)
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT)
+    parser.add_argument("--drop", type=float, default=0,
+                        help="fraction of chunks each frame drops, to try out lost chunks")
+    parser.add_argument("--seconds", type=float, help="stop after this long")
+    args = parser.parse_args()
+
+    frames = [SimFrame(col * PANEL_WIDTH, row * PANEL_HEIGHT, args.group, args.port)
+              for row in range(args.rows) for col in range(args.cols)]
+    selector = selectors.DefaultSelector()
+    for frame in frames:
+        selector.register(frame.sock, selectors.EVENT_READ, frame)
+    print("%d frames listening on %s:%d" % (len(frames), args.group, args.port))
+
+    start = time.monotonic()
+    last_report = start
+    last_frames = [0] * len(frames)
+    while args.seconds is None or time.monotonic() - start < args.seconds:
+        for key, _ in selector.select(timeout=0.1):
+            frame = key.data
+            try:
+                while True:
+                    datagram = frame.sock.recv(2048)
+                    if args.drop == 0 or random.random() >= args.drop:
+                        frame.chunk_received(datagram)
+            except BlockingIOError:
+                pass
+
+        now = time.monotonic()
+        if now - last_report >= 1:
+            rates = [(f.frames - last) / (now - last_report) for f, last in zip(frames, last_frames)]
+            last_frames = [f.frames for f in frames]
+            last_report = now
+            print("fps min %.1f max %.1f, missed chunks %d, late chunks %d, restarts %d" % (
+                min(rates), max(rates), sum(f.missed for f in frames), sum(f.late for f in frames),
+                sum(f.restarts for f in frames)))
+
+
+if __name__ == "__main__":
+    main()
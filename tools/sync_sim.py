@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+"""Simulate a leader and several followers keeping time with the sync protocol.
+
+Each simulated frame has its own millis clock, driven by a timer whose crystal
+is off by a random number of ppm, and its own UDP socket on 127.0.0.1. The
+leader sends sync packets to every follower as sync.c does. Each follower
+passes them to its own copy of the firmware's clock filter, main/sync_filter.c
+built for the PC by tools/host, and applies the step, slew and rate trim it
+asks for to its clock the way main.c's timer interrupt does. The simulator
+times packets on its own clock, so a few minutes of syncing run in seconds,
+and adds a random network delay to each packet.
+
+The leader changes scene every --scene-every seconds, announced ahead of time.
+Every frame's change is timed on the simulator's clock. The output lists how far
+apart the frames started each scene and each follower's offset from the leader.
+The exit status is 1 if any scene change after the first window lands more
+than --tolerance ms apart, which is a frame at 60 fps by default.
+
+Usage:
+    sync_sim.py --followers 4 --ppm 100 --jitter 8 --seconds 300
+"""
+
+import argparse
+import random
+import socket
+import struct
+import sys
+
+import firmware_host
+
+# sync.c
+MAGIC = b"LFTS"
+VERSION = 1
+SYNC_TIME = 0
+SYNC_SCENE = 1
+PACKET = struct.Struct("<4sBBBBHHII")
+SYNC_INTERVAL_MILLIS = 1000
+SYNC_SCENE_REPEATS = 3
+NUM_SCENES = 12
+# sync_filter.h
+SYNC_WINDOW_SAMPLES = 16
+SYNC_SCENE_LEAD_MILLIS = 200
+PPM_PER_RATE_TICK = 25
+
+# main.c
+TIMER_ALARM_VALUE = 40000
+SLEW_TICKS = 16
+
+DEFAULT_PORT = 4210
+
+
+def u32(value):
+    return value & 0xFFFFFFFF
+
+
+def s32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+class SimClock:
+    """millis as kept by main.c's timer ISR, on a crystal that is off by ppm."""
+
+    def __init__(self, ppm, millis):
+        self.ppm = ppm
+        self.millis = millis
+        self.step = 0
+        self.slew = 0
+        self.slew_ticks = 0
+        self.alarm_ticks = 0
+        self.next_tick = 0.0
+        self.scheduled = None
+        self.started = []
+
+    def period(self):
+        """Length of one tick, in true milliseconds."""
+        return (1 + self.alarm_ticks / TIMER_ALARM_VALUE) * (1 + self.ppm / 1e6)
+
+    def tick(self, now):
+        self.millis = u32(self.millis + 1)
+        if self.step != 0:
+            self.millis = u32(self.millis + self.step)
+            self.step = 0
+        elif self.slew != 0:
+            self.slew_ticks += 1
+            if self.slew_ticks >= SLEW_TICKS:
+                self.slew_ticks = 0
+                if self.slew > 0:
+                    self.millis = u32(self.millis + 1)
+                    self.slew -= 1
+                else:
+                    self.millis = u32(self.millis - 1)
+                    self.slew += 1
+        # The render loop's check for a scheduled scene, once a tick
+        if self.scheduled is not None and s32(self.millis - self.scheduled[1]) >= 0:
+            self.started.append((self.scheduled[0], now))
+            self.scheduled = None
+
+    def advance(self, now):
+        while self.next_tick <= now:
+            self.tick(self.next_tick)
+            self.next_tick += self.period()
+
+    def millis_step(self, adjust):
+        self.slew = 0
+        self.step = adjust
+
+    def millis_slew(self, adjust):
+        self.slew = adjust
+
+    def millis_set_rate(self, alarm_ticks):
+        self.alarm_ticks = alarm_ticks
+
+    def schedule_scene(self, seq, start_millis):
+        self.scheduled = (seq, start_millis)
+
+
+class SimLeader(SimClock):
+    def __init__(self, ppm, millis, ports):
+        super().__init__(ppm, millis)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.ports = ports
+        self.scene_seq = 0
+        self.next_send = millis
+
+    def send(self, kind, scene=0, seq=0, start_millis=0):
+        packet = PACKET.pack(MAGIC, VERSION, kind, scene, 0, seq, 0, self.millis, start_millis)
+        for port in self.ports:
+            self.sock.sendto(packet, ("127.0.0.1", port))
+
+    def send_time(self):
+        if s32(self.millis - self.next_send) >= 0:
+            self.send(SYNC_TIME)
+            self.next_send = u32(self.millis + SYNC_INTERVAL_MILLIS)
+
+    def change_scene(self):
+        """sync_scene_start, followed by the leader scheduling the scene itself."""
+        self.scene_seq = (self.scene_seq + 1) & 0xFFFF
+        start_millis = u32(self.millis + SYNC_SCENE_LEAD_MILLIS)
+        for _ in range(SYNC_SCENE_REPEATS):
+            self.send(SYNC_SCENE, self.scene_seq % NUM_SCENES, self.scene_seq, start_millis)
+        self.schedule_scene(self.scene_seq, start_millis)
+
+
+class SimFollower(SimClock):
+    def __init__(self, ppm, millis, port):
+        super().__init__(ppm, millis)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        self.sock.bind(("127.0.0.1", port))
+        self.sock.setblocking(False)
+        self.port = port
+        self.delayed = []
+
+        self.filter = firmware_host.SyncFilter()
+        self.synced = False
+        self.last_offset = 0
+        self.rate_ticks = 0
+        self.steps = 0
+        self.packets = 0
+
+    def receive(self, now, jitter):
+        """Queues packets waiting on the socket to arrive after a network delay."""
+        while True:
+            try:
+                data = self.sock.recv(64)
+            except BlockingIOError:
+                return
+            self.delayed.append((now + random.uniform(0, jitter), data))
+
+    def deliver(self, now):
+        due = [entry for entry in self.delayed if entry[0] <= now]
+        self.delayed = [entry for entry in self.delayed if entry[0] > now]
+        for _, data in sorted(due, key=lambda entry: entry[0]):
+            self.packet_received(data)
+
+    def packet_received(self, data):
+        if len(data) != PACKET.size:
+            return
+        magic, version, kind, scene, _, seq, _, leader_millis, start_millis = PACKET.unpack(data)
+        if magic != MAGIC or version != VERSION:
+            return
+        self.packets += 1
+        if kind == SYNC_TIME:
+            self.time_received(leader_millis)
+        elif kind == SYNC_SCENE:
+            self.scene_received(scene, seq, start_millis)
+
+    def time_received(self, leader_millis):
+        action, offset, rate_ticks, self.steps = self.filter.time(leader_millis, self.millis)
+        if action == "step":
+            self.millis_step(offset)
+        elif action == "slew":
+            self.millis_slew(offset)
+        if action != "keep" and self.synced:
+            self.last_offset = offset
+        self.synced = True
+        if rate_ticks is not None:
+            self.rate_ticks = rate_ticks
+            self.millis_set_rate(rate_ticks)
+
+    def scene_received(self, scene, seq, start_millis):
+        if scene >= NUM_SCENES:
+            return
+        start_millis = self.filter.scene(seq, start_millis, self.millis)
+        if start_millis is not None:
+            self.schedule_scene(seq, start_millis)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--followers", type=int, default=3)
+    parser.add_argument("--ppm", type=float, default=100, help="largest crystal error, either way")
+    parser.add_argument("--jitter", type=float, default=5, help="largest network delay in ms")
+    parser.add_argument("--seconds", type=int, default=240, help="simulated time to run for")
+    parser.add_argument("--scene-every", type=int, default=10, help="seconds between scene changes")
+    parser.add_argument("--tolerance", type=float, default=16, help="largest spread of a scene change in ms")
+    parser.add_argument("--port", type=int, default=DEFAULT_PORT, help="first follower's port")
+    parser.add_argument("--seed", type=int, help="for a repeatable run")
+    args = parser.parse_args()
+    random.seed(args.seed)
+
+    def boot_millis():
+        return random.randrange(1 << 32)
+
+    followers = [SimFollower(random.uniform(-args.ppm, args.ppm), boot_millis(), args.port + i)
+                 for i in range(args.followers)]
+    leader = SimLeader(random.uniform(-args.ppm, args.ppm), boot_millis(), [f.port for f in followers])
+    clocks = [leader] + followers
+    print("crystals: leader %+.0f ppm, followers %s" % (
+        leader.ppm, ", ".join("%+.0f ppm" % f.ppm for f in followers)))
+
+    # The first window completes after a packet per follower to step the clock,
+    # then SYNC_WINDOW_SAMPLES more
+    settled_millis = (SYNC_WINDOW_SAMPLES + 2) * SYNC_INTERVAL_MILLIS
+    scene_every = args.scene_every * 1000
+    failed = False
+    reported = 0
+    now = 0
+    while now < args.seconds * 1000:
+        now += 1
+        for clock in clocks:
+            clock.advance(now)
+        leader.send_time()
+        if now % scene_every == 0:
+            leader.change_scene()
+        for follower in followers:
+            follower.receive(now, args.jitter)
+            follower.deliver(now)
+
+        if now // 10000 > reported:
+            reported = now // 10000
+            print("%4d s  offsets %s" % (now // 1000, "  ".join(
+                "%+4d ms (measured %+d, trimmed %+d ppm, %d steps)" % (
+                    s32(f.millis - leader.millis), f.last_offset, -f.rate_ticks * PPM_PER_RATE_TICK, f.steps)
+                for f in followers)))
+
+        # A scene change is done once every frame has started it
+        if leader.started and all(f.started for f in followers):
+            seq, leader_start = leader.started.pop(0)
+            starts = [leader_start]
+            for follower in followers:
+                follower_seq, follower_start = follower.started.pop(0)
+                starts.append(follower_start if follower_seq == seq else float("inf"))
+            spread = max(starts) - min(starts)
+            late = leader_start >= settled_millis and spread > args.tolerance
+            failed |= late
+            print("%4d s  scene %d started within %.1f ms%s" % (
+                leader_start // 1000, seq, spread, "  <-- too far apart" if late else ""))
+
+    for clock in followers:
+        clock.sock.close()
+        clock.filter.close()
+    leader.sock.close()
+    print("FAIL" if failed else "OK")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()